@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if LINUX
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+#include <pattern.h>
+#include <sequence.h>
+#include <wire.h>
+
+#define ANIM_SRC 1
+#include <anim.h>
+#undef ANIM_SRC
+
+/* The frames of a compiled file are sent to the port straight out of the
+   page cache: map_animation maps the file and points an ENCODED into it,
+   store_encoded hands each frame to write() from there and only reads
+   back the responses. */
+
+static int check_animation(ANIM *anim);
+
+
+/* compile <patternfile> <compiledfile> */
+int compile_animation(int myargc, char **myargv)
+{
+  int rc;
+  SEQUENCE seq;
+  ENCODED enc;
+  ANIM_HEADER header;
+  FILE *file;
+  int nread;
+
+  init_sequence(&seq);
+  if (read_sequence(myargv[0], &seq) != RET_SEQUENCE_OK)
+  {
+    fprintf(stderr, "read of patternfile %s has failed\n", myargv[0]);
+    rc = RET_ANIM_ERR_OPEN;
+    goto EXIT;
+  }
+
+  nread = seq.nframes;
+  coalesce_sequence(&seq);
+  if (encode_sequence(&seq, &enc) != RET_SEQUENCE_OK)
+  {
+    rc = RET_ANIM_ERR_MEMORY;
+    goto FREE_EXIT;
+  }
+
+  if ((file = fopen(myargv[1], "wb")) == NULL)
+  {
+    fprintf(stderr, "open of %s has failed\n", myargv[1]);
+    rc = RET_ANIM_ERR_WRITE;
+    goto ENCODED_EXIT;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ANIM_MAGIC, ANIM_MAGIC_LEN);
+  header.nframes = enc.nframes;
+  header.datalen = enc.offsets[enc.nframes];
+  header.hash = enc.hash;
+
+  if ((fwrite(&header, sizeof(header), 1, file) != 1) ||
+      (fwrite(enc.offsets, sizeof(int), enc.nframes + 1, file) !=
+       enc.nframes + 1) ||
+      (fwrite(enc.data, 1, header.datalen, file) != header.datalen))
+  {
+    fclose(file);
+    fprintf(stderr, "write of %s has failed\n", myargv[1]);
+    rc = RET_ANIM_ERR_WRITE;
+    goto ENCODED_EXIT;
+  }
+  if (fclose(file) != 0)
+  {
+    fprintf(stderr, "write of %s has failed\n", myargv[1]);
+    rc = RET_ANIM_ERR_WRITE;
+    goto ENCODED_EXIT;
+  }
+
+  printf("%d patterns read, %d compiled, %d bytes on the wire\n", nread,
+         enc.nframes, header.datalen);
+  rc = RET_ANIM_OK;
+
+ENCODED_EXIT:
+  free_encoded(&enc);
+
+FREE_EXIT:
+  free_sequence(&seq);
+
+EXIT:
+  return rc;
+}
+
+
+/* 1 if path is a compiled animation, 0 if not or it can not be read */
+int is_animation(char *path)
+{
+  FILE *file;
+  char magic[ANIM_MAGIC_LEN];
+  int found;
+
+  if ((file = fopen(path, "rb")) == NULL)
+  {
+    return 0;
+  }
+  found = (fread(magic, ANIM_MAGIC_LEN, 1, file) == 1) &&
+          (memcmp(magic, ANIM_MAGIC, ANIM_MAGIC_LEN) == 0);
+  fclose(file);
+
+  return found;
+}
+
+
+#if LINUX
+
+int map_animation(char *path, ANIM *anim)
+{
+  int rc;
+  int fd;
+  struct stat st;
+
+  memset(anim, 0, sizeof(*anim));
+
+  if ((fd = open(path, O_RDONLY)) == -1)
+  {
+    rc = RET_ANIM_ERR_OPEN;
+    goto EXIT;
+  }
+  if ((fstat(fd, &st) == -1) || (st.st_size < sizeof(ANIM_HEADER)))
+  {
+    rc = RET_ANIM_ERR_FORMAT;
+    goto CLOSE_EXIT;
+  }
+
+  anim->maplen = st.st_size;
+  anim->map = mmap(NULL, anim->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (anim->map == MAP_FAILED)
+  {
+    anim->map = NULL;
+    rc = RET_ANIM_ERR_MEMORY;
+    goto CLOSE_EXIT;
+  }
+  /* the frames are sent once, front to back */
+  madvise(anim->map, anim->maplen, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+  if ((rc = check_animation(anim)) != RET_ANIM_OK)
+  {
+    unmap_animation(anim);
+  }
+
+CLOSE_EXIT:
+  /* the mapping stays without the descriptor */
+  close(fd);
+
+EXIT:
+  return rc;
+}
+
+
+void unmap_animation(ANIM *anim)
+{
+  if (anim->map != NULL)
+  {
+    munmap(anim->map, anim->maplen);
+  }
+  memset(anim, 0, sizeof(*anim));
+}
+
+#endif
+
+#if WIN
+
+/* no mmap here, the file is read into memory in one piece */
+int map_animation(char *path, ANIM *anim)
+{
+  int rc;
+  FILE *file;
+
+  memset(anim, 0, sizeof(*anim));
+
+  if ((file = fopen(path, "rb")) == NULL)
+  {
+    rc = RET_ANIM_ERR_OPEN;
+    goto EXIT;
+  }
+  fseek(file, 0, SEEK_END);
+  anim->maplen = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  if ((anim->maplen < sizeof(ANIM_HEADER)) ||
+      ((anim->map = malloc(anim->maplen)) == NULL) ||
+      (fread(anim->map, anim->maplen, 1, file) != 1))
+  {
+    free(anim->map);
+    anim->map = NULL;
+    rc = RET_ANIM_ERR_FORMAT;
+    goto CLOSE_EXIT;
+  }
+
+  if ((rc = check_animation(anim)) != RET_ANIM_OK)
+  {
+    unmap_animation(anim);
+  }
+
+CLOSE_EXIT:
+  fclose(file);
+
+EXIT:
+  return rc;
+}
+
+
+void unmap_animation(ANIM *anim)
+{
+  free(anim->map);
+  memset(anim, 0, sizeof(*anim));
+}
+
+#endif
+
+
+/* checks the header and the index against the size of the file, then
+   points anim->enc into the mapping */
+static int check_animation(ANIM *anim)
+{
+  ANIM_HEADER *header;
+  int *offsets;
+  long indexlen;
+  int i;
+
+  header = (ANIM_HEADER *) anim->map;
+  if ((memcmp(header->magic, ANIM_MAGIC, ANIM_MAGIC_LEN) != 0) ||
+      (header->nframes < 0) || (header->datalen < 0) ||
+      (header->nframes >= (anim->maplen - (long) sizeof(ANIM_HEADER)) /
+                          (long) sizeof(int)))
+  {
+    return RET_ANIM_ERR_FORMAT;
+  }
+
+  indexlen = (header->nframes + 1) * sizeof(int);
+  if (sizeof(ANIM_HEADER) + indexlen + header->datalen != anim->maplen)
+  {
+    return RET_ANIM_ERR_FORMAT;
+  }
+
+  offsets = (int *) (anim->map + sizeof(ANIM_HEADER));
+  if ((offsets[0] != 0) || (offsets[header->nframes] != header->datalen))
+  {
+    return RET_ANIM_ERR_FORMAT;
+  }
+  for (i = 0; i < header->nframes; i++)
+  {
+    if ((offsets[i + 1] <= offsets[i]) ||
+        (offsets[i + 1] - offsets[i] > MAX_FRAME_LEN))
+    {
+      return RET_ANIM_ERR_FORMAT;
+    }
+  }
+
+  anim->enc.data = anim->map + sizeof(ANIM_HEADER) + indexlen;
+  anim->enc.offsets = offsets;
+  anim->enc.nframes = header->nframes;
+  anim->enc.hash = header->hash;
+
+  return RET_ANIM_OK;
+}
@@ -0,0 +1,46 @@
+#ifndef ANIM_H
+#define ANIM_H
+
+#define RET_ANIM_OK         (0)
+#define RET_ANIM_ERR_OPEN   (1)
+#define RET_ANIM_ERR_WRITE  (2)
+#define RET_ANIM_ERR_FORMAT (3)
+#define RET_ANIM_ERR_MEMORY (4)
+
+/* Compiled animation: the store commands of a pattern file as they go
+   over the wire, written by "mmm8x8 compile". The file is an ANIM_HEADER,
+   nframes + 1 offsets (int) and datalen bytes of frames, frame i from
+   offsets[i] to offsets[i + 1] relative to the first frame. The numbers
+   are in the byte order of the host that wrote it. */
+
+#define ANIM_MAGIC     "MMM8ANI1"
+#define ANIM_MAGIC_LEN (8)
+
+typedef struct {
+  char               magic[ANIM_MAGIC_LEN];
+  int                nframes;
+  int                datalen;
+  unsigned long long hash;        /* as ENCODED, of the frames and durations */
+} ANIM_HEADER;
+
+/* a compiled file mapped into memory, enc points into the mapping */
+typedef struct {
+  ENCODED        enc;
+  unsigned char *map;
+  long           maplen;
+} ANIM;
+
+#if ANIM_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int compile_animation(int myargc, char **myargv);
+EXTERN int is_animation(char *path);
+EXTERN int map_animation(char *path, ANIM *anim);
+EXTERN void unmap_animation(ANIM *anim);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * Example of the asynchronous interface: many coroutines in one thread
+ * show patterns on all given devices, each device gets its share of the
+ * commands in flight.
+ *
+ * Usage: mmm8x8async [options] [<serial device> ...]
+ *   --emulate <n>       add n emulated modules
+ *   --tasks <n>         coroutines showing patterns (default 1000)
+ *   --frames <n>        patterns each coroutine shows (default 10)
+ *   --cancel-after <ms> stop all coroutines after ms
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <pthread.h>
+
+#include <asyncdev.h>
+
+extern "C" {
+#include <emulator.h>
+}
+
+using namespace mmm8x8;
+
+#define DEFAULT_TASKS  (1000)
+#define DEFAULT_FRAMES (10)
+#define NSTATUS        (6)
+
+static int counts[NSTATUS];
+static int in_flight;
+static int max_in_flight;
+
+
+static task<> show_version(device &dev, const char *path)
+{
+  version v = co_await dev.firmware_version();
+
+  if (v.status == status::ok)
+  {
+    printf("%s: firmware version %d.%d.%d\n", path, v.major, v.minor, v.patch);
+  }
+  else
+  {
+    printf("%s: no firmware version, status %d\n", path, (int) v.status);
+  }
+}
+
+
+static task<> show_patterns(device &dev, int first, int frames,
+                            std::stop_token stop)
+{
+  unsigned char pattern[8];
+  response r;
+  int i;
+
+  for (i = 0; i < frames; i++)
+  {
+    // a column moving from the left to the right
+    memset(pattern, 0, sizeof(pattern));
+    pattern[(first + i) % 8] = 0xff;
+
+    in_flight++;
+    if (in_flight > max_in_flight)
+    {
+      max_in_flight = in_flight;
+    }
+    r = co_await dev.display_pattern(pattern,
+                                     clock::now() + std::chrono::seconds(10),
+                                     stop);
+    in_flight--;
+    counts[(int) r.status]++;
+  }
+}
+
+
+static task<> cancel_after(event_loop &loop, std::stop_source &source, int ms)
+{
+  co_await loop.sleep_for(std::chrono::milliseconds(ms));
+  source.request_stop();
+}
+
+
+static void print_usage(void)
+{
+  fprintf(stderr, "Usage: mmm8x8async [--emulate <n>] [--tasks <n>] "
+                  "[--frames <n>] [--cancel-after <ms>]\n"
+                  "                   [<serial device> ...]\n");
+}
+
+
+int main(int argc, char **argv)
+{
+  int rc;
+  EMULATOR *emulator = nullptr;
+  int nemulated = 0;
+  int ntasks = DEFAULT_TASKS;
+  int nframes = DEFAULT_FRAMES;
+  int cancel_ms = 0;
+  std::vector<const char *> paths;
+  std::vector<std::unique_ptr<device>> devices;
+  std::stop_source source;
+  clock::time_point start;
+  long long us;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "--emulate") == 0) && (i + 1 < argc))
+    {
+      nemulated = atoi(argv[++i]);
+    }
+    else if ((strcmp(argv[i], "--tasks") == 0) && (i + 1 < argc))
+    {
+      ntasks = atoi(argv[++i]);
+    }
+    else if ((strcmp(argv[i], "--frames") == 0) && (i + 1 < argc))
+    {
+      nframes = atoi(argv[++i]);
+    }
+    else if ((strcmp(argv[i], "--cancel-after") == 0) && (i + 1 < argc))
+    {
+      cancel_ms = atoi(argv[++i]);
+    }
+    else if (strncmp(argv[i], "--", 2) == 0)
+    {
+      print_usage();
+      return 1;
+    }
+    else
+    {
+      paths.push_back(argv[i]);
+    }
+  }
+
+  if ((nemulated > 0) &&
+      (start_emulator(nemulated, &emulator) != RET_EMULATOR_OK))
+  {
+    fprintf(stderr, "start of %d emulated ports has failed.\n", nemulated);
+    return 1;
+  }
+  for (i = 0; i < nemulated; i++)
+  {
+    paths.push_back(emulator->ports[i].path);
+  }
+  if (paths.empty() || (ntasks <= 0) || (nframes <= 0))
+  {
+    print_usage();
+    rc = 1;
+    goto EXIT;
+  }
+
+  {
+    event_loop loop;
+
+    for (const char *path : paths)
+    {
+      devices.push_back(std::make_unique<device>(loop));
+      if (devices.back()->open(path) != RET_SERIAL_OK)
+      {
+        fprintf(stderr, "open of device %s has failed.\n", path);
+      }
+      loop.spawn(show_version(*devices.back(), path));
+    }
+
+    for (i = 0; i < ntasks; i++)
+    {
+      loop.spawn(show_patterns(*devices[i % devices.size()], i, nframes,
+                               source.get_token()));
+    }
+    if (cancel_ms > 0)
+    {
+      loop.spawn(cancel_after(loop, source, cancel_ms));
+    }
+
+    start = clock::now();
+    loop.run();
+    us = std::chrono::duration_cast<std::chrono::microseconds>(
+           clock::now() - start).count();
+
+    devices.clear();
+  }
+
+  printf("%d devices, %d coroutines, %d commands, at most %d in flight\n",
+         (int) paths.size(), ntasks, ntasks * nframes, max_in_flight);
+  printf("ok %d, nak %d, timeout %d, cancelled %d, io error %d, closed %d, "
+         "%lld.%03lld s\n", counts[(int) status::ok], counts[(int) status::nak],
+         counts[(int) status::timeout], counts[(int) status::cancelled],
+         counts[(int) status::io_error], counts[(int) status::closed],
+         us / 1000000, us / 1000 % 1000);
+
+  rc = (counts[(int) status::ok] == ntasks * nframes) ? 0 : 1;
+
+EXIT:
+  if (emulator != nullptr)
+  {
+    stop_emulator(emulator);
+  }
+
+  return rc;
+}
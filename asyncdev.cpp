@@ -0,0 +1,570 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <asyncdev.h>
+
+extern "C" {
+#include <trace.h>
+}
+
+namespace mmm8x8
+{
+
+constexpr int MAX_EVENTS = 64;
+
+constexpr int CMD_DISPLAY_RSP_LEN = 6;
+constexpr int CMD_VERSION_RSP_LEN = 12;
+
+
+/* sleeper */
+
+sleeper::~sleeper()
+{
+  _loop.remove_timer(this);
+}
+
+
+void sleeper::await_suspend(std::coroutine_handle<> h)
+{
+  _handle = h;
+  _loop.add_timer(this, _when);
+}
+
+
+void sleeper::expire()
+{
+  _loop.resume(_handle);
+}
+
+
+/* command */
+
+command::command(device &dev, char cmd, const unsigned char *params,
+                 int nparam, int rsplen, clock::time_point deadline,
+                 std::stop_token stop)
+  : _device(&dev), _rsplen(rsplen), _deadline(deadline), _stop(stop)
+{
+  _framelen = encode_command(cmd, nparam, const_cast<unsigned char *>(params),
+                             _frame);
+  _response.status = status::ok;
+  _response.length = 0;
+}
+
+
+// a coroutine destroyed while it waits leaves nothing behind
+command::~command()
+{
+  if (_handle)
+  {
+    _handle = nullptr;
+    finish(status::cancelled);
+  }
+}
+
+
+bool command::await_suspend(std::coroutine_handle<> h)
+{
+  if (!_device->_open)
+  {
+    _response.status = status::closed;
+    return false;
+  }
+  if (_stop.stop_requested())
+  {
+    _response.status = status::cancelled;
+    return false;
+  }
+
+  _handle = h;
+  _device->_loop.add_timer(this, _deadline);
+  _stop_callback.emplace(_stop, canceller{this});
+  _device->submit(this);
+
+  return true;
+}
+
+
+void command::expire()
+{
+  finish(status::timeout);
+}
+
+
+// may run on any thread, the loop finishes the command
+void command::canceller::operator()() noexcept
+{
+  cmd->_device->_loop.request_cancel(cmd);
+}
+
+
+/* Takes the command out of the queue, the timers and the device, and
+   resumes the awaiting coroutine with the status. A command on the wire
+   leaves the device draining its response. */
+void command::finish(enum status status)
+{
+  event_loop &loop = _device->_loop;
+
+  _response.status = status;
+  loop.remove_timer(this);
+  if (_queued)
+  {
+    _device->withdraw(this);
+  }
+  if (_device->_owner == this)
+  {
+    _device->_owner = nullptr;
+    _device->_draining = true;
+    loop.add_timer(_device, clock::now() + DRAIN_TIME);
+  }
+
+  // waits for a callback running on another thread
+  _stop_callback.reset();
+  loop.forget_cancel(this);
+
+  if (_handle)
+  {
+    loop.resume(_handle);
+    _handle = nullptr;
+  }
+}
+
+
+version version_command::await_resume() noexcept
+{
+  version v = { _response.status, 0, 0, 0 };
+
+  if ((v.status == status::ok) && (_response.length == CMD_VERSION_RSP_LEN))
+  {
+    v.major = _response.data[4] * 256 + _response.data[5];
+    v.minor = _response.data[6] * 256 + _response.data[7];
+    v.patch = _response.data[8] * 256 + _response.data[9];
+  }
+
+  return v;
+}
+
+
+/* device */
+
+device::device(event_loop &loop)
+  : _loop(loop), _hdl(-1), _open(false), _busy(false), _owner(nullptr),
+    _draining(false)
+{
+}
+
+
+device::~device()
+{
+  close();
+}
+
+
+int device::open(const char *path)
+{
+  int rc;
+
+  close();
+  rc = open_serial(const_cast<char *>(path), &_hdl);
+  if (rc == RET_SERIAL_OK)
+  {
+    _open = true;
+    _loop.watch(this);
+  }
+
+  return rc;
+}
+
+
+void device::close()
+{
+  fail(status::closed);
+}
+
+
+command device::display_pattern(const unsigned char pattern[8],
+                                clock::time_point deadline,
+                                std::stop_token stop)
+{
+  return command(*this, 'D', pattern, 8, CMD_DISPLAY_RSP_LEN, deadline, stop);
+}
+
+
+command device::display_text(const char *text, clock::time_point deadline,
+                             std::stop_token stop)
+{
+  int len = std::min<int>(strlen(text), MAX_PARAMS);
+
+  return command(*this, 'E', reinterpret_cast<const unsigned char *>(text),
+                 len, CMD_DISPLAY_RSP_LEN, deadline, stop);
+}
+
+
+version_command device::firmware_version(clock::time_point deadline,
+                                         std::stop_token stop)
+{
+  return version_command(*this, 'v', nullptr, 0, CMD_VERSION_RSP_LEN,
+                         deadline, stop);
+}
+
+
+void device::submit(command *cmd)
+{
+  _queue.push_back(cmd);
+  cmd->_queued = true;
+  start_next();
+}
+
+
+void device::withdraw(command *cmd)
+{
+  auto it = std::find(_queue.begin(), _queue.end(), cmd);
+
+  if (it != _queue.end())
+  {
+    _queue.erase(it);
+  }
+  cmd->_queued = false;
+}
+
+
+// puts the next queued command on the wire, unless one is still there
+void device::start_next()
+{
+  command *cmd;
+
+  while (!_busy && !_queue.empty() && _open)
+  {
+    cmd = _queue.front();
+    _queue.pop_front();
+    cmd->_queued = false;
+
+    memcpy(_tx, cmd->_frame, cmd->_framelen);
+    _txlen = cmd->_framelen;
+    _written = 0;
+    _rsplen = cmd->_rsplen;
+    _received = 0;
+    _owner = cmd;
+    _busy = true;
+
+    transfer();
+  }
+}
+
+
+/* writes and reads as far as the port allows without blocking,
+   the port is edge triggered, so both go on until EAGAIN */
+void device::transfer()
+{
+  command *cmd;
+  int n;
+
+  while (_written < _txlen)
+  {
+    n = ::write(_hdl, _tx + _written, _txlen - _written);
+    if (n > 0)
+    {
+      trace_bytes(_hdl, TRACE_TX, _tx + _written, n);
+      _written += n;
+    }
+    else if ((n == -1) && (errno == EINTR))
+    {
+      continue;
+    }
+    else if ((n == -1) && (errno == EAGAIN))
+    {
+      return;
+    }
+    else
+    {
+      fail(status::io_error);
+      return;
+    }
+  }
+
+  while (_received < _rsplen)
+  {
+    n = ::read(_hdl, _rx + _received, _rsplen - _received);
+    if (n > 0)
+    {
+      trace_bytes(_hdl, TRACE_RX, _rx + _received, n);
+      _received += n;
+    }
+    else if ((n == -1) && (errno == EINTR))
+    {
+      continue;
+    }
+    else if ((n == -1) && (errno == EAGAIN))
+    {
+      return;
+    }
+    else
+    {
+      fail(status::io_error);
+      return;
+    }
+  }
+
+  _busy = false;
+  if (_draining)
+  {
+    _draining = false;
+    _loop.remove_timer(this);
+  }
+
+  if ((cmd = _owner) != nullptr)
+  {
+    _owner = nullptr;
+    memcpy(cmd->_response.data, _rx, _rsplen);
+    cmd->_response.length = _rsplen;
+    cmd->finish(((_rsplen >= 4) && (_rx[3] == NAK)) ? status::nak :
+                                                      status::ok);
+  }
+}
+
+
+// ends the command on the wire and all queued ones, closes the port
+void device::fail(enum status status)
+{
+  command *cmd;
+
+  _busy = false;
+  if (_draining)
+  {
+    _draining = false;
+    _loop.remove_timer(this);
+  }
+  if ((cmd = _owner) != nullptr)
+  {
+    _owner = nullptr;
+    cmd->finish(status);
+  }
+  while (!_queue.empty())
+  {
+    _queue.front()->finish(status);
+  }
+
+  if (_open)
+  {
+    _open = false;
+    _loop.unwatch(this);
+    close_serial(_hdl);
+  }
+}
+
+
+void device::ready(unsigned int events)
+{
+  if (!_open)
+  {
+    return;
+  }
+  if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN))
+  {
+    fail(status::io_error);
+    return;
+  }
+
+  if (_busy)
+  {
+    transfer();
+  }
+  start_next();
+}
+
+
+// the response of a timed out command has not come, drop what is there
+void device::expire()
+{
+  _draining = false;
+  _busy = false;
+  tcflush(_hdl, TCIFLUSH);
+  start_next();
+}
+
+
+/* event_loop */
+
+event_loop::event_loop()
+  : _finished(0)
+{
+  struct epoll_event ev;
+
+  _epoll = epoll_create1(EPOLL_CLOEXEC);
+  _wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup, &ev);
+}
+
+
+event_loop::~event_loop()
+{
+  _tasks.clear();
+  ::close(_wakeup);
+  ::close(_epoll);
+}
+
+
+void event_loop::spawn(task<> t)
+{
+  std::coroutine_handle<> h = t._handle;
+
+  t._handle.promise()._finished = &_finished;
+  _tasks.push_back(std::move(t));
+  resume(h);
+}
+
+
+void event_loop::run()
+{
+  struct epoll_event events[MAX_EVENTS];
+  std::coroutine_handle<> h;
+  clock::time_point now;
+  timer *t;
+  uint64_t count;
+  int timeout;
+  int n;
+  int i;
+
+  for (;;)
+  {
+    while (!_ready.empty())
+    {
+      h = _ready.front();
+      _ready.pop_front();
+      h.resume();
+    }
+
+    if (_finished > 0)
+    {
+      _tasks.remove_if([](const task<> &t) { return t.done(); });
+      _finished = 0;
+    }
+    if (_tasks.empty())
+    {
+      break;
+    }
+
+    timeout = -1;
+    if (!_timers.empty())
+    {
+      now = clock::now();
+      timeout = 0;
+      if (_timers.begin()->first > now)
+      {
+        // round up, an early wakeup would just wait again
+        timeout = std::chrono::ceil<std::chrono::milliseconds>(
+                    _timers.begin()->first - now).count();
+      }
+    }
+
+    n = epoll_wait(_epoll, events, MAX_EVENTS, timeout);
+    for (i = 0; i < n; i++)
+    {
+      if (events[i].data.ptr == nullptr)
+      {
+        if (::read(_wakeup, &count, sizeof(count)) == sizeof(count))
+        {
+          run_cancels();
+        }
+      }
+      else
+      {
+        static_cast<device *>(events[i].data.ptr)->ready(events[i].events);
+      }
+    }
+
+    now = clock::now();
+    while (!_timers.empty() && (_timers.begin()->first <= now))
+    {
+      t = _timers.begin()->second;
+      _timers.erase(_timers.begin());
+      t->_armed = false;
+      t->expire();
+    }
+  }
+}
+
+
+void event_loop::add_timer(timer *t, clock::time_point when)
+{
+  remove_timer(t);
+  t->_slot = _timers.emplace(when, t);
+  t->_armed = true;
+}
+
+
+void event_loop::remove_timer(timer *t)
+{
+  if (t->_armed)
+  {
+    _timers.erase(t->_slot);
+    t->_armed = false;
+  }
+}
+
+
+void event_loop::watch(device *dev)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.ptr = dev;
+  epoll_ctl(_epoll, EPOLL_CTL_ADD, dev->_hdl, &ev);
+}
+
+
+void event_loop::unwatch(device *dev)
+{
+  epoll_ctl(_epoll, EPOLL_CTL_DEL, dev->_hdl, nullptr);
+}
+
+
+void event_loop::request_cancel(command *cmd)
+{
+  uint64_t one = 1;
+
+  {
+    std::lock_guard<std::mutex> lock(_cancel_lock);
+    _cancels.push_back(cmd);
+  }
+  if (::write(_wakeup, &one, sizeof(one)) != sizeof(one))
+  {
+    // the counter is already set, the loop wakes up anyway
+  }
+}
+
+
+void event_loop::forget_cancel(command *cmd)
+{
+  std::lock_guard<std::mutex> lock(_cancel_lock);
+
+  _cancels.erase(std::remove(_cancels.begin(), _cancels.end(), cmd),
+                 _cancels.end());
+}
+
+
+void event_loop::run_cancels()
+{
+  std::vector<command *> cancels;
+
+  {
+    std::lock_guard<std::mutex> lock(_cancel_lock);
+    cancels.swap(_cancels);
+  }
+  for (command *cmd : cancels)
+  {
+    cmd->finish(status::cancelled);
+  }
+}
+
+}
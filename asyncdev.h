@@ -0,0 +1,372 @@
+/*
+ * Asynchronous C++20 interface to MMM8x8 modules on the host (Linux only)
+ *
+ * One event_loop owns the serial ports of its devices and drives any
+ * number of coroutines in a single thread:
+ *
+ *   mmm8x8::task<> show(mmm8x8::device &dev, const unsigned char *frame)
+ *   {
+ *     mmm8x8::version v = co_await dev.firmware_version();
+ *     mmm8x8::response r = co_await dev.display_pattern(frame);
+ *     ...
+ *   }
+ *
+ *   mmm8x8::event_loop loop;
+ *   mmm8x8::device dev(loop);
+ *   dev.open("/dev/ttyUSB0");
+ *   loop.spawn(show(dev, frame));
+ *   loop.run();
+ *
+ * A module answers one command at a time, so the commands of a device are
+ * queued and sent one after the other, the commands of different devices
+ * are in flight at the same time. Every command has a deadline (by default
+ * DEFAULT_TIMEOUT from now) and may be given a std::stop_token. A command
+ * that misses its deadline or is stopped is resumed at once with
+ * status::timeout or status::cancelled. If it was already on the wire,
+ * its response is still waited for (at most DRAIN_TIME) and dropped, so
+ * the next command does not read it.
+ *
+ * Everything except request_stop() on the stop_source must be called from
+ * the thread that runs the loop. No exceptions are thrown, a coroutine
+ * that throws terminates the program.
+ */
+
+#ifndef ASYNCDEV_H
+#define ASYNCDEV_H
+
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <vector>
+
+extern "C" {
+#include <serial.h>
+#include <wire.h>
+}
+
+namespace mmm8x8
+{
+
+using clock = std::chrono::steady_clock;
+
+constexpr clock::duration DEFAULT_TIMEOUT = std::chrono::milliseconds(500);
+constexpr clock::duration DRAIN_TIME = std::chrono::milliseconds(100);
+
+constexpr int MAX_RESPONSE_LEN = 12;
+
+enum class status
+{
+  ok,
+  nak,              // the module has refused the command
+  timeout,          // the deadline has passed
+  cancelled,        // the stop_token was stopped
+  io_error,         // the port has failed, the device is closed
+  closed            // the device is not open
+};
+
+struct response
+{
+  enum status status;
+  unsigned char data[MAX_RESPONSE_LEN];
+  int length;
+};
+
+struct version
+{
+  enum status status;
+  int major;
+  int minor;
+  int patch;
+};
+
+class event_loop;
+class device;
+
+
+// coroutine type, started by co_await or by event_loop::spawn
+template <typename T = void>
+class task;
+
+template <typename T>
+class task_promise_base
+{
+ public:
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  struct final_awaiter
+  {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+    {
+      std::coroutine_handle<> next = h.promise()._continuation;
+      if (!next && h.promise()._finished)
+      {
+        // a spawned task, the loop frees it
+        ++*h.promise()._finished;
+      }
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+  final_awaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() noexcept { std::terminate(); }
+
+  std::coroutine_handle<> _continuation;
+  int *_finished = nullptr;
+};
+
+template <typename T>
+class task_promise : public task_promise_base<T>
+{
+ public:
+  task<T> get_return_object() noexcept;
+  void return_value(T value) { _value = std::move(value); }
+
+  std::optional<T> _value;
+};
+
+template <>
+class task_promise<void> : public task_promise_base<void>
+{
+ public:
+  task<void> get_return_object() noexcept;
+  void return_void() noexcept {}
+};
+
+template <typename T>
+class task
+{
+ public:
+  using promise_type = task_promise<T>;
+
+  explicit task(std::coroutine_handle<promise_type> h) : _handle(h) {}
+  task(task &&other) noexcept : _handle(other._handle) { other._handle = {}; }
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  ~task() { if (_handle) _handle.destroy(); }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept
+  {
+    _handle.promise()._continuation = h;
+    return _handle;
+  }
+  T await_resume()
+  {
+    if constexpr (!std::is_void_v<T>)
+    {
+      return std::move(*_handle.promise()._value);
+    }
+  }
+
+  bool done() const noexcept { return !_handle || _handle.done(); }
+
+ private:
+  friend class event_loop;
+  std::coroutine_handle<promise_type> _handle;
+};
+
+template <typename T>
+task<T> task_promise<T>::get_return_object() noexcept
+{
+  return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept
+{
+  return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+
+// something the loop calls back when its time has come
+class timer
+{
+ public:
+  virtual ~timer() = default;
+
+ protected:
+  friend class event_loop;
+  virtual void expire() = 0;
+
+  std::multimap<clock::time_point, timer *>::iterator _slot;
+  bool _armed = false;
+};
+
+
+// awaitable of event_loop::sleep_until
+class sleeper : public timer
+{
+ public:
+  sleeper(event_loop &loop, clock::time_point when) : _loop(loop), _when(when) {}
+  sleeper(const sleeper &) = delete;
+  ~sleeper();
+
+  bool await_ready() const noexcept { return clock::now() >= _when; }
+  void await_suspend(std::coroutine_handle<> h);
+  void await_resume() noexcept {}
+
+ private:
+  void expire() override;
+
+  event_loop &_loop;
+  clock::time_point _when;
+  std::coroutine_handle<> _handle;
+};
+
+
+// awaitable of a command, it lives in the frame of the awaiting coroutine
+class command : public timer
+{
+ public:
+  command(const command &) = delete;
+  command &operator=(const command &) = delete;
+  ~command();
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> h);
+  response await_resume() noexcept { return _response; }
+
+ protected:
+  friend class device;
+  friend class event_loop;
+
+  command(device &dev, char cmd, const unsigned char *params, int nparam,
+          int rsplen, clock::time_point deadline, std::stop_token stop);
+
+  void expire() override;
+  void finish(enum status status);
+
+  struct canceller
+  {
+    command *cmd;
+    void operator()() noexcept;
+  };
+
+  device *_device;
+  unsigned char _frame[MAX_FRAME_LEN];
+  int _framelen;
+  int _rsplen;
+  clock::time_point _deadline;
+  std::stop_token _stop;
+  std::optional<std::stop_callback<canceller>> _stop_callback;
+  std::coroutine_handle<> _handle;
+  bool _queued = false;
+  response _response;
+};
+
+
+class version_command : public command
+{
+ public:
+  version await_resume() noexcept;
+
+ private:
+  friend class device;
+  using command::command;
+};
+
+
+// one module on a serial port
+class device : public timer
+{
+ public:
+  explicit device(event_loop &loop);
+  device(const device &) = delete;
+  device &operator=(const device &) = delete;
+  ~device();
+
+  // returns RET_SERIAL_OK or the error of open_serial
+  int open(const char *path);
+  // commands still queued finish with status::closed
+  void close();
+  bool is_open() const noexcept { return _open; }
+
+  command display_pattern(const unsigned char pattern[8],
+                          clock::time_point deadline = clock::now() + DEFAULT_TIMEOUT,
+                          std::stop_token stop = {});
+  command display_text(const char *text,
+                       clock::time_point deadline = clock::now() + DEFAULT_TIMEOUT,
+                       std::stop_token stop = {});
+  version_command firmware_version(clock::time_point deadline = clock::now() + DEFAULT_TIMEOUT,
+                                   std::stop_token stop = {});
+
+ private:
+  friend class command;
+  friend class event_loop;
+
+  void submit(command *cmd);
+  void withdraw(command *cmd);
+  void start_next();
+  void transfer();
+  void fail(enum status status);
+  void ready(unsigned int events);
+  void expire() override;
+
+  event_loop &_loop;
+  SERHDL _hdl;
+  bool _open;
+  std::deque<command *> _queue;
+
+  // the command on the wire, its owner is gone once it timed out
+  bool _busy;
+  command *_owner;
+  unsigned char _tx[MAX_FRAME_LEN];
+  int _txlen;
+  int _written;
+  unsigned char _rx[MAX_RESPONSE_LEN];
+  int _rsplen;
+  int _received;
+  bool _draining;
+};
+
+
+class event_loop
+{
+ public:
+  event_loop();
+  event_loop(const event_loop &) = delete;
+  event_loop &operator=(const event_loop &) = delete;
+  ~event_loop();
+
+  // runs the task, the loop keeps it until it has finished
+  void spawn(task<> t);
+  // returns when all spawned tasks have finished
+  void run();
+
+  sleeper sleep_until(clock::time_point when) { return sleeper(*this, when); }
+  sleeper sleep_for(clock::duration d) { return sleeper(*this, clock::now() + d); }
+
+ private:
+  friend class command;
+  friend class device;
+  friend class sleeper;
+
+  void add_timer(timer *t, clock::time_point when);
+  void remove_timer(timer *t);
+  void resume(std::coroutine_handle<> h) { _ready.push_back(h); }
+  void watch(device *dev);
+  void unwatch(device *dev);
+  void request_cancel(command *cmd);
+  void forget_cancel(command *cmd);
+  void run_cancels();
+
+  int _epoll;
+  int _wakeup;
+  std::list<task<>> _tasks;
+  int _finished;
+  std::deque<std::coroutine_handle<>> _ready;
+  std::multimap<clock::time_point, timer *> _timers;
+  std::mutex _cancel_lock;
+  std::vector<command *> _cancels;
+};
+
+}
+
+#endif
@@ -0,0 +1,205 @@
+#if LINUX
+#  define _GNU_SOURCE     /* RUSAGE_THREAD */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if LINUX
+#  include <sys/time.h>
+#  include <sys/resource.h>
+#endif
+
+#include <serial.h>
+#include <wire.h>
+#include <clock.h>
+#include <emulator.h>
+
+/* Compares the CPU time per frame of the serial backends with 1, 16 and
+   64 emulated modules. Every round sends one displaypattern command to
+   all modules and reads all acknowledges:
+     select  write_serial and read_serial, one port after the other
+     poll    transfer_serial with poll()
+     uring   transfer_serial with io_uring
+   Only the time of the sending thread is counted, not the emulator.
+   Usage: mmm8x8bench [frames per port] */
+
+#define RET_BENCH_OK    (0)
+#define RET_BENCH_ERR   (1)
+
+#define DEFAULT_ROUNDS  (2000)
+#define BENCH_RSP_LEN   (6)
+#define BENCH_TIMEOUT   (1000)
+
+#define BACKEND_SELECT  (-1)
+
+static int run_bench(int nports, int backend, int rounds);
+static long long thread_cpu_us(void);
+
+
+int main(int argc, char **argv)
+{
+  int rc;
+  static int nports[] = { 1, 16, 64 };
+  static int backends[] = { BACKEND_SELECT, SERIAL_BACKEND_POLL,
+                            SERIAL_BACKEND_URING };
+  int rounds;
+  int i;
+  int k;
+
+  rounds = (argc > 1) ? atoi(argv[1]) : DEFAULT_ROUNDS;
+  if (rounds <= 0)
+  {
+    fprintf(stderr, "Usage: mmm8x8bench [frames per port]\n");
+    rc = RET_BENCH_ERR;
+    goto EXIT;
+  }
+
+  printf("ports backend    frames   wall ms  frames/s  cpu us/frame\n");
+  rc = RET_BENCH_OK;
+  for (i = 0; i < sizeof(nports) / sizeof(nports[0]); i++)
+  {
+    for (k = 0; k < sizeof(backends) / sizeof(backends[0]); k++)
+    {
+      if (run_bench(nports[i], backends[k], rounds) != RET_BENCH_OK)
+      {
+        rc = RET_BENCH_ERR;
+      }
+    }
+  }
+
+EXIT:
+  return rc;
+}
+
+
+static int run_bench(int nports, int backend, int rounds)
+{
+  int rc;
+  EMULATOR *emulator;
+  SERIO *ios;
+  unsigned char frame[MAX_FRAME_LEN];
+  unsigned char *responses;
+  unsigned char pattern[8];
+  int len;
+  int opened;
+  int round;
+  int i;
+  long frames;
+  long long start;
+  long long cpu;
+  long long wall;
+  char *name;
+
+  if (start_emulator(nports, &emulator) != RET_EMULATOR_OK)
+  {
+    fprintf(stderr, "start of %d emulated ports has failed.\n", nports);
+    rc = RET_BENCH_ERR;
+    goto EXIT;
+  }
+
+  ios = calloc(nports, sizeof(SERIO));
+  responses = malloc(nports * BENCH_RSP_LEN);
+  if ((ios == NULL) || (responses == NULL))
+  {
+    rc = RET_BENCH_ERR;
+    goto FREE_EXIT;
+  }
+
+  memset(pattern, 0x55, sizeof(pattern));
+  len = encode_command('D', sizeof(pattern), pattern, frame);
+  for (opened = 0; opened < nports; opened++)
+  {
+    if (open_serial(emulator->ports[opened].path, &ios[opened].hdl) !=
+        RET_SERIAL_OK)
+    {
+      fprintf(stderr, "open of device %s has failed.\n",
+              emulator->ports[opened].path);
+      rc = RET_BENCH_ERR;
+      goto CLOSE_EXIT;
+    }
+    ios[opened].tx = frame;
+    ios[opened].txlen = len;
+    ios[opened].rx = responses + opened * BENCH_RSP_LEN;
+    ios[opened].rxlen = BENCH_RSP_LEN;
+  }
+
+  name = "select";
+  if (backend != BACKEND_SELECT)
+  {
+    if (select_serial_backend(backend) != backend)
+    {
+      printf("%5d %-8s io_uring is not available\n", nports, "uring");
+      rc = RET_BENCH_OK;
+      goto CLOSE_EXIT;
+    }
+    name = (backend == SERIAL_BACKEND_URING) ? "uring" : "poll";
+  }
+
+  frames = 0;
+  start = get_time_us();
+  cpu = thread_cpu_us();
+  for (round = 0; round < rounds; round++)
+  {
+    if (backend == BACKEND_SELECT)
+    {
+      for (i = 0; i < nports; i++)
+      {
+        if ((write_serial(ios[i].hdl, frame, len) == len) &&
+            (read_serial(ios[i].hdl, ios[i].rx, BENCH_RSP_LEN) ==
+             BENCH_RSP_LEN))
+        {
+          frames++;
+        }
+      }
+    }
+    else
+    {
+      frames += transfer_serial(ios, nports, BENCH_TIMEOUT);
+    }
+  }
+  cpu = thread_cpu_us() - cpu;
+  wall = get_time_us() - start;
+
+  printf("%5d %-8s %8ld %9lld %9lld %13.2f\n", nports, name, frames,
+         wall / 1000, (wall > 0) ? frames * 1000000LL / wall : 0,
+         (frames > 0) ? (double) cpu / frames : 0.0);
+
+  rc = (frames == (long) rounds * nports) ? RET_BENCH_OK : RET_BENCH_ERR;
+  if (rc != RET_BENCH_OK)
+  {
+    fprintf(stderr, "%ld of %ld frames have been acknowledged.\n", frames,
+            (long) rounds * nports);
+  }
+
+CLOSE_EXIT:
+  for (i = 0; i < opened; i++)
+  {
+    close_serial(ios[i].hdl);
+  }
+
+FREE_EXIT:
+  free(responses);
+  free(ios);
+  stop_emulator(emulator);
+
+EXIT:
+  return rc;
+}
+
+
+/* user and system time of the calling thread */
+static long long thread_cpu_us(void)
+{
+#if LINUX
+  struct rusage usage;
+
+  getrusage(RUSAGE_THREAD, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#else
+  return 0;
+#endif
+}
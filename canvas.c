@@ -0,0 +1,573 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <font.h>
+#include <clock.h>
+#include <portlock.h>
+#include <wire.h>
+
+#define CANVAS_SRC 1
+#include <canvas.h>
+#undef CANVAS_SRC
+
+/* A canvas is a grid of modules, each one addressed by its own serial
+   device. The layout file has one line per module:
+     <serial device> <column> <row>
+   where column and row count modules, 0 0 is the top left one.
+   Empty lines and lines starting with # are skipped.
+   Every frame goes to all modules in one transfer_serial, so a large
+   canvas is driven by the one thread without a syscall per module. */
+
+#define RET_CANVAS_OK         (0)
+#define RET_CANVAS_ERR_LAYOUT (1)
+#define RET_CANVAS_ERR_OPEN   (2)
+#define RET_CANVAS_ERR_SEND   (3)
+
+#define MAX_MODULES (64)
+#define MAX_LAYOUT_LINE (1024)
+#define DEFAULT_SCROLL_FPS (10)
+#define US_PER_DURATION (100000)
+#define CMD_CANVAS_RSP_LEN (6)
+
+typedef struct {
+  char          *device;
+  char           lockfile[PATH_MAX];
+  int            x;               /* position in modules */
+  int            y;
+  SERHDL         hdl;
+  PORTLOCK       lock;
+  unsigned char  pattern[LINES_PER_PATTERN];
+  unsigned char  frame[MAX_FRAME_LEN];
+  unsigned char  response[CMD_CANVAS_RSP_LEN];
+} MODULE;
+
+typedef struct {
+  MODULE         modules[MAX_MODULES];
+  SERIO          ios[MAX_MODULES];
+  int            nmodules;
+  int            width;           /* pixels */
+  int            height;
+  long           frames;
+  long           skewed;          /* frames acknowledged by two or more */
+  long long      skew_sum;
+  long long      skew_max;
+} CANVAS;
+
+static int read_layout(char *path, CANVAS *canvas);
+static void free_layout(CANVAS *canvas);
+static int lock_canvas(CANVAS *canvas);
+static void unlock_canvas(CANVAS *canvas);
+static int compare_devices(const void *a, const void *b);
+static int open_canvas(CANVAS *canvas);
+static void close_canvas(CANVAS *canvas);
+static int push_canvas(CANVAS *canvas, unsigned char *bitmap);
+static int show_bitmaps(CANVAS *canvas, char *path);
+static int scroll_text(CANVAS *canvas, char *text);
+static void wait_until(long long due);
+
+
+int draw_canvas(int myargc, char **myargv)
+{
+  int rc;
+  CANVAS *canvas;
+
+  if ((canvas = calloc(1, sizeof(CANVAS))) == NULL)
+  {
+    rc = RET_CANVAS_ERR_LAYOUT;
+    goto EXIT;
+  }
+
+  if ((rc = read_layout(myargv[0], canvas)) != RET_CANVAS_OK)
+  {
+    fprintf(stderr, "read of layout %s has failed\n", myargv[0]);
+    goto FREE_EXIT;
+  }
+
+  if ((strcmp(myargv[1], "bitmap") != 0) && (strcmp(myargv[1], "text") != 0))
+  {
+    fprintf(stderr, "canvas shows a bitmap or a text.\n");
+    rc = RET_CANVAS_ERR_LAYOUT;
+    goto FREE_EXIT;
+  }
+
+  if ((rc = open_canvas(canvas)) != RET_CANVAS_OK)
+  {
+    goto FREE_EXIT;
+  }
+
+  if (strcmp(myargv[1], "bitmap") == 0)
+  {
+    rc = show_bitmaps(canvas, myargv[2]);
+  }
+  else
+  {
+    rc = scroll_text(canvas, myargv[2]);
+  }
+
+  if (canvas->skewed > 0)
+  {
+    printf("%d modules, %ld frames, skew between modules %lld.%03lld ms "
+           "average, %lld.%03lld ms max\n", canvas->nmodules, canvas->frames,
+           canvas->skew_sum / canvas->skewed / 1000,
+           canvas->skew_sum / canvas->skewed % 1000,
+           canvas->skew_max / 1000, canvas->skew_max % 1000);
+  }
+  else if (canvas->frames > 0)
+  {
+    printf("%d modules, %ld frames\n", canvas->nmodules, canvas->frames);
+  }
+
+  close_canvas(canvas);
+
+FREE_EXIT:
+  free_layout(canvas);
+  free(canvas);
+
+EXIT:
+  return rc;
+}
+
+
+static int read_layout(char *path, CANVAS *canvas)
+{
+  int rc;
+  FILE *file;
+  char line[MAX_LAYOUT_LINE];
+  char device[MAX_LAYOUT_LINE];
+  MODULE *module;
+  int x;
+  int y;
+  int i;
+
+  if ((file = fopen(path, "r")) == NULL)
+  {
+    rc = RET_CANVAS_ERR_LAYOUT;
+    goto EXIT;
+  }
+
+  rc = RET_CANVAS_OK;
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    if (sscanf(line, "%s", device) != 1 || device[0] == '#')
+    {
+      continue;
+    }
+    if ((sscanf(line, "%s %d %d", device, &x, &y) != 3) ||
+        (x < 0) || (y < 0) || (canvas->nmodules == MAX_MODULES))
+    {
+      rc = RET_CANVAS_ERR_LAYOUT;
+      break;
+    }
+
+    module = &canvas->modules[canvas->nmodules];
+    if (get_lockfile(device, module->lockfile, sizeof(module->lockfile)) !=
+        RET_PORTLOCK_OK)
+    {
+      rc = RET_CANVAS_ERR_LAYOUT;
+      break;
+    }
+
+    /* a position shows one module, a module one position, links to a
+       device name the same module */
+    for (i = 0; i < canvas->nmodules; i++)
+    {
+      if ((canvas->modules[i].x == x) && (canvas->modules[i].y == y))
+      {
+        fprintf(stderr, "two modules at %d %d.\n", x, y);
+        break;
+      }
+      if (strcmp(canvas->modules[i].lockfile, module->lockfile) == 0)
+      {
+        fprintf(stderr, "device %s is in the layout twice, as %s.\n",
+                device, canvas->modules[i].device);
+        break;
+      }
+    }
+    if (i < canvas->nmodules)
+    {
+      rc = RET_CANVAS_ERR_LAYOUT;
+      break;
+    }
+
+    canvas->nmodules++;
+    module->device = strdup(device);
+    module->x = x;
+    module->y = y;
+
+    if ((x + 1) * COLUMNS_PER_PATTERN > canvas->width)
+    {
+      canvas->width = (x + 1) * COLUMNS_PER_PATTERN;
+    }
+    if ((y + 1) * LINES_PER_PATTERN > canvas->height)
+    {
+      canvas->height = (y + 1) * LINES_PER_PATTERN;
+    }
+  }
+
+  if (canvas->nmodules == 0)
+  {
+    rc = RET_CANVAS_ERR_LAYOUT;
+  }
+
+  fclose(file);
+
+EXIT:
+  return rc;
+}
+
+
+static void free_layout(CANVAS *canvas)
+{
+  int i;
+
+  for (i = 0; i < canvas->nmodules; i++)
+  {
+    free(canvas->modules[i].device);
+  }
+}
+
+
+/* locks and opens all modules */
+static int open_canvas(CANVAS *canvas)
+{
+  int rc;
+  int i;
+  MODULE *module;
+
+  if (!cmd_options.dryrun && (lock_canvas(canvas) != RET_CANVAS_OK))
+  {
+    rc = RET_CANVAS_ERR_OPEN;
+    goto EXIT;
+  }
+
+  for (i = 0; !cmd_options.dryrun && (i < canvas->nmodules); i++)
+  {
+    module = &canvas->modules[i];
+    if (open_serial(module->device, &module->hdl) != RET_SERIAL_OK)
+    {
+      fprintf(stderr, "open of device %s has failed.\n", module->device);
+      while (--i >= 0)
+      {
+        close_serial(canvas->modules[i].hdl);
+      }
+      unlock_canvas(canvas);
+      rc = RET_CANVAS_ERR_OPEN;
+      goto EXIT;
+    }
+  }
+
+  rc = RET_CANVAS_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static void close_canvas(CANVAS *canvas)
+{
+  int i;
+
+  if (cmd_options.dryrun)
+  {
+    return;
+  }
+
+  for (i = 0; i < canvas->nmodules; i++)
+  {
+    close_serial(canvas->modules[i].hdl);
+  }
+  unlock_canvas(canvas);
+}
+
+
+/* queues for the devices in the order of their lock files, two canvases
+   that share modules can not each hold one the other waits for, whatever
+   links they name the devices by */
+static int lock_canvas(CANVAS *canvas)
+{
+  int rc;
+  MODULE *order[MAX_MODULES];
+  int i;
+
+  for (i = 0; i < canvas->nmodules; i++)
+  {
+    canvas->modules[i].lock.fd = -1;
+    order[i] = &canvas->modules[i];
+  }
+  qsort(order, canvas->nmodules, sizeof(order[0]), compare_devices);
+
+  for (i = 0; i < canvas->nmodules; i++)
+  {
+    if (lock_port(order[i]->device, cmd_options.wait, &order[i]->lock) !=
+        RET_PORTLOCK_OK)
+    {
+      fprintf(stderr, "device %s is busy.\n", order[i]->device);
+      unlock_canvas(canvas);
+      rc = RET_CANVAS_ERR_OPEN;
+      goto EXIT;
+    }
+  }
+
+  rc = RET_CANVAS_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static void unlock_canvas(CANVAS *canvas)
+{
+  int i;
+
+  for (i = 0; i < canvas->nmodules; i++)
+  {
+    unlock_port(&canvas->modules[i].lock);
+  }
+}
+
+
+static int compare_devices(const void *a, const void *b)
+{
+  return strcmp((*(MODULE **) a)->lockfile, (*(MODULE **) b)->lockfile);
+}
+
+
+/* Slices the bitmap (width x height, one byte per pixel) into one pattern
+   per module and exchanges them with all modules at once. The skew is the
+   time between the first and the last acknowledge, a frame that fewer
+   than two modules have acknowledged has none. */
+static int push_canvas(CANVAS *canvas, unsigned char *bitmap)
+{
+  int rc;
+  int i;
+  int line;
+  int column;
+  MODULE *module;
+  SERIO *io;
+  unsigned char *pixel;
+  long long first;
+  long long last;
+  int acked;
+
+  for (i = 0; i < canvas->nmodules; i++)
+  {
+    module = &canvas->modules[i];
+    for (column = 0; column < COLUMNS_PER_PATTERN; column++)
+    {
+      module->pattern[column] = 0;
+      pixel = bitmap + module->y * LINES_PER_PATTERN * canvas->width +
+              module->x * COLUMNS_PER_PATTERN + column;
+      for (line = 0; line < LINES_PER_PATTERN; line++)
+      {
+        if (pixel[line * canvas->width])
+        {
+          module->pattern[column] |= 1 << line;
+        }
+      }
+    }
+
+    io = &canvas->ios[i];
+    io->hdl = module->hdl;
+    io->tx = module->frame;
+    io->txlen = encode_command('D', LINES_PER_PATTERN, module->pattern,
+                               module->frame);
+    io->rx = module->response;
+    io->rxlen = CMD_CANVAS_RSP_LEN;
+  }
+
+  exchange_frames(canvas->ios, canvas->nmodules);
+
+  rc = RET_CANVAS_OK;
+  first = 0;
+  last = 0;
+  acked = 0;
+  for (i = 0; i < canvas->nmodules; i++)
+  {
+    io = &canvas->ios[i];
+    if (io->rc != RET_COMMAND_OK)
+    {
+      fprintf(stderr, "sending to device %s has failed.\n",
+              canvas->modules[i].device);
+      rc = RET_CANVAS_ERR_SEND;
+      continue;
+    }
+    acked++;
+    if ((first == 0) || (io->done_us < first))
+    {
+      first = io->done_us;
+    }
+    if (io->done_us > last)
+    {
+      last = io->done_us;
+    }
+  }
+
+  canvas->frames++;
+  if (acked < 2)
+  {
+    return rc;
+  }
+  canvas->skewed++;
+  canvas->skew_sum += last - first;
+  if (last - first > canvas->skew_max)
+  {
+    canvas->skew_max = last - first;
+  }
+
+  return rc;
+}
+
+
+/* Shows the bitmaps of a file, each one is as high as the canvas and
+   separated by a line with the optional duration, like a pattern file. */
+static int show_bitmaps(CANVAS *canvas, char *path)
+{
+  int rc;
+  FILE *file;
+  unsigned char *bitmap;
+  unsigned char duration;
+  int line;
+  int more;
+  long long due;
+
+  if ((bitmap = malloc(canvas->width * canvas->height)) == NULL)
+  {
+    rc = RET_CANVAS_ERR_LAYOUT;
+    goto EXIT;
+  }
+
+  if (open_patternfile(path, &file) != RET_PATTERN_OK)
+  {
+    fprintf(stderr, "open of bitmap %s has failed\n", path);
+    rc = RET_CANVAS_ERR_LAYOUT;
+    goto FREE_EXIT;
+  }
+
+  rc = RET_CANVAS_OK;
+  due = get_time_us();
+  more = 1;
+  while (more)
+  {
+    for (line = 0; line < canvas->height; line++)
+    {
+      if (read_patternline(file, bitmap + line * canvas->width,
+                           canvas->width) != RET_PATTERN_OK)
+      {
+        break;
+      }
+    }
+    if (line < canvas->height)
+    {
+      if ((line > 0) || (canvas->frames == 0))
+      {
+        fprintf(stderr, "read of bitmap %s has failed\n", path);
+        rc = RET_CANVAS_ERR_LAYOUT;
+      }
+      break;
+    }
+    if (read_patternduration(file, &duration) != RET_PATTERN_OK)
+    {
+      more = 0;
+    }
+    if (!more || (duration == 0))
+    {
+      duration = DEFAULT_DURATION;
+    }
+
+    wait_until(due);
+    if ((rc = push_canvas(canvas, bitmap)) != RET_CANVAS_OK)
+    {
+      break;
+    }
+    due += (long long) duration * US_PER_DURATION;
+  }
+
+  close_patternfile(file);
+
+FREE_EXIT:
+  free(bitmap);
+
+EXIT:
+  return rc;
+}
+
+
+/* Scrolls the text from the right to the left through the top row of
+   modules, one column per frame at --fps (default 10) frames/s. */
+static int scroll_text(CANVAS *canvas, char *text)
+{
+  int rc;
+  unsigned char *bitmap;
+  unsigned char *columns;
+  int ncolumns;
+  int offset;
+  int column;
+  int line;
+  int i;
+  long long due;
+  long long period;
+
+  /* blank canvas width in front, so the text comes in from the right,
+     one blank column after each character */
+  ncolumns = canvas->width + strlen(text) * (GLYPH_WIDTH + 1);
+  bitmap = malloc(canvas->width * canvas->height);
+  columns = calloc(ncolumns, 1);
+  if ((bitmap == NULL) || (columns == NULL))
+  {
+    rc = RET_CANVAS_ERR_LAYOUT;
+    goto FREE_EXIT;
+  }
+  for (i = 0; text[i] != '\0'; i++)
+  {
+    get_glyph(text[i], columns + canvas->width + i * (GLYPH_WIDTH + 1));
+  }
+
+  period = 1000000 / ((cmd_options.fps > 0) ? cmd_options.fps :
+                                              DEFAULT_SCROLL_FPS);
+  rc = RET_CANVAS_OK;
+  due = get_time_us();
+  for (offset = 0; offset < ncolumns; offset++)
+  {
+    memset(bitmap, 0, canvas->width * canvas->height);
+    for (column = 0; column < canvas->width; column++)
+    {
+      if (offset + column >= ncolumns)
+      {
+        break;
+      }
+      for (line = 0; line < LINES_PER_PATTERN; line++)
+      {
+        bitmap[line * canvas->width + column] =
+          (columns[offset + column] >> line) & 1;
+      }
+    }
+
+    wait_until(due);
+    if ((rc = push_canvas(canvas, bitmap)) != RET_CANVAS_OK)
+    {
+      break;
+    }
+    due += period;
+  }
+
+FREE_EXIT:
+  free(columns);
+  free(bitmap);
+
+  return rc;
+}
+
+
+static void wait_until(long long due)
+{
+  if (!cmd_options.dryrun)
+  {
+    sleep_us(due - get_time_us());
+  }
+}
@@ -0,0 +1,14 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#if CANVAS_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int draw_canvas(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
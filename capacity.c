@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <state.h>
+
+#define CAPACITY_SRC 1
+#include <capacity.h>
+#undef CAPACITY_SRC
+
+/* The module only says that its pattern storage is full by a NAK of the
+   'I' that does not fit. The number of patterns it holds is found by the
+   capacity command, which stores empty patterns until that NAK comes and
+   keeps the result per firmware version in the state file "capacity".
+   Probing overwrites what the device holds, so stores never probe, they
+   check against the capacity found before, if there is one, before the
+   first pattern is written. */
+
+#define CAPACITY "capacity"
+#define PROBE_RSP_LEN (6)
+#define PROBE_TRIES (3)     /* NAKs in a row that mean the storage is full */
+
+static int probe_capacity(SERHDL hdl, char *device, int *capacity);
+
+
+/* capacity: the capacity of the firmware of the device, probed if it is
+   not known yet, again with --force */
+int print_capacity(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  int capacity;
+
+  rc = get_capacity(hdl, cmd_options.device, cmd_options.force, &capacity);
+  if ((rc == RET_CAPACITY_UNKNOWN) && !cmd_options.dryrun)
+  {
+    rc = get_capacity(hdl, cmd_options.device, 1, &capacity);
+  }
+  if (rc != RET_CAPACITY_OK)
+  {
+    fprintf(stderr, "the capacity of %s is not known.\n",
+            cmd_options.device);
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
+  }
+
+  printf("%s holds %s%d patterns\n", cmd_options.device,
+         (capacity == MAX_CAPACITY) ? "at least " : "", capacity);
+  rc = RET_COMMAND_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* the capacity of the firmware of the device as found before, probed
+   if probe is set */
+int get_capacity(SERHDL hdl, char *device, int probe, int *capacity)
+{
+  int rc;
+  char version[MAX_VERSION_LEN];
+  char value[MAX_STATE_LINE];
+
+  if (cmd_options.dryrun)
+  {
+    rc = RET_CAPACITY_UNKNOWN;
+    goto EXIT;
+  }
+  if (query_firmwareversion(hdl, version, sizeof(version)) != RET_COMMAND_OK)
+  {
+    rc = RET_CAPACITY_ERR;
+    goto EXIT;
+  }
+
+  if (!probe)
+  {
+    rc = ((read_state(CAPACITY, version, value, sizeof(value)) ==
+           RET_STATE_OK) && ((*capacity = atoi(value)) > 0)) ?
+         RET_CAPACITY_OK : RET_CAPACITY_UNKNOWN;
+    goto EXIT;
+  }
+
+  /* the probe overwrites what the device holds */
+  forget_stored(device, version);
+  if ((rc = probe_capacity(hdl, device, capacity)) != RET_CAPACITY_OK)
+  {
+    goto EXIT;
+  }
+  snprintf(value, sizeof(value), "%d", *capacity);
+  write_state(CAPACITY, version, value);
+
+EXIT:
+  return rc;
+}
+
+
+/* Pre-flight check of a coalesced sequence: one that does not fit is
+   rejected, with --downsample it is reduced to the capacity. Nothing has
+   been written to the device in either case. */
+int fit_sequence(SERHDL hdl, char *device, SEQUENCE *seq)
+{
+  int rc;
+  int capacity;
+  int nframes;
+
+  /* a device that does not answer fails at the store */
+  rc = get_capacity(hdl, device, 0, &capacity);
+  if ((rc == RET_CAPACITY_UNKNOWN) && !cmd_options.dryrun &&
+      !cmd_options.quiet)
+  {
+    printf("the capacity of %s is not known, \"capacity\" finds it\n",
+           device);
+  }
+  if ((rc != RET_CAPACITY_OK) || (seq->nframes <= capacity))
+  {
+    rc = RET_COMMAND_OK;
+    goto EXIT;
+  }
+
+  if (!cmd_options.downsample)
+  {
+    fprintf(stderr, "%d patterns do not fit into the %d of %s, nothing "
+                    "has been stored.\n", seq->nframes, capacity, device);
+    rc = RET_COMMAND_ERR_FULL;
+    goto EXIT;
+  }
+
+  nframes = seq->nframes;
+  downsample_sequence(seq, capacity);
+  coalesce_sequence(seq);
+  printf("%d patterns do not fit into the %d of %s, downsampled to %d\n",
+         nframes, capacity, device, seq->nframes);
+  rc = RET_COMMAND_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* Stores empty patterns until the module refuses one. A NAK may as well
+   be a frame that was garbled on the line, so the pattern is offered
+   again and only refused PROBE_TRIES times in a row it ends the probe. */
+static int probe_capacity(SERHDL hdl, char *device, int *capacity)
+{
+  int rc;
+  unsigned char params[LINES_PER_PATTERN + 1];
+  unsigned char response[PROBE_RSP_LEN];
+  int naks;
+
+  printf("probing the pattern storage of %s, the patterns it holds are "
+         "overwritten\n", device);
+  memset(params, 0, sizeof(params));
+  params[LINES_PER_PATTERN] = DEFAULT_DURATION;
+  naks = 0;
+  for (*capacity = 0; *capacity < MAX_CAPACITY; (*capacity)++)
+  {
+    if (send_command(hdl, (*capacity == 0) ? 'G' : 'I', sizeof(params),
+                     params) != RET_COMMAND_OK)
+    {
+      rc = RET_CAPACITY_ERR;
+      goto EXIT;
+    }
+    rc = receive_response(hdl, response, PROBE_RSP_LEN);
+    if ((rc == RET_COMMAND_ERR_NAK) && (*capacity > 0))
+    {
+      if (++naks == PROBE_TRIES)
+      {
+        break;
+      }
+      (*capacity)--;
+      continue;
+    }
+    if (rc != RET_COMMAND_OK)
+    {
+      rc = RET_CAPACITY_ERR;
+      goto EXIT;
+    }
+    naks = 0;
+  }
+
+  rc = RET_CAPACITY_OK;
+
+EXIT:
+  return rc;
+}
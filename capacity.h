@@ -0,0 +1,23 @@
+#ifndef CAPACITY_H
+#define CAPACITY_H
+
+#define RET_CAPACITY_OK      (0)
+#define RET_CAPACITY_ERR     (1)    /* the device has not answered */
+#define RET_CAPACITY_UNKNOWN (2)    /* not probed yet, or --dry-run */
+
+/* probing ends here, the capacity is at least that */
+#define MAX_CAPACITY (4096)
+
+#if CAPACITY_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int print_capacity(SERHDL hdl, int myargc, char **myargv);
+EXTERN int get_capacity(SERHDL hdl, char *device, int probe, int *capacity);
+EXTERN int fit_sequence(SERHDL hdl, char *device, SEQUENCE *seq);
+
+#undef EXTERN
+
+#endif
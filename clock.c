@@ -0,0 +1,64 @@
+#if LINUX
+#  include <time.h>
+#endif
+
+#if WIN
+#  include <windows.h>
+#endif
+
+#define CLOCK_SRC 1
+#include <clock.h>
+#undef CLOCK_SRC
+
+#if LINUX
+
+/* monotonic time in microseconds */
+long long get_time_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+void sleep_us(long long us)
+{
+  struct timespec ts;
+
+  if (us <= 0)
+  {
+    return;
+  }
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  while (nanosleep(&ts, &ts) == -1)
+    ;
+}
+
+#endif /* LINUX */
+
+#if WIN
+
+long long get_time_us(void)
+{
+  LARGE_INTEGER count;
+  LARGE_INTEGER freq;
+
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&freq);
+  return count.QuadPart / freq.QuadPart * 1000000 +
+         count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+}
+
+
+void sleep_us(long long us)
+{
+  if (us <= 0)
+  {
+    return;
+  }
+  Sleep((DWORD) ((us + 999) / 1000));
+}
+
+#endif /* WIN */
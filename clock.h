@@ -0,0 +1,15 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#if CLOCK_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN long long get_time_us(void);
+EXTERN void sleep_us(long long us);
+
+#undef EXTERN
+
+#endif
@@ -4,54 +4,62 @@
 
 #include <serial.h>
 #include <pattern.h>
-#include <crc16.h>
+#include <sequence.h>
+#include <state.h>
+#include <wire.h>
+#include <clock.h>
+#include <probes.h>
+#include <anim.h>
+#include <effect.h>
+#include <capacity.h>
+#include <pipeline.h>
 
 #define COMMAND_SRC 1
 #include <command.h>
 #undef COMMAND_SRC
 
-#define STX 0x02
-#define ESC 0x10
-#define FLAG 0x80
-#define NAK 0x15
+/* what went over the wire, or would have with --dry-run */
+typedef struct {
+  long commands;          /* commands sent */
+  long txbytes;           /* escaped frame bytes sent */
+  long escapes;           /* bytes added by escaping */
+  long rxbytes;           /* response bytes received */
+  long long time_us;      /* wire time of all of them */
+} BUDGET;
 
-#define LINES_PER_PATTERN (8)
-#define COLUMNS_PER_PATTERN (8)
+static long sequence_wire_bytes(SEQUENCE *seq);
+static int store_animation(SERHDL hdl, char *path);
+static void get_effect(int *effect, int *steps);
+static int is_stored(SERHDL hdl, char *device, char *kind,
+                     unsigned long long hash, char *key, int keylen);
+static void remember_stored(char *key, unsigned long long hash);
+static void account_frame(unsigned char *frame, int len);
+static void frame_header(unsigned char *frame, int len, int *command,
+                         int *nparam);
 
-static int send_command(SERHDL hdl, char command, int nparam,
-                        unsigned char *params);
-static int receive_response(SERHDL hdl, unsigned char *response, int rsplen);
-static int write_serial_with_escape(SERHDL hdl, unsigned char byte,
-                                    unsigned short *crc16);
-static int write_and_crc_byte(SERHDL hdl, unsigned char byte,
-                              unsigned short *crc16);
+PROBE_SEMAPHORE(send_command);
+PROBE_SEMAPHORE(receive_response);
 
-static int read_one_pattern(FILE *patternfile, unsigned char *pattern);
+#define MANIFEST "manifest"
+
+#define US_PER_DURATION (100000)
+
+static BUDGET budget;
+static long long virtual_time_us;
 
 
 int get_firmwareversion(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-  #define CMD_GET_FIRMWARE_RSP_LEN (12)
-  unsigned char response[CMD_GET_FIRMWARE_RSP_LEN];
+  char version[MAX_VERSION_LEN];
 
-  rc = send_command(hdl, 'v', 0, NULL);
+  rc = query_firmwareversion(hdl, version, sizeof(version));
   if (rc != RET_COMMAND_OK) 
   {
-    fprintf(stderr, "sending command firmwareversion has failed.\n");
-    goto EXIT;
-  }
-
-  rc = receive_response(hdl, response, CMD_GET_FIRMWARE_RSP_LEN);
-  if (rc != RET_COMMAND_OK) 
-  {
-    fprintf(stderr, "receiving response of command firmwareversion "
-                    "has failed.\n");
     goto EXIT;
   }
   
-  printf("Firmware version: %d.%d.%d\n", response[4] * 256 + response[5],
-         response[6] * 256 + response[7], response[8] * 256 + response[9]); 
+  printf("Firmware version: %s\n", version); 
 
 EXIT:
   return rc;
@@ -92,8 +100,20 @@ int store_text(SERHDL hdl, int myargc, char **myargv)
   #define CMD_STORE_TEXT_RSP_LEN (6)
   unsigned char response[CMD_STORE_TEXT_RSP_LEN];
   int textlen;
+  unsigned long long hash;
+  char key[MAX_STATE_LINE];
 
   textlen = strlen(myargv[0]);
+
+  /* skip rewriting the flash with the text it already holds */
+  hash = hash_bytes(HASH_INIT, (unsigned char *) myargv[0], textlen);
+  if (is_stored(hdl, cmd_options.device, "text", hash, key, sizeof(key)))
+  {
+    printf("text is already stored, nothing to do.\n");
+    rc = RET_COMMAND_OK;
+    goto EXIT;
+  }
+
   rc = send_command(hdl, 'J', textlen, (unsigned char *) myargv[0]);
   if (rc != RET_COMMAND_OK) 
   {
@@ -109,6 +129,8 @@ int store_text(SERHDL hdl, int myargc, char **myargv)
     goto EXIT;
   }
 
+  remember_stored(key, hash);
+
 EXIT:
   return rc;
 }
@@ -147,17 +169,18 @@ int display_pattern(SERHDL hdl, int myargc, char **myargv)
   int rc;
 #define CMD_DISPLAY_PATTERN_RSP_LEN (6)
   unsigned char response[CMD_DISPLAY_PATTERN_RSP_LEN];
-  FILE *patternfile;
+  FRAMESRC src;
   unsigned char pattern[LINES_PER_PATTERN];
+  unsigned char duration;
   
-  if ((rc = open_patternfile(myargv[0], &patternfile)) != RET_PATTERN_OK)
+  if ((rc = open_frames(myargv[0], &src)) != RET_SEQUENCE_OK)
   {
     fprintf(stderr, "open of patternfile %s has failed\n", myargv[0]);
     goto EXIT;
   }
 
   
-  if ((rc = read_one_pattern(patternfile, pattern)) != RET_COMMAND_OK)
+  if ((rc = read_frame(&src, pattern, &duration)) != RET_SEQUENCE_OK)
   {
     fprintf(stderr, "read of patternfile %s has failed\n", myargv[0]);
     goto CLOSE_EXIT;
@@ -180,7 +203,7 @@ int display_pattern(SERHDL hdl, int myargc, char **myargv)
   
 
 CLOSE_EXIT:
-  close_patternfile(patternfile);
+  close_frames(&src);
 
 EXIT:
   return rc;
@@ -190,88 +213,378 @@ EXIT:
 int store_pattern(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-#define CMD_STORE_PATTERN_RSP_LEN (6)
-  unsigned char response[CMD_STORE_PATTERN_RSP_LEN];
-  FILE *patternfile;
-  unsigned char dummy;
-  unsigned char pattern[LINES_PER_PATTERN + 1];
-#define DISPLAY_DURATION (1)
-  
-  /* open pattern file */
-  if ((rc = open_patternfile(myargv[0], &patternfile)) != RET_PATTERN_OK)
+  SEQUENCE seq;
+  ENCODED enc;
+  int nread;
+  int saved;
+  long bytes;
+  int unchanged;
+  int effect;
+  int steps;
+  char *failed;
+
+  /* a compiled file is sent as it is */
+  if ((myargc == 1) && is_animation(myargv[0]))
   {
-    fprintf(stderr, "open of patternfile %s has failed\n", myargv[0]);
+    rc = store_animation(hdl, myargv[0]);
     goto EXIT;
   }
+  
+  /* read all patterns with their durations, with two files those of the
+     transition from the first to the second one in between */
+  init_sequence(&seq);
+  if (myargc == 2)
+  {
+    get_effect(&effect, &steps);
+    rc = read_transition(myargv[0], myargv[1], effect, steps, &seq,
+                         &failed);
+  }
+  else
+  {
+    rc = read_sequence(myargv[0], &seq);
+    failed = myargv[0];
+  }
+  if (rc != RET_SEQUENCE_OK)
+  {
+    fprintf(stderr, "read of patternfile %s has failed\n", failed);
+    goto FREE_SEQUENCE_EXIT;
+  }
+
+  /* identical consecutive patterns are stored once with the summed duration */
+  nread = seq.nframes;
+  bytes = sequence_wire_bytes(&seq);
+  saved = coalesce_sequence(&seq);
+  bytes -= sequence_wire_bytes(&seq);
 
-  /* read the first pattern */
-  if ((rc = read_one_pattern(patternfile, pattern)) != RET_COMMAND_OK)
+  if ((rc = fit_sequence(hdl, cmd_options.device, &seq)) != RET_COMMAND_OK)
   {
-      fprintf(stderr, "read of patternfile %s has failed\n", myargv[0]);
-      goto CLOSE_EXIT;
+    goto FREE_SEQUENCE_EXIT;
   }
 
-  /* set duration of display in multiples of 100 ms */
-  pattern[LINES_PER_PATTERN] = DISPLAY_DURATION;
+  if (encode_sequence(&seq, &enc) != RET_SEQUENCE_OK)
+  {
+    fprintf(stderr, "out of memory for %d patterns.\n", seq.nframes);
+    rc = RET_COMMAND_ERR_WRITE;
+    goto FREE_SEQUENCE_EXIT;
+  }
 
-  /* write first pattern */
-  rc = send_command(hdl, 'G', LINES_PER_PATTERN + 1, pattern);
-  if (rc != RET_COMMAND_OK) 
+  rc = store_encoded(hdl, cmd_options.device, &enc, &unchanged);
+  if (rc != RET_COMMAND_OK)
   {
-    fprintf(stderr, "sending command storepattern has failed.\n");
-    goto CLOSE_EXIT;
+    goto FREE_EXIT;
   }
 
-  rc = receive_response(hdl, response, CMD_STORE_PATTERN_RSP_LEN);
-  if (rc != RET_COMMAND_OK) 
+  if (unchanged)
   {
-    fprintf(stderr, "receiving response of command storepattern "
-                    "has failed.\n");
-    goto CLOSE_EXIT;
+    printf("patterns are already stored, nothing to do.\n");
   }
-  
-  /* read the subsequent patterns */
-  while (read_patternfile(patternfile, &dummy) == RET_PATTERN_OK)
+  else
   {
-    if ((rc = read_one_pattern(patternfile, pattern)) != RET_COMMAND_OK)
-    {
-      fprintf(stderr, "read of patternfile %s has failed\n", myargv[0]);
-      goto CLOSE_EXIT;
-    }
+    printf("%d patterns read, %d stored, %d patterns (%ld bytes) saved by "
+           "merging repeated patterns\n", nread, seq.nframes, saved, bytes);
+  }
+
+FREE_EXIT:
+  free_encoded(&enc);
+
+FREE_SEQUENCE_EXIT:
+  free_sequence(&seq);
+
+EXIT:
+  return rc;
+}
+
+
+/* the frames go to the port from the mapping of the compiled file */
+static int store_animation(SERHDL hdl, char *path)
+{
+  int rc;
+  ANIM anim;
+  int unchanged;
+
+  if (map_animation(path, &anim) != RET_ANIM_OK)
+  {
+    fprintf(stderr, "read of compiled file %s has failed\n", path);
+    rc = RET_COMMAND_ERR_WRITE;
+    goto EXIT;
+  }
+
+  rc = store_encoded(hdl, cmd_options.device, &anim.enc, &unchanged);
+  if (rc != RET_COMMAND_OK)
+  {
+    goto UNMAP_EXIT;
+  }
+
+  if (unchanged)
+  {
+    printf("patterns are already stored, nothing to do.\n");
+  }
+  else
+  {
+    printf("%d compiled patterns stored\n", anim.enc.nframes);
+  }
+
+UNMAP_EXIT:
+  unmap_animation(&anim);
+
+EXIT:
+  return rc;
+}
+
+
+/* Sends the encoded store commands of a sequence, unless the manifest
+   says the device already holds them, which sets *unchanged. */
+int store_encoded(SERHDL hdl, char *device, ENCODED *enc, int *unchanged)
+{
+  int rc;
+#define CMD_STORE_PATTERN_RSP_LEN (6)
+  unsigned char response[CMD_STORE_PATTERN_RSP_LEN];
+  char key[MAX_STATE_LINE];
+  int i;
+
+  if (((rc = begin_store(hdl, device, enc, unchanged, key, sizeof(key))) !=
+       RET_COMMAND_OK) || *unchanged)
+  {
+    goto EXIT;
+  }
 
-    /* set duration of display in multiples of 100 ms */
-    pattern[LINES_PER_PATTERN] = DISPLAY_DURATION;
-    rc = send_command(hdl, 'I', LINES_PER_PATTERN + 1, pattern);
+  for (i = 0; i < enc->nframes; i++)
+  {
+    rc = send_frame(hdl, enc->data + enc->offsets[i],
+                    enc->offsets[i + 1] - enc->offsets[i]);
     if (rc != RET_COMMAND_OK) 
     {
-      fprintf(stderr, "sending command storepattern has failed.\n");
-      goto CLOSE_EXIT;
+      fprintf(stderr, "sending command storepattern to %s has failed.\n",
+              device);
+      goto EXIT;
     }
 
     rc = receive_response(hdl, response, CMD_STORE_PATTERN_RSP_LEN);
     if (rc != RET_COMMAND_OK) 
     {
-      if (rc == RET_COMMAND_ERR_NAK)
+      if ((rc == RET_COMMAND_ERR_NAK) && (i > 0))
       {
-        fprintf(stderr, "storage for patterns is exhausted.\n");
+        fprintf(stderr, "storage for patterns of %s is exhausted.\n",
+                device);
       }
       else
       {
         fprintf(stderr, "receiving response of command storepattern "
-                        "has failed.\n");
+                        "from %s has failed.\n", device);
       }
+      goto EXIT;
+    }
+  }
+
+  end_store(key, enc);
+
+EXIT:
+  return rc;
+}
+
+
+/* The checks before the frames of enc are sent, key is for end_store().
+   Nothing is to be sent if the device holds them already (unchanged),
+   a store that would be cut off is not begun. */
+int begin_store(SERHDL hdl, char *device, ENCODED *enc, int *unchanged,
+                char *key, int keylen)
+{
+  int rc;
+  int capacity;
+
+  *unchanged = is_stored(hdl, device, "pattern", enc->hash, key, keylen);
+  if (*unchanged)
+  {
+    rc = RET_COMMAND_OK;
+    goto EXIT;
+  }
+
+  if ((get_capacity(hdl, device, 0, &capacity) == RET_CAPACITY_OK) &&
+      (enc->nframes > capacity))
+  {
+    fprintf(stderr, "%d patterns do not fit into the %d of %s, nothing "
+                    "has been stored.\n", enc->nframes, capacity, device);
+    rc = RET_COMMAND_ERR_FULL;
+    goto EXIT;
+  }
+
+  /* a partly written sequence does not match anything */
+  remember_stored(key, 0);
+  rc = RET_COMMAND_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* all frames of enc have been acknowledged */
+void end_store(char *key, ENCODED *enc)
+{
+  remember_stored(key, enc->hash);
+}
+
+
+/* --effect and --steps, validated by the option parser already */
+static void get_effect(int *effect, int *steps)
+{
+  *effect = find_effect((cmd_options.effect != NULL) ? cmd_options.effect :
+                                                       DEFAULT_EFFECT);
+  *steps = (cmd_options.steps > 0) ? cmd_options.steps :
+                                     DEFAULT_EFFECT_STEPS;
+}
+
+
+/* Shows the patterns of a file one after the other with their durations,
+   or at --fps frames per second. A pattern whose time has already passed
+   when the link is free again is dropped. */
+int play_pattern(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+#define CMD_PLAY_PATTERN_RSP_LEN (6)
+  unsigned char frame[MAX_FRAME_LEN];
+  FRAMESRC src;
+  PIPELINE pl;
+  unsigned char pattern[LINES_PER_PATTERN];
+  unsigned char duration;
+  long long start;
+  long long due;
+  long long period;
+  int fps;
+  int every;
+  int nread;
+  int shown;
+  int dropped;
+  int effect;
+  int steps;
+  
+  if ((rc = open_frames(myargv[0], &src)) != RET_SEQUENCE_OK)
+  {
+    fprintf(stderr, "open of patternfile %s has failed\n", myargv[0]);
+    goto EXIT;
+  }
+
+  /* the transition into the second file is made pattern by pattern */
+  if (myargc == 2)
+  {
+    get_effect(&effect, &steps);
+    if ((rc = open_transition(&src, myargv[1], effect, steps)) !=
+        RET_SEQUENCE_OK)
+    {
+      fprintf(stderr, "open of patternfile %s has failed\n", myargv[1]);
       goto CLOSE_EXIT;
     }
   }
 
+  if ((rc = open_pipeline(hdl, &pl)) != RET_COMMAND_OK)
+  {
+    goto CLOSE_EXIT;
+  }
+
+  /* a rate the link cannot sustain is down-sampled to every n-th pattern,
+     based on a display frame without escaped bytes */
+  period = 0;
+  every = 1;
+  if (cmd_options.fps > 0)
+  {
+    memset(pattern, 0, sizeof(pattern));
+    fps = admit_frame_rate(cmd_options.fps,
+                           encode_command('D', LINES_PER_PATTERN, pattern,
+                                          frame),
+                           pl.async ? 0 : CMD_PLAY_PATTERN_RSP_LEN);
+    every = (cmd_options.fps + fps - 1) / fps;
+    period = 1000000 / cmd_options.fps;
+    if (every > 1)
+    {
+      fprintf(stderr, "showing every %d. pattern.\n", every);
+    }
+  }
+
+  nread = 0;
+  shown = 0;
+  dropped = 0;
+  start = play_time_us();
+  due = start;
+  while (1)
+  {
+    if ((rc = read_frame(&src, pattern, &duration)) != RET_SEQUENCE_OK)
+    {
+      if (nread == 0)
+      {
+        fprintf(stderr, "read of patternfile %s has failed\n", myargv[0]);
+        goto DRAIN_EXIT;
+      }
+      break;
+    }
+    nread++;
+
+    /* the slot of this pattern ends when the next one is due */
+    if (((nread - 1) % every) != 0)
+    {
+      due += period;
+      dropped++;
+      continue;
+    }
+    play_wait_until(due);
+    due += (period > 0) ? period : (long long) duration * US_PER_DURATION;
+    if (play_time_us() >= due)
+    {
+      dropped++;
+      continue;
+    }
+
+    rc = send_display(&pl, pattern);
+    if (rc != RET_COMMAND_OK) 
+    {
+      fprintf(stderr, "sending command play has failed.\n");
+      goto DRAIN_EXIT;
+    }
+    shown++;
+  }
+
+  /* keep the last pattern for its duration */
+  play_wait_until(due);
+
+  printf("%d patterns read, %d shown, %d dropped in %lld ms\n", nread,
+         shown, dropped, (play_time_us() - start) / 1000);
+  rc = RET_COMMAND_OK;
+
+DRAIN_EXIT:
+  close_pipeline(&pl);
+
 CLOSE_EXIT:
-  close_patternfile(patternfile);
+  close_frames(&src);
 
 EXIT:
   return rc;
 }
 
 
+/* prints what went over the wire, or would have with --dry-run */
+void print_wire_budget(void)
+{
+  unsigned char frame[MAX_FRAME_LEN];
+  unsigned char pattern[LINES_PER_PATTERN];
+  int shortest;
+  int longest;
+#define DISPLAY_RSP_LEN (6)
+
+  printf("%ld commands, %ld bytes sent (%ld for escaping), %ld bytes "
+         "received\n", budget.commands, budget.txbytes, budget.escapes,
+         budget.rxbytes);
+  printf("wire time at %d baud: %lld.%03lld ms\n", BAUDRATE,
+         budget.time_us / 1000, budget.time_us % 1000);
+
+  /* a display frame is longest if every param needs escaping */
+  memset(pattern, 0, sizeof(pattern));
+  shortest = encode_command('D', LINES_PER_PATTERN, pattern, frame);
+  memset(pattern, STX, sizeof(pattern));
+  longest = encode_command('D', LINES_PER_PATTERN, pattern, frame);
+  printf("display frames: %d to %d bytes, at most %d to %d frames/s\n",
+         shortest, longest, max_frame_rate(longest, DISPLAY_RSP_LEN),
+         max_frame_rate(shortest, DISPLAY_RSP_LEN));
+}
+
+
 int set_normalmode(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
@@ -353,6 +666,13 @@ EXIT:
 int exe_factoryreset(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
+  char key[MAX_STATE_LINE];
+
+  /* the stored text and patterns are gone after the reset */
+  is_stored(hdl, cmd_options.device, "pattern", 0, key, sizeof(key));
+  remember_stored(key, 0);
+  is_stored(hdl, cmd_options.device, "text", 0, key, sizeof(key));
+  remember_stored(key, 0);
 
   rc = send_command(hdl, 'X', 0, NULL);
   if (rc != RET_COMMAND_OK) 
@@ -364,146 +684,181 @@ int exe_factoryreset(SERHDL hdl, int myargc, char **myargv)
 }
 
 
-static int send_command(SERHDL hdl, char command, int nparam,
-                        unsigned char *params)
+int query_firmwareversion(SERHDL hdl, char *version, int len)
 {
   int rc;
-  unsigned char checksum[2];
-  unsigned char length_high;
-  unsigned char length_low;
-  unsigned short crc16;
-  unsigned short dummy;
-  int i;
-
-  /* set initial value for crc16 computation */
-  crc16 = INITIAL_VALUE;
+  #define CMD_GET_FIRMWARE_RSP_LEN (12)
+  unsigned char response[CMD_GET_FIRMWARE_RSP_LEN];
 
-  /* write start frame character */
-  rc = write_and_crc_byte(hdl, STX, &crc16);
-  if (rc != 1)
+  rc = send_command(hdl, 'v', 0, NULL);
+  if (rc != RET_COMMAND_OK) 
   {
-    rc = RET_COMMAND_ERR_WRITE;
+    fprintf(stderr, "sending command firmwareversion has failed.\n");
     goto EXIT;
   }
 
-  /* write two byte length, command + params */
-  length_high = 0;
-  rc = write_serial_with_escape(hdl, length_high, &crc16);
-  if (rc != 1)
+  rc = receive_response(hdl, response, CMD_GET_FIRMWARE_RSP_LEN);
+  if (rc != RET_COMMAND_OK) 
   {
-    rc = RET_COMMAND_ERR_WRITE;
+    fprintf(stderr, "receiving response of command firmwareversion "
+                    "has failed.\n");
     goto EXIT;
   }
   
-  length_low = 1 + nparam;
-  rc = write_serial_with_escape(hdl, length_low, &crc16);
-  if (rc != 1)
+  snprintf(version, len, "%d.%d.%d", response[4] * 256 + response[5],
+           response[6] * 256 + response[7], response[8] * 256 + response[9]); 
+
+EXIT:
+  return rc;
+}
+
+
+/* Checks the manifest whether the device already holds content with this
+   hash. The manifest is keyed by device and firmware version, the key is
+   returned for remember_stored(). Always false with --force. */
+static int is_stored(SERHDL hdl, char *device, char *kind,
+                     unsigned long long hash, char *key, int keylen)
+{
+  char version[MAX_VERSION_LEN];
+  char value[MAX_STATE_LINE];
+
+  key[0] = '\0';
+  if (cmd_options.dryrun ||
+      (query_firmwareversion(hdl, version, sizeof(version)) != RET_COMMAND_OK))
   {
-    rc = RET_COMMAND_ERR_WRITE;
-    goto EXIT;
+    return 0;
   }
+  snprintf(key, keylen, "%s %s %s", device, version, kind);
 
-  /* write command */
-  rc = write_serial_with_escape(hdl, command, &crc16);
-  if (rc != 1)
+  if (cmd_options.force ||
+      (read_state(MANIFEST, key, value, sizeof(value)) != RET_STATE_OK))
   {
-    rc = RET_COMMAND_ERR_WRITE;
-    goto EXIT;
+    return 0;
   }
 
-  /* write params */
-  if (nparam) 
+  return (strtoull(value, NULL, 16) == hash);
+}
+
+
+/* the device holds something else than the manifest says */
+void forget_stored(char *device, char *version)
+{
+  char key[MAX_STATE_LINE];
+
+  snprintf(key, sizeof(key), "%s %s %s", device, version, "pattern");
+  write_state(MANIFEST, key, NULL);
+}
+
+
+/* records the hash of the stored content, 0 forgets it */
+static void remember_stored(char *key, unsigned long long hash)
+{
+  char value[24];
+
+  if (key[0] == '\0')
   {
-    for (i = 0; i < nparam; i++)
-    {
-      rc = write_serial_with_escape(hdl, params[i], &crc16);
-      if (rc != 1)
-      {
-        rc = RET_COMMAND_ERR_WRITE;
-        goto EXIT;
-      }
-    }
+    return;
   }
 
-  /* write checksum CRC16 */
-  checksum[0] = (crc16 >> 8) & 0xff;
-  checksum[1] = crc16 & 0xff;
-  rc = write_serial_with_escape(hdl, checksum[0], &dummy); 
-  if (rc != 1)
+  if (hash == 0)
   {
-    rc = RET_COMMAND_ERR_WRITE;
-    goto EXIT;
+    write_state(MANIFEST, key, NULL);
   }
-  rc = write_serial_with_escape(hdl, checksum[1], &dummy); 
-  if (rc != 1)
+  else
   {
-    rc = RET_COMMAND_ERR_WRITE;
-    goto EXIT;
+    snprintf(value, sizeof(value), "%016llx", hash);
+    write_state(MANIFEST, key, value);
   }
-
-  rc = RET_COMMAND_OK;
-
-EXIT:
-  return rc;
 }
 
 
-static int write_serial_with_escape(SERHDL hdl, unsigned char byte,
-                                    unsigned short *crc16)
+int send_command(SERHDL hdl, char command, int nparam, unsigned char *params)
 {
   int rc;
+  unsigned char frame[MAX_FRAME_LEN];
+  int len;
 
-  switch (byte)
+  if (nparam > MAX_PARAMS)
   {
-    case STX:
-      rc = write_and_crc_byte(hdl, ESC, crc16);
-      if (rc != 1) 
-      {
-        goto EXIT;
-      }
-      rc = write_and_crc_byte(hdl, STX | FLAG, crc16);
-      break;
-
-    case ESC:
-      rc = write_and_crc_byte(hdl, ESC, crc16);
-      if (rc != 1) 
-      {
-        goto EXIT;
-      }
-      rc = write_and_crc_byte(hdl, ESC | FLAG, crc16);
-      break;
-
-    default:
-      rc = write_and_crc_byte(hdl, byte, crc16);
-      break;
+    rc = RET_COMMAND_ERR_WRITE;
+    goto EXIT;
   }
 
+  /* build the whole frame first, then write it with a single call */
+  len = encode_command(command, nparam, params, frame);
+  rc = send_frame(hdl, frame, len);
+
 EXIT:
   return rc;
 }
 
 
-static int write_and_crc_byte(SERHDL hdl, unsigned char byte,
-                              unsigned short *crc16)
+/* writes a complete, already encoded frame */
+int send_frame(SERHDL hdl, unsigned char *frame, int len)
 {
   int rc;
+  int command;
+  int nparam;
+
+  account_frame(frame, len);
+  if (cmd_options.dryrun)
+  {
+    virtual_time_us += wire_time_us(len);
+    rc = RET_COMMAND_OK;
+    goto EXIT;
+  }
+
+  rc = write_serial(hdl, frame, len);
+  if (rc != len)
+  {
+    rc = RET_COMMAND_ERR_WRITE;
+    goto EXIT;
+  }
 
-  rc = write_serial(hdl, &byte, 1); 
-  if (rc == 1)
+  /* stored sequences come here already encoded, so the probe is here */
+  if (PROBE_ENABLED(send_command))
   {
-    *crc16 = calc_crc16(*crc16, byte);
+    frame_header(frame, len, &command, &nparam);
+    PROBE3(send_command, command, nparam, len);
   }
 
+  rc = RET_COMMAND_OK;
+
+EXIT:
   return rc;
 }
 
 
-static int receive_response(SERHDL hdl, unsigned char *response, int rsplen)
+int receive_response(SERHDL hdl, unsigned char *response, int rsplen)
 {
   int rc;
   int i;
+  long long start = 0;
+
+  __atomic_add_fetch(&budget.rxbytes, rsplen, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&budget.time_us, wire_time_us(rsplen), __ATOMIC_RELAXED);
+  if (cmd_options.dryrun)
+  {
+    /* pretend the module has acknowledged */
+    virtual_time_us += wire_time_us(rsplen);
+    memset(response, 0, rsplen);
+    response[0] = STX;
+    rc = RET_COMMAND_OK;
+    goto EXIT;
+  }
   
+  if (PROBE_ENABLED(receive_response))
+  {
+    start = get_time_us();
+  }
   rc = read_serial(hdl, response, rsplen);
+  if (PROBE_ENABLED(receive_response))
+  {
+    /* rsplen -1: no complete response */
+    PROBE3(receive_response, (rc == rsplen) ? rsplen : -1,
+           (rc == rsplen) && (rsplen >= 4) && (response[3] == NAK),
+           get_time_us() - start);
+  }
   if ( (rc == -1) || (rc != rsplen) )
   {
     rc = RET_COMMAND_ERR_READ;
@@ -516,12 +871,15 @@ static int receive_response(SERHDL hdl, unsigned char *response, int rsplen)
     goto EXIT;
   }
  
-  printf("rsp: ");
-  for (i = 0; i < rsplen; i++)
+  if (!cmd_options.quiet)
   {
-    printf("%02X ", *(response + i));
+    printf("rsp: ");
+    for (i = 0; i < rsplen; i++)
+    {
+      printf("%02X ", *(response + i));
+    }
+    printf("\n");
   }
-  printf("\n");
 
   rc = RET_COMMAND_OK;
 
@@ -530,38 +888,187 @@ EXIT:
 }
 
 
-
-static int read_one_pattern(FILE *patternfile, unsigned char *pattern)
+/* Sends one frame and receives its response on each of many ports at
+   once, through a single transfer_serial. The rc of each exchange is
+   turned into RET_COMMAND_OK, RET_COMMAND_ERR_READ or RET_COMMAND_ERR_NAK,
+   the number of acknowledged exchanges is returned. */
+int exchange_frames(SERIO *ios, int nios)
 {
+#define EXCHANGE_TIMEOUT_MS (100)     /* as long as read_serial waits */
   int rc;
-  int lines;
-  int columns;
-  unsigned char linepattern;
+  long long start;
+  long long longest;
+  int command;
+  int nparam;
+  int i;
+  int k;
 
-  for (lines = 0; lines  < LINES_PER_PATTERN; lines++)
+  longest = 0;
+  for (i = 0; i < nios; i++)
   {
-    pattern[lines] = 0;
+    account_frame(ios[i].tx, ios[i].txlen);
+    __atomic_add_fetch(&budget.rxbytes, ios[i].rxlen, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&budget.time_us, wire_time_us(ios[i].rxlen),
+                       __ATOMIC_RELAXED);
+    if (wire_time_us(ios[i].txlen + ios[i].rxlen) > longest)
+    {
+      longest = wire_time_us(ios[i].txlen + ios[i].rxlen);
+    }
   }
 
-  for (lines = 0; lines < LINES_PER_PATTERN; lines++)
+  start = get_time_us();
+  if (cmd_options.dryrun)
   {
-    if ((rc = read_patternfile(patternfile, &linepattern)) != RET_PATTERN_OK)
+    /* the ports are busy at the same time, pretend all have acknowledged */
+    virtual_time_us += longest;
+    for (i = 0; i < nios; i++)
     {
-      rc = RET_COMMAND_ERR_READ;
-      goto EXIT;
+      memset(ios[i].rx, 0, ios[i].rxlen);
+      ios[i].rx[0] = STX;
+      ios[i].rc = ios[i].rxlen;
+      ios[i].done_us = start;
+    }
+  }
+  else
+  {
+    transfer_serial(ios, nios, EXCHANGE_TIMEOUT_MS);
+  }
+
+  rc = 0;
+  for (i = 0; i < nios; i++)
+  {
+    if (!cmd_options.dryrun && PROBE_ENABLED(send_command))
+    {
+      frame_header(ios[i].tx, ios[i].txlen, &command, &nparam);
+      PROBE3(send_command, command, nparam, ios[i].txlen);
+    }
+    if (!cmd_options.dryrun && PROBE_ENABLED(receive_response))
+    {
+      PROBE3(receive_response, (ios[i].rc == ios[i].rxlen) ? ios[i].rxlen : -1,
+             (ios[i].rc == ios[i].rxlen) && (ios[i].rxlen >= 4) &&
+             (ios[i].rx[3] == NAK),
+             (ios[i].rc == ios[i].rxlen) ? ios[i].done_us - start : 0);
     }
 
-    for (columns = 0; columns < COLUMNS_PER_PATTERN; columns++)
+    if (ios[i].rc != ios[i].rxlen)
     {
-      if (linepattern & (1 << (COLUMNS_PER_PATTERN - columns - 1))) 
+      ios[i].rc = RET_COMMAND_ERR_READ;
+      continue;
+    }
+    if ((ios[i].rxlen >= 4) && (ios[i].rx[3] == NAK))
+    {
+      ios[i].rc = RET_COMMAND_ERR_NAK;
+      continue;
+    }
+    if (!cmd_options.quiet)
+    {
+      printf("rsp: ");
+      for (k = 0; k < ios[i].rxlen; k++)
       {
-        pattern[columns] = pattern[columns] | (1 << lines);
+        printf("%02X ", ios[i].rx[k]);
       }
+      printf("\n");
     }
+    ios[i].rc = RET_COMMAND_OK;
+    rc++;
   }
-  
-  rc = RET_COMMAND_OK;
 
-EXIT:
   return rc;
 }
+
+
+/* bytes on the wire for storing a sequence, commands and responses */
+static long sequence_wire_bytes(SEQUENCE *seq)
+{
+  long bytes;
+  unsigned char frame[MAX_FRAME_LEN];
+  unsigned char pattern[LINES_PER_PATTERN + 1];
+  int i;
+
+  bytes = 0;
+  for (i = 0; i < seq->nframes; i++)
+  {
+    memcpy(pattern, seq->frames[i].pattern, LINES_PER_PATTERN);
+    pattern[LINES_PER_PATTERN] = seq->frames[i].duration;
+    bytes += encode_command((i == 0) ? 'G' : 'I', LINES_PER_PATTERN + 1,
+                            pattern, frame);
+    bytes += CMD_STORE_PATTERN_RSP_LEN;
+  }
+
+  return bytes;
+}
+
+
+/* real time, or the time the link would have taken with --dry-run */
+long long play_time_us(void)
+{
+  return cmd_options.dryrun ? virtual_time_us : get_time_us();
+}
+
+
+void play_wait_until(long long due)
+{
+  if (cmd_options.dryrun)
+  {
+    if (virtual_time_us < due)
+    {
+      virtual_time_us = due;
+    }
+  }
+  else
+  {
+    sleep_us(due - get_time_us());
+  }
+}
+
+
+/* counts a frame into the wire budget, the pipelined reader and the
+   deploy workers count from other threads */
+static void account_frame(unsigned char *frame, int len)
+{
+  int escapes;
+  int i;
+
+  /* every ESC on the wire stands for one escaped byte */
+  escapes = 0;
+  for (i = 0; i < len; i++)
+  {
+    if (frame[i] == ESC)
+    {
+      escapes++;
+    }
+  }
+
+  __atomic_add_fetch(&budget.commands, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&budget.txbytes, len, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&budget.escapes, escapes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&budget.time_us, wire_time_us(len), __ATOMIC_RELAXED);
+}
+
+
+/* command and number of params of an escaped frame */
+static void frame_header(unsigned char *frame, int len, int *command,
+                         int *nparam)
+{
+  unsigned char header[3];
+  int n;
+  int i;
+
+  memset(header, 0, sizeof(header));
+  n = 0;
+  for (i = 1; (i < len) && (n < 3); i++)
+  {
+    if (frame[i] == ESC)
+    {
+      if (++i < len)
+      {
+        header[n++] = frame[i] & ~FLAG;
+      }
+      continue;
+    }
+    header[n++] = frame[i];
+  }
+
+  *command = header[2];
+  *nparam = (header[0] << 8) + header[1] - 1;
+}
@@ -5,6 +5,29 @@
 #define RET_COMMAND_ERR_READ  (1)
 #define RET_COMMAND_ERR_WRITE (2)
 #define RET_COMMAND_ERR_NAK   (3)
+#define RET_COMMAND_ERR_FULL  (4)   /* patterns do not fit, none written */
+
+#define MAX_VERSION_LEN (32)
+
+typedef struct {
+  char *device;           /* serial device as given on the command line */
+  int   force;            /* store even if the device has the same content */
+  int   dryrun;           /* only count what would go over the wire */
+  int   fps;              /* frames per second for play, 0: as in the file */
+  int   quiet;            /* do not print the responses */
+  int   jobs;             /* devices deploy uploads to at the same time */
+  char *trace;            /* file the bytes on the ports are traced to */
+  int   fast;             /* replay without the times of the trace */
+  int   threshold;        /* percent replay may be slower, 0: default */
+  int   wait;             /* seconds to wait for a busy device, 0: default */
+  char *effect;           /* transition between two inputfiles, NULL: default */
+  int   steps;            /* patterns of the transition, 0: default */
+  int   levels;           /* greyscale levels, 0: as the link sustains */
+  int   cutoff;           /* grey from which an image pixel is on, 0: default */
+  int   crop;             /* images are cropped to 8x8 instead of scaled */
+  int   downsample;       /* fit stores into the device, do not reject them */
+  int   pipeline;         /* display frames do not wait for their acknowledge */
+} CMD_OPTIONS;
 
 #if COMMAND_SRC
 # define EXTERN 
@@ -12,6 +35,8 @@
 # define EXTERN extern
 #endif
 
+EXTERN CMD_OPTIONS cmd_options;
+
 
 EXTERN int get_firmwareversion(SERHDL hdl, int myargc, char **myargv);
 EXTERN int display_text(SERHDL hdl, int myargc, char **myargv);
@@ -19,10 +44,27 @@ EXTERN int store_text(SERHDL hdl, int myargc, char **myargv);
 EXTERN int set_textspeed(SERHDL hdl, int myargc, char **myargv);
 EXTERN int display_pattern(SERHDL hdl, int myargc, char **myargv);
 EXTERN int store_pattern(SERHDL hdl, int myargc, char **myargv);
+EXTERN int play_pattern(SERHDL hdl, int myargc, char **myargv);
 EXTERN int set_normalmode(SERHDL hdl, int myargc, char **myargv);
 EXTERN int set_textmode(SERHDL hdl, int myargc, char **myargv);
 EXTERN int set_patternmode(SERHDL hdl, int myargc, char **myargv);
 EXTERN int exe_factoryreset(SERHDL hdl, int myargc, char **myargv);
+EXTERN void print_wire_budget(void);
+EXTERN int store_encoded(SERHDL hdl, char *device, ENCODED *enc,
+                         int *unchanged);
+EXTERN int begin_store(SERHDL hdl, char *device, ENCODED *enc,
+                       int *unchanged, char *key, int keylen);
+EXTERN void end_store(char *key, ENCODED *enc);
+EXTERN int query_firmwareversion(SERHDL hdl, char *version, int len);
+EXTERN void forget_stored(char *device, char *version);
+
+EXTERN int send_command(SERHDL hdl, char command, int nparam,
+                        unsigned char *params);
+EXTERN int send_frame(SERHDL hdl, unsigned char *frame, int len);
+EXTERN int receive_response(SERHDL hdl, unsigned char *response, int rsplen);
+EXTERN int exchange_frames(SERIO *ios, int nios);
+EXTERN long long play_time_us(void);
+EXTERN void play_wait_until(long long due);
 
 #undef EXTERN
 
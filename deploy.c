@@ -0,0 +1,624 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <clock.h>
+#include <discover.h>
+#include <portlock.h>
+#include <anim.h>
+#include <state.h>
+
+#define DEPLOY_SRC 1
+#include <deploy.h>
+#undef DEPLOY_SRC
+
+/* Deploy stores pattern files on many modules at once. The manifest has
+   one line per module:
+     <serial device> <patternfile>
+   Empty lines and lines starting with # are skipped. Every pattern file
+   is read and encoded once, however many modules get it.
+
+   The main thread locks the ports one after the other in the order of
+   their lock files, like canvas does, so two deploys that share devices
+   do not each hold one the other waits for. The devices are then dealt
+   out to --jobs workers (default 8). A worker keeps up to WORKER_DEVICES
+   of them going, it opens a device, asks whether it holds the content
+   already and then sends its patterns, the next pattern of each of its
+   devices in a single transfer_serial. A device that is done or has
+   failed makes room for the next one. A worker takes the devices from
+   the front of its own queue, when that is empty it steals from the back
+   of the other queues, so a worker with fast devices helps the ones with
+   slow devices. */
+
+#define RET_DEPLOY_OK         (0)
+#define RET_DEPLOY_ERR_LAYOUT (1)
+#define RET_DEPLOY_ERR_READ   (2)
+#define RET_DEPLOY_ERR_OPEN   (3)
+#define RET_DEPLOY_ERR_STORE  (4)
+
+#define MAX_TARGETS (1024)
+#define MAX_JOBS (64)
+#define DEFAULT_JOBS (8)
+#define WORKER_DEVICES (8)
+#define MAX_MANIFEST_LINE (1024)
+#define CMD_DEPLOY_RSP_LEN (6)
+
+typedef struct deploy DEPLOY;
+
+typedef struct {
+  char      *path;
+  ENCODED    enc;
+  ANIM       anim;            /* a compiled file, enc points into it */
+  int        rc;
+} CONTENT;
+
+typedef struct {
+  char          *device;
+  char          *lockfile;
+  CONTENT       *content;
+  int            rc;
+  int            unchanged;
+  int            frame;         /* the next pattern to send */
+  SERHDL         hdl;
+  PORTLOCK       lock;
+  char           key[MAX_STATE_LINE];
+  unsigned char  response[CMD_DEPLOY_RSP_LEN];
+  long long      start;
+  long long      time_us;
+} TARGET;
+
+typedef struct {
+  pthread_mutex_t lock;
+  int            *queue;          /* targets, taken from head to tail */
+  int             head;
+  int             tail;
+  int             stolen;         /* targets taken from other workers */
+  pthread_t       thread;
+  int             index;
+  DEPLOY         *deploy;
+} WORKER;
+
+struct deploy {
+  CONTENT   contents[MAX_TARGETS];
+  int        ncontents;
+  TARGET     targets[MAX_TARGETS];
+  TARGET    *order[MAX_TARGETS];  /* the targets by lock file */
+  int        ntargets;
+  WORKER     workers[MAX_JOBS];
+  int        nworkers;
+};
+
+static int read_manifest(char *path, DEPLOY *deploy);
+static CONTENT *get_content(DEPLOY *deploy, char *path);
+static void encode_contents(DEPLOY *deploy);
+static void lock_targets(DEPLOY *deploy);
+static int compare_lockfiles(const void *a, const void *b);
+static void run_workers(DEPLOY *deploy);
+static void *worker_thread(void *arg);
+static int next_target(WORKER *worker);
+static int prepare_target(TARGET *target);
+static void finish_target(TARGET *target);
+static void free_deploy(DEPLOY *deploy);
+
+
+int deploy_patterns(int myargc, char **myargv)
+{
+  int rc;
+  DEPLOY *deploy;
+  TARGET *target;
+  long long start;
+  long long total;
+  int i;
+  int stored;
+  int unchanged;
+  int failed;
+  int stolen;
+
+  if ((deploy = calloc(1, sizeof(DEPLOY))) == NULL)
+  {
+    rc = RET_DEPLOY_ERR_LAYOUT;
+    goto EXIT;
+  }
+
+  if ((rc = read_manifest(myargv[0], deploy)) != RET_DEPLOY_OK)
+  {
+    fprintf(stderr, "read of manifest %s has failed\n", myargv[0]);
+    goto FREE_EXIT;
+  }
+
+  start = get_time_us();
+
+  /* a pattern file that can not be read fails its devices only */
+  encode_contents(deploy);
+  lock_targets(deploy);
+  run_workers(deploy);
+
+  total = get_time_us() - start;
+
+  stored = 0;
+  unchanged = 0;
+  failed = 0;
+  for (i = 0; i < deploy->ntargets; i++)
+  {
+    target = &deploy->targets[i];
+    if (target->rc != RET_DEPLOY_OK)
+    {
+      failed++;
+    }
+    else if (target->unchanged)
+    {
+      unchanged++;
+    }
+    else
+    {
+      stored++;
+    }
+    printf("%s: %s %s, %d patterns, %lld.%03lld s\n", target->device,
+           target->content->path,
+           (target->rc != RET_DEPLOY_OK) ? "failed" :
+           target->unchanged ? "unchanged" : "stored",
+           target->content->enc.nframes,
+           target->time_us / 1000000, target->time_us / 1000 % 1000);
+  }
+
+  stolen = 0;
+  for (i = 0; i < deploy->nworkers; i++)
+  {
+    stolen += deploy->workers[i].stolen;
+  }
+
+  printf("%d devices, %d stored, %d unchanged, %d failed, %d workers, "
+         "%d devices stolen, %lld.%03lld s\n", deploy->ntargets, stored,
+         unchanged, failed, deploy->nworkers, stolen,
+         total / 1000000, total / 1000 % 1000);
+
+  rc = (failed > 0) ? RET_DEPLOY_ERR_STORE : RET_DEPLOY_OK;
+
+FREE_EXIT:
+  free_deploy(deploy);
+
+EXIT:
+  return rc;
+}
+
+
+static int read_manifest(char *path, DEPLOY *deploy)
+{
+  int rc;
+  FILE *file;
+  char line[MAX_MANIFEST_LINE];
+  char device[MAX_MANIFEST_LINE];
+  char patternfile[MAX_MANIFEST_LINE];
+  char lockfile[PATH_MAX];
+  TARGET *target;
+  int i;
+
+  if ((file = fopen(path, "r")) == NULL)
+  {
+    rc = RET_DEPLOY_ERR_LAYOUT;
+    goto EXIT;
+  }
+
+  rc = RET_DEPLOY_OK;
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    if (sscanf(line, "%s", device) != 1 || device[0] == '#')
+    {
+      continue;
+    }
+    if ((sscanf(line, "%s %s", device, patternfile) != 2) ||
+        (deploy->ntargets == MAX_TARGETS))
+    {
+      rc = RET_DEPLOY_ERR_LAYOUT;
+      break;
+    }
+
+    /* a device is written by one target, links to it name the same one */
+    if (get_lockfile(device, lockfile, sizeof(lockfile)) != RET_PORTLOCK_OK)
+    {
+      rc = RET_DEPLOY_ERR_LAYOUT;
+      break;
+    }
+    for (i = 0; i < deploy->ntargets; i++)
+    {
+      if (strcmp(deploy->targets[i].lockfile, lockfile) == 0)
+      {
+        fprintf(stderr, "device %s is in the manifest twice, as %s.\n",
+                device, deploy->targets[i].device);
+        break;
+      }
+    }
+    if (i < deploy->ntargets)
+    {
+      rc = RET_DEPLOY_ERR_LAYOUT;
+      break;
+    }
+
+    target = &deploy->targets[deploy->ntargets++];
+    target->device = strdup(device);
+    target->lockfile = strdup(lockfile);
+    target->content = get_content(deploy, patternfile);
+  }
+
+  if (deploy->ntargets == 0)
+  {
+    rc = RET_DEPLOY_ERR_LAYOUT;
+  }
+
+  fclose(file);
+
+EXIT:
+  return rc;
+}
+
+
+/* devices with the same pattern file share its content */
+static CONTENT *get_content(DEPLOY *deploy, char *path)
+{
+  CONTENT *content;
+  int i;
+
+  for (i = 0; i < deploy->ncontents; i++)
+  {
+    if (strcmp(deploy->contents[i].path, path) == 0)
+    {
+      return (&deploy->contents[i]);
+    }
+  }
+
+  content = &deploy->contents[deploy->ncontents++];
+  content->path = strdup(path);
+
+  return (content);
+}
+
+
+static void encode_contents(DEPLOY *deploy)
+{
+  int i;
+  CONTENT *content;
+  SEQUENCE seq;
+
+  for (i = 0; i < deploy->ncontents; i++)
+  {
+    content = &deploy->contents[i];
+
+    if (is_animation(content->path))
+    {
+      if (map_animation(content->path, &content->anim) != RET_ANIM_OK)
+      {
+        fprintf(stderr, "read of compiled file %s has failed\n",
+                content->path);
+        content->rc = RET_DEPLOY_ERR_READ;
+      }
+      content->enc = content->anim.enc;
+      continue;
+    }
+
+    init_sequence(&seq);
+    if (read_sequence(content->path, &seq) != RET_SEQUENCE_OK)
+    {
+      fprintf(stderr, "read of patternfile %s has failed\n", content->path);
+      content->rc = RET_DEPLOY_ERR_READ;
+    }
+    else
+    {
+      coalesce_sequence(&seq);
+      if (encode_sequence(&seq, &content->enc) != RET_SEQUENCE_OK)
+      {
+        content->rc = RET_DEPLOY_ERR_READ;
+      }
+    }
+    free_sequence(&seq);
+  }
+}
+
+
+/* queues for the ports in the order of their lock files */
+static void lock_targets(DEPLOY *deploy)
+{
+  TARGET *target;
+  int i;
+
+  for (i = 0; i < deploy->ntargets; i++)
+  {
+    target = &deploy->targets[i];
+    target->lock.fd = -1;
+    deploy->order[i] = target;
+  }
+  if (cmd_options.dryrun)
+  {
+    return;
+  }
+  qsort(deploy->order, deploy->ntargets, sizeof(deploy->order[0]),
+        compare_lockfiles);
+
+  for (i = 0; i < deploy->ntargets; i++)
+  {
+    target = deploy->order[i];
+    if (target->content->rc != RET_DEPLOY_OK)
+    {
+      continue;
+    }
+    if ((check_discovered(target->device) != RET_DISCOVER_OK) ||
+        (lock_port(target->device, cmd_options.wait, &target->lock) !=
+         RET_PORTLOCK_OK))
+    {
+      fprintf(stderr, "open of device %s has failed.\n", target->device);
+      target->rc = RET_DEPLOY_ERR_OPEN;
+    }
+  }
+}
+
+
+static int compare_lockfiles(const void *a, const void *b)
+{
+  return strcmp((*(TARGET **) a)->lockfile, (*(TARGET **) b)->lockfile);
+}
+
+
+/* deals the targets out round robin and waits for all workers */
+static void run_workers(DEPLOY *deploy)
+{
+  int i;
+  int jobs;
+  WORKER *worker;
+
+  jobs = (cmd_options.jobs > 0) ? cmd_options.jobs : DEFAULT_JOBS;
+  if (jobs > MAX_JOBS)
+  {
+    jobs = MAX_JOBS;
+  }
+  if (jobs > deploy->ntargets)
+  {
+    jobs = deploy->ntargets;
+  }
+  deploy->nworkers = jobs;
+
+  for (i = 0; i < deploy->nworkers; i++)
+  {
+    worker = &deploy->workers[i];
+    pthread_mutex_init(&worker->lock, NULL);
+    worker->queue = malloc(deploy->ntargets * sizeof(int));
+    worker->index = i;
+    worker->deploy = deploy;
+  }
+  for (i = 0; i < deploy->ntargets; i++)
+  {
+    worker = &deploy->workers[i % deploy->nworkers];
+    worker->queue[worker->tail++] = i;
+  }
+
+  for (i = 0; i < deploy->nworkers; i++)
+  {
+    pthread_create(&deploy->workers[i].thread, NULL, worker_thread,
+                   &deploy->workers[i]);
+  }
+  for (i = 0; i < deploy->nworkers; i++)
+  {
+    pthread_join(deploy->workers[i].thread, NULL);
+    pthread_mutex_destroy(&deploy->workers[i].lock);
+    free(deploy->workers[i].queue);
+  }
+}
+
+
+/* sends the next pattern of all its devices at once, a device that is
+   done is replaced by the next one of the queues */
+static void *worker_thread(void *arg)
+{
+  WORKER *worker;
+  DEPLOY *deploy;
+  TARGET *active[WORKER_DEVICES];
+  SERIO ios[WORKER_DEVICES];
+  TARGET *target;
+  ENCODED *enc;
+  int nactive;
+  int more;
+  int i;
+  int k;
+
+  worker = arg;
+  deploy = worker->deploy;
+  nactive = 0;
+  more = 1;
+  for (;;)
+  {
+    while (more && (nactive < WORKER_DEVICES))
+    {
+      if ((k = next_target(worker)) < 0)
+      {
+        more = 0;
+      }
+      else if (prepare_target(&deploy->targets[k]))
+      {
+        active[nactive++] = &deploy->targets[k];
+      }
+    }
+    if (nactive == 0)
+    {
+      break;
+    }
+
+    for (i = 0; i < nactive; i++)
+    {
+      enc = &active[i]->content->enc;
+      k = active[i]->frame;
+      ios[i].hdl = active[i]->hdl;
+      ios[i].tx = enc->data + enc->offsets[k];
+      ios[i].txlen = enc->offsets[k + 1] - enc->offsets[k];
+      ios[i].rx = active[i]->response;
+      ios[i].rxlen = CMD_DEPLOY_RSP_LEN;
+    }
+
+    exchange_frames(ios, nactive);
+
+    k = 0;
+    for (i = 0; i < nactive; i++)
+    {
+      target = active[i];
+      if (ios[i].rc != RET_COMMAND_OK)
+      {
+        if ((ios[i].rc == RET_COMMAND_ERR_NAK) && (target->frame > 0))
+        {
+          fprintf(stderr, "storage for patterns of %s is exhausted.\n",
+                  target->device);
+        }
+        else
+        {
+          fprintf(stderr, "receiving response of command storepattern "
+                          "from %s has failed.\n", target->device);
+        }
+        target->rc = RET_DEPLOY_ERR_STORE;
+      }
+      if ((target->rc != RET_DEPLOY_OK) ||
+          (++target->frame == target->content->enc.nframes))
+      {
+        finish_target(target);
+        continue;
+      }
+      active[k++] = target;
+    }
+    nactive = k;
+  }
+
+  return NULL;
+}
+
+
+/* own queue from the front, the other queues from the back,
+   -1 when all queues are empty, no targets are added later */
+static int next_target(WORKER *worker)
+{
+  DEPLOY *deploy;
+  WORKER *victim;
+  int target;
+  int i;
+
+  target = -1;
+  pthread_mutex_lock(&worker->lock);
+  if (worker->head < worker->tail)
+  {
+    target = worker->queue[worker->head++];
+  }
+  pthread_mutex_unlock(&worker->lock);
+  if (target >= 0)
+  {
+    return (target);
+  }
+
+  deploy = worker->deploy;
+  for (i = 1; (i < deploy->nworkers) && (target < 0); i++)
+  {
+    victim = &deploy->workers[(worker->index + i) % deploy->nworkers];
+    pthread_mutex_lock(&victim->lock);
+    if (victim->head < victim->tail)
+    {
+      target = victim->queue[--victim->tail];
+      worker->stolen++;
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+
+  return (target);
+}
+
+
+/* returns 1 when the patterns of the target are to be sent, else it is
+   done */
+static int prepare_target(TARGET *target)
+{
+  target->start = get_time_us();
+
+  if (target->rc != RET_DEPLOY_OK)
+  {
+    /* its port has not been locked */
+    goto EXIT;
+  }
+
+  if (target->content->rc != RET_DEPLOY_OK)
+  {
+    target->rc = target->content->rc;
+    goto EXIT;
+  }
+
+  if (!cmd_options.dryrun &&
+      (open_serial(target->device, &target->hdl) != RET_SERIAL_OK))
+  {
+    fprintf(stderr, "open of device %s has failed.\n", target->device);
+    target->rc = RET_DEPLOY_ERR_OPEN;
+    goto EXIT;
+  }
+
+  if (begin_store(target->hdl, target->device, &target->content->enc,
+                  &target->unchanged, target->key, sizeof(target->key)) !=
+      RET_COMMAND_OK)
+  {
+    target->rc = RET_DEPLOY_ERR_STORE;
+  }
+  else if (!target->unchanged)
+  {
+    if (target->content->enc.nframes > 0)
+    {
+      return 1;
+    }
+    end_store(target->key, &target->content->enc);
+  }
+
+  if (!cmd_options.dryrun)
+  {
+    close_serial(target->hdl);
+  }
+
+EXIT:
+  unlock_port(&target->lock);
+  target->time_us = get_time_us() - target->start;
+  return 0;
+}
+
+
+/* after the last pattern or a failed one */
+static void finish_target(TARGET *target)
+{
+  if (target->rc == RET_DEPLOY_OK)
+  {
+    end_store(target->key, &target->content->enc);
+  }
+  if (!cmd_options.dryrun)
+  {
+    close_serial(target->hdl);
+  }
+  unlock_port(&target->lock);
+  target->time_us = get_time_us() - target->start;
+}
+
+
+static void free_deploy(DEPLOY *deploy)
+{
+  int i;
+
+  for (i = 0; i < deploy->ntargets; i++)
+  {
+    free(deploy->targets[i].device);
+    free(deploy->targets[i].lockfile);
+  }
+  for (i = 0; i < deploy->ncontents; i++)
+  {
+    free(deploy->contents[i].path);
+    if (deploy->contents[i].anim.map != NULL)
+    {
+      unmap_animation(&deploy->contents[i].anim);
+    }
+    else
+    {
+      free_encoded(&deploy->contents[i].enc);
+    }
+  }
+  free(deploy);
+}
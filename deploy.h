@@ -0,0 +1,14 @@
+#ifndef DEPLOY_H
+#define DEPLOY_H
+
+#if DEPLOY_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int deploy_patterns(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if LINUX
+#  include <glob.h>
+#endif
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <state.h>
+#include <wire.h>
+#include <crc16.h>
+#include <clock.h>
+#include <portlock.h>
+
+#define DISCOVER_SRC 1
+#include <discover.h>
+#undef DISCOVER_SRC
+
+/* Discover opens all candidate ports, by default /dev/ttyUSB* and
+   /dev/ttyACM* (COM1 to COM16 on Windows), and asks all of them for their
+   firmware version in one batch of transfer_serial, so a port without a
+   module costs DISCOVER_TIMEOUT_MS once and not once per port.
+
+   The result goes to the state file .mmm8x8_devices, one record per port:
+     <port> TAB ok <firmware version> <time>
+     <port> TAB silent - <time>
+   Commands on a port that was silent at a discover in the last
+   DISCOVER_MAX_AGE_S seconds fail at once instead of waiting for the
+   read timeout, unless --force is given. A port another invocation is
+   using is reported as busy and keeps its record. */
+
+#define DEVICES "devices"
+
+#define MAX_CANDIDATES      (256)
+#define DISCOVER_TIMEOUT_MS (200)
+#define DISCOVER_MAX_AGE_S  (3600)
+
+#define CMD_VERSION_RSP_LEN (12)
+
+typedef struct {
+  char          *path;
+  SERHDL         hdl;
+  PORTLOCK       lock;
+  int            busy;
+  int            opened;
+  unsigned char  response[CMD_VERSION_RSP_LEN];
+  char           version[32];
+} CANDIDATE;
+
+static int find_candidates(char *pattern, char **paths, int max);
+static int check_version(CANDIDATE *candidate, SERIO *io);
+
+
+/* discover [<pattern>]: probes the ports matching pattern */
+int discover_devices(int myargc, char **myargv)
+{
+  int rc;
+  char *paths[MAX_CANDIDATES];
+  CANDIDATE *candidates;
+  SERIO *ios;
+  int *index;
+  unsigned char frame[MAX_FRAME_LEN];
+  int framelen;
+  char value[MAX_STATE_LINE];
+  int ncandidates;
+  int nios;
+  int found;
+  long long start;
+  long long us;
+  int i;
+
+  ncandidates = find_candidates((myargc > 0) ? myargv[0] : NULL, paths,
+                                MAX_CANDIDATES);
+
+  candidates = calloc(ncandidates + 1, sizeof(CANDIDATE));
+  ios = calloc(ncandidates + 1, sizeof(SERIO));
+  index = calloc(ncandidates + 1, sizeof(int));
+  if ((candidates == NULL) || (ios == NULL) || (index == NULL))
+  {
+    rc = RET_DISCOVER_ERR_OPEN;
+    goto FREE_EXIT;
+  }
+
+  start = get_time_us();
+
+  /* the ports are opened with O_NDELAY, opening does not wait */
+  framelen = encode_command('v', 0, NULL, frame);
+  nios = 0;
+  for (i = 0; i < ncandidates; i++)
+  {
+    candidates[i].path = paths[i];
+    candidates[i].lock.fd = -1;
+    if (lock_port(paths[i], -1, &candidates[i].lock) != RET_PORTLOCK_OK)
+    {
+      candidates[i].busy = 1;
+      continue;
+    }
+    if (open_serial(paths[i], &candidates[i].hdl) != RET_SERIAL_OK)
+    {
+      continue;
+    }
+    candidates[i].opened = 1;
+    ios[nios].hdl = candidates[i].hdl;
+    ios[nios].tx = frame;
+    ios[nios].txlen = framelen;
+    ios[nios].rx = candidates[i].response;
+    ios[nios].rxlen = CMD_VERSION_RSP_LEN;
+    index[nios++] = i;
+  }
+
+  if (nios > 0)
+  {
+    transfer_serial(ios, nios, DISCOVER_TIMEOUT_MS);
+  }
+  us = get_time_us() - start;
+
+  found = 0;
+  for (i = 0; i < nios; i++)
+  {
+    if (check_version(&candidates[index[i]], &ios[i]) == RET_DISCOVER_OK)
+    {
+      found++;
+    }
+  }
+
+  for (i = 0; i < ncandidates; i++)
+  {
+    if (candidates[i].busy)
+    {
+      printf("%s: busy\n", candidates[i].path);
+      continue;
+    }
+    if (candidates[i].version[0] != '\0')
+    {
+      printf("%s: firmware version %s\n", candidates[i].path,
+             candidates[i].version);
+      snprintf(value, sizeof(value), "ok %s %lld", candidates[i].version,
+               (long long) time(NULL));
+    }
+    else
+    {
+      printf("%s: %s\n", candidates[i].path,
+             candidates[i].opened ? "no response" : "open has failed");
+      snprintf(value, sizeof(value), "silent - %lld", (long long) time(NULL));
+    }
+    if (write_state(DEVICES, candidates[i].path, value) != RET_STATE_OK)
+    {
+      fprintf(stderr, "write of state %s has failed.\n", DEVICES);
+    }
+    if (candidates[i].opened)
+    {
+      close_serial(candidates[i].hdl);
+    }
+    unlock_port(&candidates[i].lock);
+  }
+
+  printf("%d ports, %d modules, %lld.%03lld s\n", ncandidates, found,
+         us / 1000000, us / 1000 % 1000);
+
+  rc = (found > 0) ? RET_DISCOVER_OK : RET_DISCOVER_NONE;
+
+FREE_EXIT:
+  for (i = 0; i < ncandidates; i++)
+  {
+    free(paths[i]);
+  }
+  free(index);
+  free(ios);
+  free(candidates);
+
+  return rc;
+}
+
+
+/* RET_DISCOVER_SILENT if the device has not answered the last discover,
+   RET_DISCOVER_OK if it has, if it is not known or the record is old */
+int check_discovered(char *device)
+{
+  char value[MAX_STATE_LINE];
+  char state[16];
+  long long when;
+
+  if (cmd_options.force ||
+      (read_state(DEVICES, device, value, sizeof(value)) != RET_STATE_OK) ||
+      (sscanf(value, "%15s %*s %lld", state, &when) != 2) ||
+      (strcmp(state, "silent") != 0) ||
+      ((long long) time(NULL) - when > DISCOVER_MAX_AGE_S))
+  {
+    return RET_DISCOVER_OK;
+  }
+
+  fprintf(stderr, "device %s has not answered at the last discover, run "
+                  "discover again or use --force.\n", device);
+
+  return RET_DISCOVER_SILENT;
+}
+
+
+/* the paths matching pattern, the default patterns if it is NULL */
+static int find_candidates(char *pattern, char **paths, int max)
+{
+  int n;
+#if LINUX
+  static char *defaults[] = { "/dev/ttyUSB*", "/dev/ttyACM*" };
+  glob_t found;
+  int flags;
+  int i;
+
+  memset(&found, 0, sizeof(found));
+  flags = 0;
+  if (pattern != NULL)
+  {
+    glob(pattern, 0, NULL, &found);
+  }
+  else
+  {
+    for (i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+    {
+      glob(defaults[i], flags, NULL, &found);
+      flags = GLOB_APPEND;
+    }
+  }
+
+  for (n = 0; (n < max) && (n < found.gl_pathc); n++)
+  {
+    paths[n] = strdup(found.gl_pathv[n]);
+  }
+  globfree(&found);
+#endif
+#if WIN
+  char name[16];
+
+  if (pattern != NULL)
+  {
+    paths[0] = strdup(pattern);
+    return 1;
+  }
+  for (n = 0; (n < max) && (n < 16); n++)
+  {
+    snprintf(name, sizeof(name), "COM%d", n + 1);
+    paths[n] = strdup(name);
+  }
+#endif
+
+  return n;
+}
+
+
+/* a complete response with the right checksum and ACK */
+static int check_version(CANDIDATE *candidate, SERIO *io)
+{
+  unsigned short crc16;
+  unsigned char *rsp;
+  int i;
+
+  rsp = candidate->response;
+  if ((io->rc != CMD_VERSION_RSP_LEN) || (rsp[0] != STX) || (rsp[3] == NAK))
+  {
+    return RET_DISCOVER_NONE;
+  }
+
+  crc16 = INITIAL_VALUE;
+  for (i = 0; i < CMD_VERSION_RSP_LEN - 2; i++)
+  {
+    crc16 = calc_crc16(crc16, rsp[i]);
+  }
+  if ((rsp[CMD_VERSION_RSP_LEN - 2] != (crc16 >> 8)) ||
+      (rsp[CMD_VERSION_RSP_LEN - 1] != (crc16 & 0xff)))
+  {
+    return RET_DISCOVER_NONE;
+  }
+
+  snprintf(candidate->version, sizeof(candidate->version), "%d.%d.%d",
+           rsp[4] * 256 + rsp[5], rsp[6] * 256 + rsp[7],
+           rsp[8] * 256 + rsp[9]);
+
+  return RET_DISCOVER_OK;
+}
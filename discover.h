@@ -0,0 +1,20 @@
+#ifndef DISCOVER_H
+#define DISCOVER_H
+
+#define RET_DISCOVER_OK       (0)
+#define RET_DISCOVER_NONE     (1)   /* no module has answered */
+#define RET_DISCOVER_ERR_OPEN (2)
+#define RET_DISCOVER_SILENT   (3)   /* the device did not answer last time */
+
+#if DISCOVER_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int discover_devices(int myargc, char **myargv);
+EXTERN int check_discovered(char *device);
+
+#undef EXTERN
+
+#endif
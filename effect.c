@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <frame64.h>
+
+#define EFFECT_SRC 1
+#include <effect.h>
+#undef EFFECT_SRC
+
+/* Transitions between two patterns. Step 1 to steps of a transition are
+   the patterns between from and to, neither of the two is one of them.
+   Each one is computed when it is needed, out of a few operations of
+   frame64.h, so a transition takes no memory, file or upload of its own. */
+
+typedef FRAME64 (*EFFECT_FCT)(FRAME64 from, FRAME64 to, int k);
+
+typedef struct {
+  char       *name;
+  EFFECT_FCT  fct;
+  int         range;      /* k of the steps goes from 0 to range */
+} EFFECT;
+
+static FRAME64 wipe_left(FRAME64 from, FRAME64 to, int k);
+static FRAME64 wipe_right(FRAME64 from, FRAME64 to, int k);
+static FRAME64 wipe_up(FRAME64 from, FRAME64 to, int k);
+static FRAME64 wipe_down(FRAME64 from, FRAME64 to, int k);
+static FRAME64 slide_left(FRAME64 from, FRAME64 to, int k);
+static FRAME64 slide_right(FRAME64 from, FRAME64 to, int k);
+static FRAME64 slide_up(FRAME64 from, FRAME64 to, int k);
+static FRAME64 slide_down(FRAME64 from, FRAME64 to, int k);
+static FRAME64 iris(FRAME64 from, FRAME64 to, int k);
+static FRAME64 dissolve(FRAME64 from, FRAME64 to, int k);
+
+static EFFECT effect_table[] =
+{
+/*  name,          fct,          range */
+  { "wipe-left",   wipe_left,    8 },     /* to comes in from the right */
+  { "wipe-right",  wipe_right,   8 },
+  { "wipe-up",     wipe_up,      8 },
+  { "wipe-down",   wipe_down,    8 },
+  { "slide-left",  slide_left,   8 },     /* to pushes from out */
+  { "slide-right", slide_right,  8 },
+  { "slide-up",    slide_up,     8 },
+  { "slide-down",  slide_down,   8 },
+  { "iris",        iris,         4 },     /* to grows from the middle */
+  { "dissolve",    dissolve,     64 },    /* pixel by pixel */
+};
+
+/* the step at which each pixel turns into to for dissolve, a fixed
+   shuffle of 0 to 63 so a dissolve looks the same every time */
+static const unsigned char dissolve_order[64] =
+{
+  37,  8, 59, 22, 45,  3, 30, 51, 14, 62, 27,  6, 40, 19, 56, 33,
+  11, 48,  1, 25, 53, 36, 17, 60,  9, 42, 28,  4, 57, 21, 46, 13,
+  32, 63, 18,  0, 39, 24, 52,  7, 44, 15, 58, 29, 35, 10, 50, 23,
+   2, 41, 55, 16, 31, 61,  5, 47, 26, 38, 12, 54, 20, 43, 34, 49
+};
+
+
+/* the index of the effect, -1 if there is none of that name */
+int find_effect(char *name)
+{
+  int i;
+
+  for (i = 0; i < sizeof(effect_table) / sizeof(EFFECT); i++)
+  {
+    if (strcmp(effect_table[i].name, name) == 0)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+
+/* pattern is step (1 to steps) of the way from from to to */
+void make_effect(int effect, unsigned char *from, unsigned char *to,
+                 int step, int steps, unsigned char *pattern)
+{
+  EFFECT *e;
+  int k;
+
+  e = &effect_table[effect];
+  k = step * e->range / (steps + 1);
+  frame64_to_pattern(e->fct(frame64_from_pattern(from),
+                            frame64_from_pattern(to), k), pattern);
+}
+
+
+void print_effects(FILE *file)
+{
+  int i;
+
+  for (i = 0; i < sizeof(effect_table) / sizeof(EFFECT); i++)
+  {
+    fprintf(file, "%s%s", (i == 0) ? "" : ", ", effect_table[i].name);
+  }
+}
+
+
+static FRAME64 wipe_left(FRAME64 from, FRAME64 to, int k)
+{
+  return frame64_select(from, to, ~frame64_columns(8 - k));
+}
+
+
+static FRAME64 wipe_right(FRAME64 from, FRAME64 to, int k)
+{
+  return frame64_select(from, to, frame64_columns(k));
+}
+
+
+static FRAME64 wipe_up(FRAME64 from, FRAME64 to, int k)
+{
+  return frame64_select(from, to, ~frame64_lines(8 - k));
+}
+
+
+static FRAME64 wipe_down(FRAME64 from, FRAME64 to, int k)
+{
+  return frame64_select(from, to, frame64_lines(k));
+}
+
+
+/* column x shows column x + k of from, or of to once that is past the
+   right edge, which the rotation of to has in place already */
+static FRAME64 slide_left(FRAME64 from, FRAME64 to, int k)
+{
+  k &= 7;
+  return frame64_select(frame64_shift_left(from, k),
+                        frame64_rotate_left(to, k), ~frame64_columns(8 - k));
+}
+
+
+static FRAME64 slide_right(FRAME64 from, FRAME64 to, int k)
+{
+  k &= 7;
+  return frame64_select(frame64_shift_right(from, k),
+                        frame64_rotate_right(to, k), frame64_columns(k));
+}
+
+
+static FRAME64 slide_up(FRAME64 from, FRAME64 to, int k)
+{
+  k &= 7;
+  return frame64_select(frame64_shift_up(from, k),
+                        frame64_rotate_up(to, k), ~frame64_lines(8 - k));
+}
+
+
+static FRAME64 slide_down(FRAME64 from, FRAME64 to, int k)
+{
+  k &= 7;
+  return frame64_select(frame64_shift_down(from, k),
+                        frame64_rotate_down(to, k), frame64_lines(k));
+}
+
+
+/* a square of 2k by 2k pixels in the middle */
+static FRAME64 iris(FRAME64 from, FRAME64 to, int k)
+{
+  FRAME64 columns;
+  FRAME64 lines;
+
+  columns = frame64_columns(4 + k) & ~frame64_columns(4 - k);
+  lines = frame64_lines(4 + k) & ~frame64_lines(4 - k);
+
+  return frame64_select(from, to, columns & lines);
+}
+
+
+static FRAME64 dissolve(FRAME64 from, FRAME64 to, int k)
+{
+  FRAME64 mask;
+  int i;
+
+  mask = 0;
+  for (i = 0; i < 64; i++)
+  {
+    mask |= (FRAME64) (dissolve_order[i] < k) << i;
+  }
+
+  return frame64_select(from, to, mask);
+}
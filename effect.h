@@ -0,0 +1,20 @@
+#ifndef EFFECT_H
+#define EFFECT_H
+
+#define DEFAULT_EFFECT       "dissolve"
+#define DEFAULT_EFFECT_STEPS (8)
+
+#if EFFECT_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int find_effect(char *name);
+EXTERN void make_effect(int effect, unsigned char *from, unsigned char *to,
+                        int step, int steps, unsigned char *pattern);
+EXTERN void print_effects(FILE *file);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,400 @@
+#if LINUX
+#  define _GNU_SOURCE     /* posix_openpt, ptsname_r */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if LINUX
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <termios.h>
+#  include <time.h>
+#  include <unistd.h>
+#endif
+
+#include <wire.h>
+#include <crc16.h>
+#include <clock.h>
+
+#define EMULATOR_SRC 1
+#include <emulator.h>
+#undef EMULATOR_SRC
+
+#define ACK 0x06
+
+#if LINUX
+
+static int open_port(EMULATED_PORT *port);
+static void *serve_ports(void *arg);
+static void answer_command(EMULATOR *emulator, EMULATED_PORT *port, int ok);
+static void send_answer(EMULATOR *emulator, EMULATED_PORT *port,
+                        unsigned char *payload, int len);
+static long long write_due(EMULATOR *emulator, long long now);
+static long long write_held(EMULATED_PORT *port, long long now);
+
+
+int start_emulator(int nports, EMULATOR **emulator)
+{
+  int rc;
+  EMULATOR *emu;
+  int i;
+
+  if ((nports <= 0) || (nports > MAX_EMULATED_PORTS) ||
+      ((emu = calloc(1, sizeof(EMULATOR))) == NULL))
+  {
+    rc = RET_EMULATOR_ERR_OPEN;
+    goto EXIT;
+  }
+  emu->capacity = EMULATOR_CAPACITY;
+
+  if ((emu->ports = calloc(nports, sizeof(EMULATED_PORT))) == NULL)
+  {
+    rc = RET_EMULATOR_ERR_OPEN;
+    goto FREE_EXIT;
+  }
+
+  for (emu->nports = 0; emu->nports < nports; emu->nports++)
+  {
+    if (open_port(&emu->ports[emu->nports]) != RET_EMULATOR_OK)
+    {
+      rc = RET_EMULATOR_ERR_OPEN;
+      goto CLOSE_EXIT;
+    }
+  }
+
+  if (pipe(emu->wakeup) != 0)
+  {
+    rc = RET_EMULATOR_ERR_OPEN;
+    goto CLOSE_EXIT;
+  }
+
+  if (pthread_create(&emu->thread, NULL, serve_ports, emu) != 0)
+  {
+    close(emu->wakeup[0]);
+    close(emu->wakeup[1]);
+    rc = RET_EMULATOR_ERR_OPEN;
+    goto CLOSE_EXIT;
+  }
+
+  *emulator = emu;
+  rc = RET_EMULATOR_OK;
+  goto EXIT;
+
+CLOSE_EXIT:
+  for (i = 0; i < emu->nports; i++)
+  {
+    close(emu->ports[i].slave);
+    close(emu->ports[i].master);
+  }
+  free(emu->ports);
+
+FREE_EXIT:
+  free(emu);
+
+EXIT:
+  return rc;
+}
+
+
+void stop_emulator(EMULATOR *emulator)
+{
+  int i;
+
+  if (write(emulator->wakeup[1], "", 1) == 1)
+  {
+    pthread_join(emulator->thread, NULL);
+  }
+  close(emulator->wakeup[0]);
+  close(emulator->wakeup[1]);
+
+  for (i = 0; i < emulator->nports; i++)
+  {
+    close(emulator->ports[i].slave);
+    close(emulator->ports[i].master);
+  }
+  free(emulator->ports);
+  free(emulator);
+}
+
+
+static int open_port(EMULATED_PORT *port)
+{
+  int rc;
+  struct termios options;
+
+  if ((port->master = posix_openpt(O_RDWR | O_NOCTTY)) == -1)
+  {
+    rc = RET_EMULATOR_ERR_OPEN;
+    goto EXIT;
+  }
+
+  if ((grantpt(port->master) != 0) || (unlockpt(port->master) != 0) ||
+      (ptsname_r(port->master, port->path, sizeof(port->path)) != 0) ||
+      ((port->slave = open(port->path, O_RDWR | O_NOCTTY)) == -1))
+  {
+    close(port->master);
+    rc = RET_EMULATOR_ERR_OPEN;
+    goto EXIT;
+  }
+
+  /* no echo until the client has set up the port itself */
+  tcgetattr(port->slave, &options);
+  cfmakeraw(&options);
+  tcsetattr(port->slave, TCSANOW, &options);
+
+  rc = RET_EMULATOR_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static void *serve_ports(void *arg)
+{
+  EMULATOR *emulator;
+  struct pollfd *fds;
+  unsigned char buf[4096];
+  struct timespec timeout;
+  long long next;
+  long long left;
+  int n;
+  int i;
+  int k;
+
+  emulator = arg;
+  if ((fds = calloc(emulator->nports + 1, sizeof(struct pollfd))) == NULL)
+  {
+    return NULL;
+  }
+  for (i = 0; i < emulator->nports; i++)
+  {
+    fds[i].fd = emulator->ports[i].master;
+    fds[i].events = POLLIN;
+  }
+  fds[i].fd = emulator->wakeup[0];
+  fds[i].events = POLLIN;
+
+  /* wakes up for the next held answer */
+  next = 0;
+  for (;;)
+  {
+    if (next > 0)
+    {
+      left = next - get_time_us();
+      if (left < 0)
+      {
+        left = 0;
+      }
+      timeout.tv_sec = left / 1000000;
+      timeout.tv_nsec = (left % 1000000) * 1000;
+    }
+    if ((ppoll(fds, emulator->nports + 1, (next > 0) ? &timeout : NULL,
+               NULL) == -1) && (errno != EINTR))
+    {
+      break;
+    }
+    if (fds[emulator->nports].revents)
+    {
+      break;
+    }
+
+    for (i = 0; i < emulator->nports; i++)
+    {
+      if (!(fds[i].revents & POLLIN))
+      {
+        continue;
+      }
+      n = read(fds[i].fd, buf, sizeof(buf));
+      for (k = 0; k < n; k++)
+      {
+        emulator->ports[i].received++;
+        switch (decode_byte(&emulator->ports[i].decoder, buf[k]))
+        {
+        case WIRE_FRAME:
+          answer_command(emulator, &emulator->ports[i], 1);
+          break;
+
+        case WIRE_BADCRC:
+          answer_command(emulator, &emulator->ports[i], 0);
+          break;
+        }
+      }
+    }
+
+    next = emulator->wire_time ? write_due(emulator, get_time_us()) : 0;
+  }
+
+  free(fds);
+
+  return NULL;
+}
+
+
+static void answer_command(EMULATOR *emulator, EMULATED_PORT *port, int ok)
+{
+  static unsigned char version[] = { ACK, 0, 1, 0, 2, 0, 3 };
+  unsigned char answer;
+
+  port->commands++;
+  if (emulator->delay_us > 0)
+  {
+    sleep_us(emulator->delay_us);
+  }
+
+  if (!ok)
+  {
+    port->errors++;
+    answer = NAK;
+    send_answer(emulator, port, &answer, 1);
+    return;
+  }
+
+  answer = ACK;
+  switch (port->decoder.raw[2])
+  {
+  case 'v':
+    send_answer(emulator, port, version, sizeof(version));
+    return;
+
+  case 'X':
+    port->stored = 0;
+    return;
+
+  case 'G':
+    port->stored = 1;
+    break;
+
+  case 'I':
+    if (port->stored >= emulator->capacity)
+    {
+      answer = NAK;
+    }
+    else
+    {
+      port->stored++;
+    }
+    break;
+  }
+  send_answer(emulator, port, &answer, 1);
+}
+
+
+static void send_answer(EMULATOR *emulator, EMULATED_PORT *port,
+                        unsigned char *payload, int len)
+{
+  unsigned char bytes[3 + 8 + 2];
+  EMULATED_ANSWER *answer;
+  unsigned short crc16;
+  long long start;
+  int n;
+  int i;
+
+  n = 0;
+  bytes[n++] = STX;
+  bytes[n++] = 0;
+  bytes[n++] = len;
+  memcpy(bytes + n, payload, len);
+  n += len;
+
+  crc16 = INITIAL_VALUE;
+  for (i = 0; i < n; i++)
+  {
+    crc16 = calc_crc16(crc16, bytes[i]);
+  }
+  bytes[n++] = crc16 >> 8;
+  bytes[n++] = crc16 & 0xff;
+
+  if (!emulator->wire_time)
+  {
+    port->received = 0;
+    if (write(port->master, bytes, n) != n)
+    {
+      port->errors++;
+    }
+    return;
+  }
+
+  /* the frame and the answer are on the wire after the answers before */
+  start = get_time_us();
+  if (start < port->wire_free_us)
+  {
+    start = port->wire_free_us;
+  }
+  port->wire_free_us = start + wire_time_us(port->received + n);
+  port->received = 0;
+
+  /* a full ring gives up its oldest answer early */
+  if (port->nheld == MAX_HELD_ANSWERS)
+  {
+    write_held(port, port->held[port->first].due_us);
+  }
+  answer = &port->held[(port->first + port->nheld++) % MAX_HELD_ANSWERS];
+  memcpy(answer->bytes, bytes, n);
+  answer->len = n;
+  answer->due_us = port->wire_free_us;
+}
+
+
+/* writes the held answers that are due, returns when the next one is,
+   0 for none */
+static long long write_due(EMULATOR *emulator, long long now)
+{
+  long long next;
+  long long due;
+  int i;
+
+  next = 0;
+  for (i = 0; i < emulator->nports; i++)
+  {
+    due = write_held(&emulator->ports[i], now);
+    if ((due > 0) && ((next == 0) || (due < next)))
+    {
+      next = due;
+    }
+  }
+
+  return (next);
+}
+
+
+static long long write_held(EMULATED_PORT *port, long long now)
+{
+  EMULATED_ANSWER *answer;
+
+  while (port->nheld > 0)
+  {
+    answer = &port->held[port->first];
+    if (answer->due_us > now)
+    {
+      return (answer->due_us);
+    }
+    if (write(port->master, answer->bytes, answer->len) != answer->len)
+    {
+      port->errors++;
+    }
+    port->first = (port->first + 1) % MAX_HELD_ANSWERS;
+    port->nheld--;
+  }
+
+  return 0;
+}
+
+#endif /* LINUX */
+
+#if WIN
+
+int start_emulator(int nports, EMULATOR **emulator)
+{
+  return RET_EMULATOR_ERR_OPEN;
+}
+
+
+void stop_emulator(EMULATOR *emulator)
+{
+}
+
+#endif /* WIN */
@@ -0,0 +1,61 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#define RET_EMULATOR_OK       (0)
+#define RET_EMULATOR_ERR_OPEN (1)
+
+/* Emulated modules on pseudo terminals, served by one thread. A client
+   opens emulator->ports[i].path like a serial device. Every command is
+   answered like the module does, 'v' with version 1.2.3, 'X' not at all,
+   'I' with NAK once capacity patterns are stored and any frame with a
+   wrong checksum with NAK. Responses are not escaped. With wire_time
+   set, an answer is held back as long as the frame and the answer take
+   on the wire, one after the other on each port. */
+
+#define MAX_EMULATED_PORTS  (256)
+#define EMULATOR_CAPACITY   (64)
+#define MAX_HELD_ANSWERS    (32)
+
+typedef struct {
+  long long      due_us;      /* get_time_us() when it is written */
+  unsigned char  bytes[3 + 8 + 2];
+  int            len;
+} EMULATED_ANSWER;
+
+typedef struct {
+  int            master;
+  int            slave;       /* kept open, the master never sees a hangup */
+  char           path[64];
+  WIRE_DECODER   decoder;     /* frame received so far */
+  int            received;    /* bytes of it on the wire */
+  unsigned long  commands;    /* complete frames received */
+  unsigned long  errors;      /* frames with a wrong checksum */
+  int            stored;      /* patterns in the emulated flash */
+  EMULATED_ANSWER held[MAX_HELD_ANSWERS];  /* ring of answers not due */
+  int            first;
+  int            nheld;
+  long long      wire_free_us;  /* the wire is busy until then */
+} EMULATED_PORT;
+
+typedef struct {
+  EMULATED_PORT *ports;
+  int            nports;
+  int            capacity;    /* patterns the flash holds */
+  long long      delay_us;    /* processing time per command */
+  int            wire_time;   /* answer after the time at 38400 baud */
+  int            wakeup[2];   /* pipe to stop the thread */
+  pthread_t      thread;
+} EMULATOR;
+
+#if EMULATOR_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int start_emulator(int nports, EMULATOR **emulator);
+EXTERN void stop_emulator(EMULATOR *emulator);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef FONT_H
+#define FONT_H
+
+#define GLYPH_WIDTH (5)
+
+#if FONT_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN void get_glyph(char c, unsigned char *columns);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef FRAME64_H
+#define FRAME64_H
+
+/* A pattern as one 64 bit word: byte x is column x from the left as
+   read_pattern stores it, bit y of it is line y from the top, so pixel
+   (x, y) is bit 8 * x + y. On a little endian host the word has the same
+   bytes as the pattern, frame64_from_pattern and frame64_to_pattern
+   compile to a single load and store.
+
+   All kernels are branch-free and without loops, n is 0 to 7. */
+
+typedef unsigned long long FRAME64;
+
+#define FRAME64_LSB_OF_BYTES (0x0101010101010101ULL)
+
+
+static inline FRAME64 frame64_from_pattern(const unsigned char *pattern)
+{
+  return  (FRAME64) pattern[0]        | ((FRAME64) pattern[1] << 8)  |
+         ((FRAME64) pattern[2] << 16) | ((FRAME64) pattern[3] << 24) |
+         ((FRAME64) pattern[4] << 32) | ((FRAME64) pattern[5] << 40) |
+         ((FRAME64) pattern[6] << 48) | ((FRAME64) pattern[7] << 56);
+}
+
+
+static inline void frame64_to_pattern(FRAME64 f, unsigned char *pattern)
+{
+  pattern[0] = f;
+  pattern[1] = f >> 8;
+  pattern[2] = f >> 16;
+  pattern[3] = f >> 24;
+  pattern[4] = f >> 32;
+  pattern[5] = f >> 40;
+  pattern[6] = f >> 48;
+  pattern[7] = f >> 56;
+}
+
+
+static inline int frame64_get(FRAME64 f, int x, int y)
+{
+  return (f >> (8 * x + y)) & 1;
+}
+
+
+static inline FRAME64 frame64_set(FRAME64 f, int x, int y, int on)
+{
+  FRAME64 bit = 1ULL << (8 * x + y);
+
+  return (f & ~bit) | (bit & -(FRAME64) (on != 0));
+}
+
+
+/* the n columns on the left, the n lines at the top, n is 0 to 8 */
+static inline FRAME64 frame64_columns(int n)
+{
+  return (~0ULL >> ((64 - 8 * n) & 63)) & -(FRAME64) (n != 0);
+}
+
+
+static inline FRAME64 frame64_lines(int n)
+{
+  return FRAME64_LSB_OF_BYTES * ((1U << n) - 1);
+}
+
+
+/* shifts, the pixels that move out are lost, the new ones are off */
+static inline FRAME64 frame64_shift_left(FRAME64 f, int n)
+{
+  return f >> (8 * n);
+}
+
+
+static inline FRAME64 frame64_shift_right(FRAME64 f, int n)
+{
+  return f << (8 * n);
+}
+
+
+static inline FRAME64 frame64_shift_up(FRAME64 f, int n)
+{
+  return (f >> n) & frame64_lines(8 - n);
+}
+
+
+static inline FRAME64 frame64_shift_down(FRAME64 f, int n)
+{
+  return (f << n) & ~frame64_lines(n);
+}
+
+
+/* rotations, the pixels that move out come in on the other side */
+static inline FRAME64 frame64_rotate_left(FRAME64 f, int n)
+{
+  return (f >> (8 * n)) | (f << ((64 - 8 * n) & 63));
+}
+
+
+static inline FRAME64 frame64_rotate_right(FRAME64 f, int n)
+{
+  return (f << (8 * n)) | (f >> ((64 - 8 * n) & 63));
+}
+
+
+static inline FRAME64 frame64_rotate_up(FRAME64 f, int n)
+{
+  return ((f >> n) & frame64_lines(8 - n)) |
+         ((f << ((8 - n) & 7)) & ~frame64_lines(8 - n));
+}
+
+
+static inline FRAME64 frame64_rotate_down(FRAME64 f, int n)
+{
+  return frame64_rotate_up(f, (8 - n) & 7);
+}
+
+
+/* left and right swapped: the bytes in reverse order */
+static inline FRAME64 frame64_mirror(FRAME64 f)
+{
+  f = ((f >> 8) & 0x00ff00ff00ff00ffULL) | ((f & 0x00ff00ff00ff00ffULL) << 8);
+  f = ((f >> 16) & 0x0000ffff0000ffffULL) |
+      ((f & 0x0000ffff0000ffffULL) << 16);
+  return (f >> 32) | (f << 32);
+}
+
+
+/* top and bottom swapped: the bits of each byte in reverse order */
+static inline FRAME64 frame64_flip(FRAME64 f)
+{
+  f = ((f >> 1) & 0x5555555555555555ULL) | ((f & 0x5555555555555555ULL) << 1);
+  f = ((f >> 2) & 0x3333333333333333ULL) | ((f & 0x3333333333333333ULL) << 2);
+  return ((f >> 4) & 0x0f0f0f0f0f0f0f0fULL) |
+         ((f & 0x0f0f0f0f0f0f0f0fULL) << 4);
+}
+
+
+static inline FRAME64 frame64_invert(FRAME64 f)
+{
+  return ~f;
+}
+
+
+/* pixel (x, y) to (y, x), three delta swaps */
+static inline FRAME64 frame64_transpose(FRAME64 f)
+{
+  FRAME64 t;
+
+  t = 0x0f0f0f0f00000000ULL & (f ^ (f << 28));
+  f ^= t ^ (t >> 28);
+  t = 0x3333000033330000ULL & (f ^ (f << 14));
+  f ^= t ^ (t >> 14);
+  t = 0x5500550055005500ULL & (f ^ (f << 7));
+  return f ^ t ^ (t >> 7);
+}
+
+
+static inline FRAME64 frame64_rotate_cw(FRAME64 f)
+{
+  return frame64_mirror(frame64_transpose(f));
+}
+
+
+static inline FRAME64 frame64_rotate_ccw(FRAME64 f)
+{
+  return frame64_flip(frame64_transpose(f));
+}
+
+
+/* compositing */
+static inline FRAME64 frame64_or(FRAME64 a, FRAME64 b)
+{
+  return a | b;
+}
+
+
+static inline FRAME64 frame64_xor(FRAME64 a, FRAME64 b)
+{
+  return a ^ b;
+}
+
+
+/* a where mask is off, b where it is on */
+static inline FRAME64 frame64_select(FRAME64 a, FRAME64 b, FRAME64 mask)
+{
+  return a ^ ((a ^ b) & mask);
+}
+
+
+/* the number of pixels that are on */
+static inline int frame64_popcount(FRAME64 f)
+{
+  f = f - ((f >> 1) & 0x5555555555555555ULL);
+  f = (f & 0x3333333333333333ULL) + ((f >> 2) & 0x3333333333333333ULL);
+  f = (f + (f >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (f * FRAME64_LSB_OF_BYTES) >> 56;
+}
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <wire.h>
+#include <pnm.h>
+#include <pipeline.h>
+
+#define GREY_SRC 1
+#include <grey.h>
+#undef GREY_SRC
+
+/* "mmm8x8 <device> greyscale <pgmfile> <seconds>" shows a greyscale image
+   on the 1 bit module by cycling through nplanes patterns, as fast as the
+   link takes display commands. A pixel of level q (0 to nplanes) is on in
+   q patterns of each cycle, so a cycle has nplanes + 1 levels and is
+   repeated at the frame rate divided by nplanes.
+
+   The patterns are computed once before the first one is sent: each
+   pixel carries the rest of its level from one pattern to the next
+   (error diffusion over time) and starts at a phase of its own, so the
+   pixels of an even area do not all switch in the same pattern. */
+
+#define GREY_RSP_LEN (6)
+
+static const unsigned char bayer[LINES_PER_PATTERN][COLUMNS_PER_PATTERN] =
+{
+  {  0, 32,  8, 40,  2, 34, 10, 42 },
+  { 48, 16, 56, 24, 50, 18, 58, 26 },
+  { 12, 44,  4, 36, 14, 46,  6, 38 },
+  { 60, 28, 52, 20, 62, 30, 54, 22 },
+  {  3, 35, 11, 43,  1, 33,  9, 41 },
+  { 51, 19, 59, 27, 49, 17, 57, 25 },
+  { 15, 47,  7, 39, 13, 45,  5, 37 },
+  { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+static void make_planes(unsigned char *grey, int nplanes,
+                        unsigned char (*planes)[LINES_PER_PATTERN]);
+
+
+int display_greyscale(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  unsigned char grey[PIXELS_PER_PATTERN];
+  unsigned char planes[MAX_GREY_LEVELS - 1][LINES_PER_PATTERN];
+  unsigned char frames[MAX_GREY_LEVELS - 1][MAX_FRAME_LEN];
+  int framelen[MAX_GREY_LEVELS - 1];
+  unsigned char pattern[LINES_PER_PATTERN];
+  FILE *handle;
+  PIPELINE pl;
+  long long start;
+  long long end;
+  long long due;
+  long long period;
+  long cyclebytes;
+  long sent;
+  int rsplen;
+  int linkfps;
+  int fps;
+  int nplanes;
+  int i;
+
+  if ((rc = open_pnm(myargv[0], &handle)) != RET_PNM_OK)
+  {
+    fprintf(stderr, "open of image %s has failed\n", myargv[0]);
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
+  }
+  rc = read_pnm(handle, cmd_options.crop ? PNM_CROP : PNM_SCALE, grey);
+  close_pnm(handle);
+  if (rc != RET_PNM_OK)
+  {
+    fprintf(stderr, "read of image %s has failed\n", myargv[0]);
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
+  }
+
+  if ((rc = open_pipeline(hdl, &pl)) != RET_COMMAND_OK)
+  {
+    goto EXIT;
+  }
+
+  /* the rate of display frames without escaped bytes, --fps lower, the
+     acknowledges of a pipeline do not take time of the frames */
+  rsplen = pl.async ? 0 : GREY_RSP_LEN;
+  memset(pattern, 0, sizeof(pattern));
+  linkfps = max_frame_rate(encode_command('D', LINES_PER_PATTERN, pattern,
+                                          frames[0]), rsplen);
+  fps = linkfps;
+  period = 0;
+  if (cmd_options.fps > 0)
+  {
+    fps = admit_frame_rate(cmd_options.fps,
+                           encode_command('D', LINES_PER_PATTERN, pattern,
+                                          frames[0]), rsplen);
+    period = 1000000 / fps;
+  }
+  printf("%d frames/s at %d baud, levels at refresh:", linkfps, BAUDRATE);
+  for (nplanes = 1; nplanes < MAX_GREY_LEVELS; nplanes *= 2)
+  {
+    printf("%s %d at %d Hz", (nplanes == 1) ? "" : ",", nplanes + 1,
+           linkfps / nplanes);
+  }
+  printf("\n");
+
+  /* --levels, as many as the frame rate keeps above MIN_REFRESH_HZ */
+  if (cmd_options.levels > 0)
+  {
+    nplanes = cmd_options.levels - 1;
+    if (fps / nplanes < MIN_REFRESH_HZ)
+    {
+      fprintf(stderr, "%d levels are refreshed at %d Hz and may "
+                      "flicker.\n", cmd_options.levels, fps / nplanes);
+    }
+  }
+  else
+  {
+    nplanes = fps / MIN_REFRESH_HZ;
+    if (nplanes < 1)
+    {
+      nplanes = 1;
+    }
+    if (nplanes > MAX_GREY_LEVELS - 1)
+    {
+      nplanes = MAX_GREY_LEVELS - 1;
+    }
+  }
+
+  make_planes(grey, nplanes, planes);
+  cyclebytes = 0;
+  for (i = 0; i < nplanes; i++)
+  {
+    framelen[i] = encode_command('D', LINES_PER_PATTERN, planes[i],
+                                 frames[i]);
+    cyclebytes += framelen[i] + rsplen;
+  }
+
+  /* escaped bytes of this image make some frames longer */
+  printf("%d levels, %d patterns of %ld bytes per cycle, %lld Hz "
+         "refresh\n", nplanes + 1, nplanes, cyclebytes,
+         (period > 0) ? 1000000LL / (period * nplanes) :
+                        1000000LL / wire_time_us(cyclebytes));
+
+  sent = 0;
+  start = play_time_us();
+  end = start + atoi(myargv[1]) * 1000000LL;
+  due = start;
+  for (i = 0; play_time_us() < end; i = (i + 1) % nplanes)
+  {
+    play_wait_until(due);
+    due += period;
+
+    rc = send_display_frame(&pl, frames[i], framelen[i]);
+    if (rc != RET_COMMAND_OK)
+    {
+      fprintf(stderr, "sending command greyscale has failed.\n");
+      goto CLOSE_EXIT;
+    }
+    sent++;
+  }
+
+  /* the image stays as a two level pattern */
+  threshold_pnm(grey, (cmd_options.cutoff > 0) ? cmd_options.cutoff :
+                                                 DEFAULT_CUTOFF, pattern);
+  if ((rc = send_display(&pl, pattern)) != RET_COMMAND_OK)
+  {
+    fprintf(stderr, "sending command greyscale has failed.\n");
+    goto CLOSE_EXIT;
+  }
+
+  end = play_time_us() - start;
+  printf("%ld patterns in %lld ms, %lld frames/s, %lld Hz refresh\n",
+         sent, end / 1000, (end > 0) ? sent * 1000000LL / end : 0,
+         (end > 0) ? sent * 1000000LL / end / nplanes : 0);
+  rc = RET_COMMAND_OK;
+
+CLOSE_EXIT:
+  close_pipeline(&pl);
+
+EXIT:
+  return rc;
+}
+
+
+static void make_planes(unsigned char *grey, int nplanes,
+                        unsigned char (*planes)[LINES_PER_PATTERN])
+{
+  int level;
+  int rest;
+  int x;
+  int y;
+  int i;
+
+  memset(planes, 0, nplanes * LINES_PER_PATTERN);
+  for (x = 0; x < COLUMNS_PER_PATTERN; x++)
+  {
+    for (y = 0; y < LINES_PER_PATTERN; y++)
+    {
+      level = (grey[LINES_PER_PATTERN * x + y] * nplanes + 127) / 255;
+      rest = bayer[y][x] * nplanes / 64;
+
+      /* over nplanes patterns rest passes nplanes exactly level times */
+      for (i = 0; i < nplanes; i++)
+      {
+        rest += level;
+        if (rest >= nplanes)
+        {
+          rest -= nplanes;
+          planes[i][x] |= 1 << y;
+        }
+      }
+    }
+  }
+}
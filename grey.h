@@ -0,0 +1,17 @@
+#ifndef GREY_H
+#define GREY_H
+
+#define MAX_GREY_LEVELS (33)      /* 32 patterns per cycle */
+#define MIN_REFRESH_HZ  (25)      /* slower cycles are seen to flicker */
+
+#if GREY_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int display_greyscale(SERHDL hdl, int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -1,10 +1,29 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <serial.h>
-#include <command.h>
 #include <pattern.h>
+#include <sequence.h>
+#include <command.h>
 #include <crc16.h>
+#include <stream.h>
+#include <shmfb.h>
+#include <canvas.h>
+#include <deploy.h>
+#include <wire.h>
+#include <trace.h>
+#include <tracedec.h>
+#include <replay.h>
+#include <discover.h>
+#include <portlock.h>
+#include <anim.h>
+#include <pack.h>
+#include <effect.h>
+#include <grey.h>
+#include <pnm.h>
+#include <watch.h>
+#include <capacity.h>
 
 /* local constants */
 #define RET_OK                      (0)
@@ -19,6 +38,21 @@
 #define RET_ERR_SET_TEXTMODE        (9)
 #define RET_ERR_SET_PATTERNMODE     (10)
 #define RET_ERR_EXE_FACTORYRESET    (11)
+#define RET_ERR_PLAY_PATTERN        (12)
+#define RET_ERR_STREAM_PATTERNS     (13)
+#define RET_ERR_SERVE_FRAMEBUFFER   (14)
+#define RET_ERR_DRAW_CANVAS         (15)
+#define RET_ERR_DEPLOY_PATTERNS     (16)
+#define RET_ERR_DECODE_TRACE        (17)
+#define RET_ERR_REPLAY_TRACE        (18)
+#define RET_ERR_DISCOVER_DEVICES    (19)
+#define RET_ERR_PRINT_LOCKSTAT      (20)
+#define RET_ERR_DEVICE_BUSY         (21)
+#define RET_ERR_COMPILE_ANIMATION   (22)
+#define RET_ERR_BUILD_PACK          (23)
+#define RET_ERR_DISPLAY_GREYSCALE   (24)
+#define RET_ERR_WATCH_PATTERNS      (25)
+#define RET_ERR_PRINT_CAPACITY      (26)
 
 #define CMD_NOMATCH (0)
 
@@ -32,8 +66,20 @@ typedef struct {
   int     cmd_rc;         /* process failed exit code for this command */
 } CMD;
 
+/* commands without a serial device, they open what they need themselves */
+typedef int (*TOOL_FCT)(int myargc, char **myargv);
+
+typedef struct {
+  char    *tool_name;     /* name as typed on the command line */
+  int      tool_nargs;    /* no of arguments this command needs */
+  TOOL_FCT tool_fct;      /* pointer to command function */
+  int      tool_rc;       /* process failed exit code for this command */
+} TOOL;
+
 
 static int find_command(int nargs, char *command);
+static int find_tool(int nargs, char *tool);
+static int parse_options(int argc, char **argv);
 static void print_usage(void);
 
 
@@ -48,19 +94,77 @@ static CMD cmd_table[] =
   { "settextspeed",    1,   set_textspeed,       RET_ERR_SET_TEXTSPEED },
   { "displaypattern",  1,   display_pattern,     RET_ERR_DISPLAY_PATTERN },
   { "storepattern",    1,   store_pattern,       RET_ERR_STORE_PATTERN },
+  { "storepattern",    2,   store_pattern,       RET_ERR_STORE_PATTERN },
+  { "play",            1,   play_pattern,        RET_ERR_PLAY_PATTERN },
+  { "play",            2,   play_pattern,        RET_ERR_PLAY_PATTERN },
+  { "stream",          1,   stream_patterns,     RET_ERR_STREAM_PATTERNS },
+  { "greyscale",       2,   display_greyscale,   RET_ERR_DISPLAY_GREYSCALE },
+  { "framebuffer",     0,   serve_framebuffer,   RET_ERR_SERVE_FRAMEBUFFER },
+  { "watch",           1,   watch_patterns,      RET_ERR_WATCH_PATTERNS },
+  { "capacity",        0,   print_capacity,      RET_ERR_PRINT_CAPACITY },
   { "setnormalmode",   0,   set_normalmode,      RET_ERR_SET_NORMALMODE },
   { "settextmode",     0,   set_textmode,        RET_ERR_SET_TEXTMODE },
   { "setpatternmode",  0,   set_patternmode,     RET_ERR_SET_PATTERNMODE },
   { "factoryreset",    0,   exe_factoryreset,    RET_ERR_EXE_FACTORYRESET },
 };
 
+static TOOL tool_table[] =
+{
+/*  tool_name,         nargs, tool fct,          rc */
+  { "",                0,   NULL,                RET_ERR_USAGE },/* no match */
+  { "canvas",          3,   draw_canvas,         RET_ERR_DRAW_CANVAS },
+  { "deploy",          1,   deploy_patterns,     RET_ERR_DEPLOY_PATTERNS },
+  { "decode-trace",    1,   decode_trace,        RET_ERR_DECODE_TRACE },
+  { "replay",          1,   replay_trace,        RET_ERR_REPLAY_TRACE },
+  { "discover",        0,   discover_devices,    RET_ERR_DISCOVER_DEVICES },
+  { "discover",        1,   discover_devices,    RET_ERR_DISCOVER_DEVICES },
+  { "lockstat",        1,   print_lockstat,      RET_ERR_PRINT_LOCKSTAT },
+  { "compile",         2,   compile_animation,   RET_ERR_COMPILE_ANIMATION },
+  { "pack",            2,   build_pack,          RET_ERR_BUILD_PACK },
+};
+
 
 /* code section */
 int main(int argc, char **argv)
 {
   int rc;
   int cmd;
-  SERHDL hdl;
+  int nopts;
+  SERHDL hdl = 0;
+  PORTLOCK lock = { -1 };
+
+  /* skip the options, the rest is used as before */
+  if ((nopts = parse_options(argc, argv)) < 0)
+  {
+    print_usage();
+    rc = RET_ERR_USAGE; 
+    goto EXIT;
+  }
+  argc -= nopts;
+  argv += nopts;
+
+  if ((cmd_options.trace != NULL) &&
+      (start_trace(cmd_options.trace) != RET_TRACE_OK))
+  {
+    fprintf(stderr, "open of trace file %s has failed.\n", cmd_options.trace);
+    rc = RET_ERR_USAGE;
+    goto EXIT;
+  }
+
+  /* commands without a serial device */
+  if ((argc >= 2) && ((cmd = find_tool(argc - 2, argv[1])) != CMD_NOMATCH))
+  {
+    rc = tool_table[cmd].tool_fct(argc - 2, &argv[2]);
+    if (rc != RET_OK)
+    {
+      rc = tool_table[cmd].tool_rc;
+    }
+    if (cmd_options.dryrun)
+    {
+      print_wire_budget();
+    }
+    goto EXIT;
+  }
 
   if (argc < 3)
   {
@@ -77,11 +181,27 @@ int main(int argc, char **argv)
     goto EXIT;
   }
 
-  if ((rc = open_serial(argv[1], &hdl)) != RET_SERIAL_OK)
+  /* a dry run does not need the device */
+  if (!cmd_options.dryrun && (check_discovered(argv[1]) != RET_DISCOVER_OK))
+  {
+    rc = cmd_table[cmd].cmd_rc;
+    goto EXIT;
+  }
+  /* waits behind other invocations that use the device */
+  if (!cmd_options.dryrun &&
+      (lock_port(argv[1], cmd_options.wait, &lock) != RET_PORTLOCK_OK))
+  {
+    fprintf(stderr, "device %s is busy.\n", argv[1]);
+    rc = RET_ERR_DEVICE_BUSY;
+    goto EXIT;
+  }
+  if (!cmd_options.dryrun &&
+      ((rc = open_serial(argv[1], &hdl)) != RET_SERIAL_OK))
   {
     fprintf(stderr, "open of device %s has failed.\n", argv[1]);
     goto EXIT;
   }
+  cmd_options.device = argv[1];
  
   rc = cmd_table[cmd].cmd_fct(hdl, argc - 3, &argv[3]);
   if (rc != RET_OK)
@@ -89,47 +209,271 @@ int main(int argc, char **argv)
     rc = cmd_table[cmd].cmd_rc;
   }
 
+  if (cmd_options.dryrun)
+  {
+    print_wire_budget();
+    goto EXIT;
+  }
+
   close_serial(hdl);
 
 EXIT:
+  unlock_port(&lock);
+
+  /* the command has done its work even if the trace is incomplete */
+  if (stop_trace() != RET_TRACE_OK)
+  {
+    fprintf(stderr, "write of trace file %s has failed.\n", cmd_options.trace);
+  }
+
   return rc;
 }
 
 
+/* a command may have one entry per number of arguments */
 static int find_command(int nargs, char *command)
 {
   int i;
 
   for (i = 0; i < (sizeof(cmd_table) / sizeof(CMD)); i++)
   {
-    if (strcmp(cmd_table[i].cmd_name, command) == 0)
+    if ((strcmp(cmd_table[i].cmd_name, command) == 0) &&
+        (cmd_table[i].cmd_nargs == nargs))
+    {
+      return (i);
+    }
+  }
+
+  return (CMD_NOMATCH);
+}
+
+
+/* like find_command, CMD_NOMATCH also if the name is no tool at all,
+   a tool may have one entry per number of arguments */
+static int find_tool(int nargs, char *tool)
+{
+  int i;
+
+  for (i = 1; i < (sizeof(tool_table) / sizeof(TOOL)); i++)
+  {
+    if ((strcmp(tool_table[i].tool_name, tool) == 0) &&
+        (tool_table[i].tool_nargs == nargs))
+    {
+      return (i);
+    }
+  }
+
+  return (CMD_NOMATCH);
+}
+
+
+/* parses the options in front of the serial device into cmd_options,
+   returns the number of options or -1 for an unknown option */
+static int parse_options(int argc, char **argv)
+{
+  int i;
+
+  for (i = 1; (i < argc) && (strncmp(argv[i], "--", 2) == 0); i++)
+  {
+    if (strcmp(argv[i], "--force") == 0)
+    {
+      cmd_options.force = 1;
+    }
+    else if (strcmp(argv[i], "--quiet") == 0)
+    {
+      cmd_options.quiet = 1;
+    }
+    else if (strcmp(argv[i], "--dry-run") == 0)
+    {
+      cmd_options.dryrun = 1;
+    }
+    else if ((strcmp(argv[i], "--fps") == 0) && (i + 1 < argc))
+    {
+      i++;
+      if ((cmd_options.fps = atoi(argv[i])) <= 0)
+      {
+        return (-1);
+      }
+    }
+    else if ((strcmp(argv[i], "--trace") == 0) && (i + 1 < argc))
+    {
+      cmd_options.trace = argv[++i];
+    }
+    else if (strcmp(argv[i], "--fast") == 0)
+    {
+      cmd_options.fast = 1;
+    }
+    else if (strcmp(argv[i], "--downsample") == 0)
+    {
+      cmd_options.downsample = 1;
+    }
+    else if (strcmp(argv[i], "--pipeline") == 0)
+    {
+      cmd_options.pipeline = 1;
+    }
+    else if (strcmp(argv[i], "--crop") == 0)
+    {
+      cmd_options.crop = 1;
+    }
+    else if ((strcmp(argv[i], "--cutoff") == 0) && (i + 1 < argc))
+    {
+      i++;
+      cmd_options.cutoff = atoi(argv[i]);
+      if ((cmd_options.cutoff < 1) || (cmd_options.cutoff > 255))
+      {
+        return (-1);
+      }
+    }
+    else if ((strcmp(argv[i], "--threshold") == 0) && (i + 1 < argc))
+    {
+      i++;
+      if ((cmd_options.threshold = atoi(argv[i])) <= 0)
+      {
+        return (-1);
+      }
+    }
+    else if ((strcmp(argv[i], "--effect") == 0) && (i + 1 < argc))
+    {
+      cmd_options.effect = argv[++i];
+      if (find_effect(cmd_options.effect) < 0)
+      {
+        return (-1);
+      }
+    }
+    else if ((strcmp(argv[i], "--steps") == 0) && (i + 1 < argc))
+    {
+      i++;
+      if ((cmd_options.steps = atoi(argv[i])) <= 0)
+      {
+        return (-1);
+      }
+    }
+    else if ((strcmp(argv[i], "--levels") == 0) && (i + 1 < argc))
+    {
+      i++;
+      cmd_options.levels = atoi(argv[i]);
+      if ((cmd_options.levels < 2) || (cmd_options.levels > MAX_GREY_LEVELS))
+      {
+        return (-1);
+      }
+    }
+    else if ((strcmp(argv[i], "--wait") == 0) && (i + 1 < argc))
     {
-      if (cmd_table[i].cmd_nargs == nargs)
+      i++;
+      if ((cmd_options.wait = atoi(argv[i])) <= 0)
       {
-        return (i);
+        return (-1);
       }
-      else
+    }
+    else if ((strcmp(argv[i], "--jobs") == 0) && (i + 1 < argc))
+    {
+      i++;
+      if ((cmd_options.jobs = atoi(argv[i])) <= 0)
       {
-        return (CMD_NOMATCH);
+        return (-1);
       }
     }
+    else
+    {
+      return (-1);
+    }
   }
 
-  return (CMD_NOMATCH);
+  return (i - 1);
 }
 
 
 static void print_usage(void)
 {
-  fprintf(stderr, "Usage: mmm8x8 <serial device> firmwareversion\n");
+  fprintf(stderr, "Usage: mmm8x8 [options] <serial device> firmwareversion\n");
   fprintf(stderr, "       mmm8x8 <serial device> displaytext <text>\n");
   fprintf(stderr, "       mmm8x8 <serial device> storetext <text>\n");
   fprintf(stderr, "       mmm8x8 <serial device> settextspeed "
                   "<speed: 0-255>\n");
   fprintf(stderr, "       mmm8x8 <serial device> displaypattern <inputfile>\n");
-  fprintf(stderr, "       mmm8x8 <serial device> storepattern <inputfile>\n");
+  fprintf(stderr, "       mmm8x8 <serial device> storepattern "
+                  "<inputfile|compiledfile>\n");
+  fprintf(stderr, "       mmm8x8 <serial device> storepattern "
+                  "<inputfile> <inputfile>\n");
+  fprintf(stderr, "       mmm8x8 <serial device> play <inputfile> "
+                  "[<inputfile>]\n");
+  fprintf(stderr, "       mmm8x8 <serial device> stream <raw|text|pnm>\n");
+  fprintf(stderr, "       mmm8x8 <serial device> greyscale <pgmfile> "
+                  "<seconds>\n");
+  fprintf(stderr, "       mmm8x8 <serial device> framebuffer\n");
+  fprintf(stderr, "       mmm8x8 <serial device> watch <file|directory>\n");
+  fprintf(stderr, "       mmm8x8 <serial device> capacity\n");
   fprintf(stderr, "       mmm8x8 <serial device> setnormalmode\n");
   fprintf(stderr, "       mmm8x8 <serial device> settextmode\n");
   fprintf(stderr, "       mmm8x8 <serial device> setpatternmode\n");
   fprintf(stderr, "       mmm8x8 <serial device> factoryreset\n");
+  fprintf(stderr, "       mmm8x8 canvas <layoutfile> bitmap <inputfile>\n");
+  fprintf(stderr, "       mmm8x8 canvas <layoutfile> text <text>\n");
+  fprintf(stderr, "       mmm8x8 deploy <manifestfile>\n");
+  fprintf(stderr, "       mmm8x8 decode-trace <tracefile>\n");
+  fprintf(stderr, "       mmm8x8 replay <tracefile>\n");
+  fprintf(stderr, "       mmm8x8 discover [<port pattern>]\n");
+  fprintf(stderr, "       mmm8x8 lockstat <serial device>\n");
+  fprintf(stderr, "       mmm8x8 compile <inputfile> <compiledfile>\n");
+  fprintf(stderr, "       mmm8x8 pack <directory> <packfile>\n");
+  fprintf(stderr, "       an <inputfile> may also be <packfile>:<name> or "
+                  "PBM/PGM images\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --force  storetext and storepattern write the device "
+                  "even if it\n"
+                  "           already holds the same content, commands use "
+                  "a device that\n"
+                  "           has not answered at the last discover, "
+                  "capacity probes again\n");
+  fprintf(stderr, "  --downsample  a store that does not fit into the "
+                  "device is reduced\n"
+                  "           to fit by merging patterns instead of being "
+                  "rejected\n");
+  fprintf(stderr, "  --pipeline  play, stream, framebuffer and greyscale "
+                  "send the next\n"
+                  "           pattern before the last one is acknowledged, "
+                  "waiting for\n"
+                  "           each one again when too many are lost "
+                  "(Linux only)\n");
+  fprintf(stderr, "  --dry-run  do not open the device, print the bytes and "
+                  "the time the\n"
+                  "           command would take on the wire\n");
+  fprintf(stderr, "  --fps <n>  play n patterns per second instead of their "
+                  "durations,\n"
+                  "           stream at most n patterns per second,\n"
+                  "           scroll canvas text by n columns per second\n");
+  fprintf(stderr, "  --effect <name>  transition of play and storepattern "
+                  "with two\n"
+                  "           inputfiles (default " DEFAULT_EFFECT "): ");
+  print_effects(stderr);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "  --steps <n>  patterns of the transition (default %d)\n",
+          DEFAULT_EFFECT_STEPS);
+  fprintf(stderr, "  --cutoff <n>  grey level 1 to 255 from which a pixel "
+                  "of a PBM/PGM\n"
+                  "           image is on (default %d)\n", DEFAULT_CUTOFF);
+  fprintf(stderr, "  --crop  take the 8x8 pixels in the middle of a larger "
+                  "image instead\n"
+                  "           of scaling it\n");
+  fprintf(stderr, "  --levels <n>  greyscale levels, 2 to %d (default as "
+                  "many as the\n"
+                  "           link refreshes at %d Hz or more)\n",
+          MAX_GREY_LEVELS, MIN_REFRESH_HZ);
+  fprintf(stderr, "  --jobs <n>  deploy with n threads, each writes to at "
+                  "most 8 devices\n"
+                  "           at the same time (default 8)\n");
+  fprintf(stderr, "  --wait <n>  wait at most n seconds for a device that "
+                  "is used by\n"
+                  "           another invocation (default 60)\n");
+  fprintf(stderr, "  --trace <file>  record the bytes written to and read "
+                  "from the devices\n"
+                  "           with their times in file\n");
+  fprintf(stderr, "  --fast  replay the commands as fast as possible, not at "
+                  "their times\n");
+  fprintf(stderr, "  --threshold <n>  replay fails if it is more than n "
+                  "percent slower\n"
+                  "           than the trace (default 20)\n");
+  fprintf(stderr, "  --quiet  do not print the responses, decode-trace prints "
+                  "only the\n"
+                  "           latencies per device and command\n");
 }
@@ -0,0 +1,287 @@
+/*
+ * USB to MMM8x8 bridge
+ * based on https://github.com/oism/mmm8x8
+ * download at https://github.com/dr-boehmerie/mmm8x8
+ */
+
+/*
+ * !! Beware the fact that MMM 8x8 uses 3.3V for supply and communication lines,
+ * so use a regulator and an appropriate voltage divider in the Arduino TX line !!
+ */
+
+/*
+ * The PC sends frames over the USB serial port, the bridge buffers them
+ * in a ring and passes them on to the MMM8x8 as fast as the 38400 baud
+ * link allows. Frames equal to the one currently shown are skipped.
+ * When the ring is full, the oldest frame is dropped.
+ *
+ * Host -> bridge, every packet is
+ *   0xA5, type, payload, checksum (xor of type and payload)
+ *   type 'F': payload is 8 bytes, one byte per column (displayPattern layout)
+ *   type 'S': no payload, requests a status packet
+ *   type 'C': no payload, clears the ring and the counters
+ *
+ * Bridge -> host, status packet
+ *   0x5A, 'S', queued, free, dropped (2), shown (2), skipped (2),
+ *   errors (2), checksum (xor of 'S' up to errors), 16 bit values are MSB first
+ *   Sent on request, after a clear and every STATUS_INTERVAL ms.
+ *
+ * Boards with a hardware UART (Uno, Mega) may lose host bytes while
+ * SoftwareSerial transmits with interrupts disabled, those show up as
+ * errors. The host should not send more frames than 'free' reports.
+ * Boards with native USB (Leonardo, Micro) are flow controlled by USB.
+ */
+
+#include "mmm8x8.h"
+
+// Use Hardware UART or CDC to communicate with the PC
+// Use Software Serial to communicate with MMM 8x8
+/*
+  Not all pins on the Mega and Mega 2560 support change interrupts,
+  so only the following can be used for RX:
+  10, 11, 12, 13, 50, 51, 52, 53, 62, 63, 64, 65, 66, 67, 68, 69
+
+  Not all pins on the Leonardo and Micro support change interrupts,
+  so only the following can be used for RX:
+  8, 9, 10, 11, 14 (MISO), 15 (SCK), 16 (MOSI).
+*/
+
+mmm8x8 elv(10, 11); // RX, TX
+
+// host protocol
+#define HOST_BAUD        115200
+#define HOST_SYNC        0xA5
+#define BRIDGE_SYNC      0x5A
+#define TYPE_FRAME       'F'
+#define TYPE_STATUS      'S'
+#define TYPE_CLEAR       'C'
+#define FRAME_LEN        8
+#define STATUS_INTERVAL  100
+
+// ring of frames, must be a power of 2
+#define RING_FRAMES      16
+
+uint8_t ring[RING_FRAMES][FRAME_LEN];
+uint8_t ring_head;      // next slot to write
+uint8_t ring_count;     // frames queued
+
+uint8_t shown[FRAME_LEN];
+bool shown_valid;
+
+// counters reported to the host
+uint16_t cnt_dropped;
+uint16_t cnt_shown;
+uint16_t cnt_skipped;
+uint16_t cnt_errors;
+
+// receive state machine
+enum RX_STATE
+{
+  RX_SYNC,
+  RX_TYPE,
+  RX_PAYLOAD,
+  RX_CHECKSUM
+};
+enum RX_STATE rx_state;
+uint8_t rx_type;
+uint8_t rx_buf[FRAME_LEN];
+uint8_t rx_len;
+uint8_t rx_xor;
+
+unsigned long last_status;
+
+
+void put_frame(const uint8_t *frame)
+{
+  if (ring_count == RING_FRAMES)
+  {
+    // ring is full, drop the oldest frame
+    ring_count--;
+    cnt_dropped++;
+  }
+  memcpy(ring[ring_head], frame, FRAME_LEN);
+  ring_head = (ring_head + 1) & (RING_FRAMES - 1);
+  ring_count++;
+}
+
+uint8_t *get_frame(void)
+{
+  uint8_t tail;
+
+  if (ring_count == 0)
+  {
+    return NULL;
+  }
+  tail = (ring_head - ring_count) & (RING_FRAMES - 1);
+  ring_count--;
+  return ring[tail];
+}
+
+void send_status(void)
+{
+  uint8_t pkt[2 + 2 + 4 * 2 + 1];
+  uint8_t n = 0;
+  uint8_t x = 0;
+
+  pkt[n++] = BRIDGE_SYNC;
+  pkt[n++] = TYPE_STATUS;
+  pkt[n++] = ring_count;
+  pkt[n++] = RING_FRAMES - ring_count;
+  pkt[n++] = cnt_dropped >> 8;
+  pkt[n++] = cnt_dropped & 0xff;
+  pkt[n++] = cnt_shown >> 8;
+  pkt[n++] = cnt_shown & 0xff;
+  pkt[n++] = cnt_skipped >> 8;
+  pkt[n++] = cnt_skipped & 0xff;
+  pkt[n++] = cnt_errors >> 8;
+  pkt[n++] = cnt_errors & 0xff;
+  for (uint8_t i = 1; i < n; i++)
+  {
+    x ^= pkt[i];
+  }
+  pkt[n++] = x;
+
+  Serial.write(pkt, n);
+  last_status = millis();
+}
+
+void clear_all(void)
+{
+  ring_head = 0;
+  ring_count = 0;
+  shown_valid = false;
+  cnt_dropped = 0;
+  cnt_shown = 0;
+  cnt_skipped = 0;
+  cnt_errors = 0;
+}
+
+void handle_packet(void)
+{
+  switch (rx_type)
+  {
+  case TYPE_FRAME:
+    put_frame(rx_buf);
+    break;
+
+  case TYPE_STATUS:
+    send_status();
+    break;
+
+  case TYPE_CLEAR:
+    clear_all();
+    send_status();
+    break;
+  }
+}
+
+// parses everything the host has sent so far, never blocks
+void receive_host(void)
+{
+  uint8_t c;
+
+  while (Serial.available() > 0)
+  {
+    c = Serial.read();
+
+    switch (rx_state)
+    {
+    case RX_SYNC:
+      if (c == HOST_SYNC)
+      {
+        rx_state = RX_TYPE;
+      }
+      break;
+
+    case RX_TYPE:
+      rx_type = c;
+      rx_xor = c;
+      rx_len = 0;
+      if (c == TYPE_FRAME)
+      {
+        rx_state = RX_PAYLOAD;
+      }
+      else if (c == TYPE_STATUS || c == TYPE_CLEAR)
+      {
+        rx_state = RX_CHECKSUM;
+      }
+      else
+      {
+        cnt_errors++;
+        rx_state = RX_SYNC;
+      }
+      break;
+
+    case RX_PAYLOAD:
+      rx_buf[rx_len++] = c;
+      rx_xor ^= c;
+      if (rx_len == FRAME_LEN)
+      {
+        rx_state = RX_CHECKSUM;
+      }
+      break;
+
+    case RX_CHECKSUM:
+      if (c == rx_xor)
+      {
+        handle_packet();
+      }
+      else
+      {
+        cnt_errors++;
+      }
+      rx_state = RX_SYNC;
+      break;
+    }
+  }
+}
+
+// passes one queued frame on to the MMM8x8, skips unchanged frames
+void send_module(void)
+{
+  uint8_t *frame;
+
+  frame = get_frame();
+  if (frame == NULL)
+  {
+    return;
+  }
+
+  if (shown_valid && memcmp(frame, shown, FRAME_LEN) == 0)
+  {
+    cnt_skipped++;
+    return;
+  }
+
+  // copy first, the slot may be reused while the module is busy
+  memcpy(shown, frame, FRAME_LEN);
+  if (elv.displayPattern(shown) == 0)
+  {
+    shown_valid = true;
+    cnt_shown++;
+  }
+  else
+  {
+    shown_valid = false;
+    cnt_errors++;
+  }
+}
+
+void setup() {
+  Serial.begin (HOST_BAUD);
+
+  elv.begin();
+
+  clear_all();
+  rx_state = RX_SYNC;
+}
+
+void loop() {
+  receive_host();
+  send_module();
+
+  if (millis() - last_status >= STATUS_INTERVAL)
+  {
+    send_status();
+  }
+}
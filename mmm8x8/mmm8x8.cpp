@@ -174,17 +174,16 @@ int8_t mmm8x8::send_byte_escaped (uint8_t data, uint16_t *crc)
   return rc;
 }
 
-int8_t mmm8x8::send_command (char command, uint8_t nparam, const uint8_t *params)
+int8_t mmm8x8::send_command_start (char command, uint8_t nparam, uint16_t *crc)
 {
   int8_t    rc;
   uint8_t   tmph, tmpl;
-  uint16_t  crc;
 
   /* init crc */
-  crc = CRC_INIT_VAL;
+  *crc = CRC_INIT_VAL;
 
   /* write start of frame */
-  rc = send_byte (STX, &crc);
+  rc = send_byte (STX, crc);
   if (rc != 1)
   {
     rc = RET_COMMAND_ERR_WRITE;
@@ -194,13 +193,13 @@ int8_t mmm8x8::send_command (char command, uint8_t nparam, const uint8_t *params
   /* write two bytes length (command + params) */
   tmph = 0;
   tmpl = 1 + nparam;
-  rc = send_byte_escaped (tmph, &crc);
+  rc = send_byte_escaped (tmph, crc);
   if (rc != 1)
   {
     rc = RET_COMMAND_ERR_WRITE;
     goto EXIT;
   }
-  rc = send_byte_escaped (tmpl, &crc);
+  rc = send_byte_escaped (tmpl, crc);
   if (rc != 1)
   {
     rc = RET_COMMAND_ERR_WRITE;
@@ -208,29 +207,23 @@ int8_t mmm8x8::send_command (char command, uint8_t nparam, const uint8_t *params
   }
 
   /* write command */
-  rc = send_byte_escaped (command, &crc);
+  rc = send_byte_escaped (command, crc);
   if (rc != 1)
   {
     rc = RET_COMMAND_ERR_WRITE;
     goto EXIT;
   }
 
-  /* write params */
-  if (nparam > 0)
-  {
-    do
-    {
-      rc = send_byte_escaped (*params, &crc);
-      if (rc != 1)
-      {
-        rc = RET_COMMAND_ERR_WRITE;
-        goto EXIT;
-      }
-      params++;
-      nparam--;
-    }
-    while (nparam > 0);
-  }
+  rc = RET_COMMAND_OK;
+
+EXIT:
+  return rc;
+}
+
+int8_t mmm8x8::send_command_end (uint16_t crc)
+{
+  int8_t    rc;
+  uint8_t   tmph, tmpl;
 
   /* write 2 bytes checksum */
   tmph = (crc >> 8) & 0xff;
@@ -254,6 +247,42 @@ EXIT:
   return rc;
 }
 
+int8_t mmm8x8::send_command (char command, uint8_t nparam, const uint8_t *params)
+{
+  int8_t    rc;
+  uint16_t  crc;
+
+  /* write start of frame, length and command */
+  rc = send_command_start (command, nparam, &crc);
+  if (rc != RET_COMMAND_OK)
+  {
+    goto EXIT;
+  }
+
+  /* write params */
+  if (nparam > 0)
+  {
+    do
+    {
+      rc = send_byte_escaped (*params, &crc);
+      if (rc != 1)
+      {
+        rc = RET_COMMAND_ERR_WRITE;
+        goto EXIT;
+      }
+      params++;
+      nparam--;
+    }
+    while (nparam > 0);
+  }
+
+  /* write checksum */
+  rc = send_command_end (crc);
+
+EXIT:
+  return rc;
+}
+
 
 int8_t mmm8x8::cmd_get_firmwareversion (uint8_t *buffer, uint8_t maxLen)
 {
@@ -356,24 +385,55 @@ int8_t mmm8x8::cmd_display_pattern(const uint8_t pattern[8])
 
 int8_t mmm8x8::cmd_store_pattern(const uint8_t pattern[8], uint8_t delay, uint8_t cmd)
 {
-  int8_t  rc;
-  uint8_t buffer[8 + 1];
+  return store_pattern_from(pattern, false, delay, cmd);
+}
 
-  memcpy(buffer, pattern, 8);
-  buffer[8] = delay;
+int8_t mmm8x8::cmd_store_pattern_P(const uint8_t *pattern, uint8_t delay, uint8_t cmd)
+{
+  return store_pattern_from(pattern, true, delay, cmd);
+}
 
-  rc = send_command(cmd, 8 + 1, buffer);
+// pattern is in RAM or, with progmem, read from flash byte by byte
+int8_t mmm8x8::store_pattern_from(const uint8_t *pattern, bool progmem, uint8_t delay, uint8_t cmd)
+{
+  int8_t  rc;
+  uint8_t resp[MMM8x8_RESPONSE_LEN];
+  uint16_t crc;
+  uint8_t data;
+
+  /* pattern and delay are sent as 9 params, no need to copy them together */
+  rc = send_command_start(cmd, COLUMNS + 1, &crc);
+  if (rc != RET_COMMAND_OK)
+  {
+    goto EXIT;
+  }
+  for (uint8_t i = 0; i < COLUMNS; i++)
+  {
+    data = progmem ? pgm_read_byte(pattern + i) : pattern[i];
+    if (send_byte_escaped(data, &crc) != 1)
+    {
+      rc = RET_COMMAND_ERR_WRITE;
+      goto EXIT;
+    }
+  }
+  if (send_byte_escaped(delay, &crc) != 1)
+  {
+    rc = RET_COMMAND_ERR_WRITE;
+    goto EXIT;
+  }
+  rc = send_command_end(crc);
   if (rc == RET_COMMAND_OK)
   {
-    rc = recv_response(buffer, MMM8x8_RESPONSE_LEN);
+    rc = recv_response(resp, MMM8x8_RESPONSE_LEN);
   }
+
+EXIT:
   return rc;
 }
 
 
 
 
-
 // public functions
 mmm8x8::mmm8x8(int8_t pin_rx, int8_t pin_tx)
 {
@@ -512,6 +572,62 @@ int8_t mmm8x8::storeNextPattern(const uint8_t pattern[8], uint8_t delay)
   return rc;
 }
 
+// Shows a frame
+int8_t mmm8x8::displayPattern(const mmm8x8frame &frame)
+{
+  uint8_t pattern[8];
+
+  frame.toPattern(pattern);
+  return cmd_display_pattern(pattern);
+}
+
+// Stores a frame as the first pattern, delay is in steps of 100ms
+int8_t mmm8x8::storeFirstPattern(const mmm8x8frame &frame, uint8_t delay)
+{
+  uint8_t pattern[8];
+
+  frame.toPattern(pattern);
+  return cmd_store_pattern(pattern, delay, CMD_STORE_PATTERN0);
+}
+
+// Stores a frame as a following pattern, delay is in steps of 100ms
+int8_t mmm8x8::storeNextPattern(const mmm8x8frame &frame, uint8_t delay)
+{
+  uint8_t pattern[8];
+
+  frame.toPattern(pattern);
+  return cmd_store_pattern(pattern, delay, CMD_STORE_PATTERNx);
+}
+
+// Stores n patterns from flash, the first one replaces the stored sequence,
+// delays (also in flash) are in steps of 100ms, NULL means 100ms for all.
+// Stops at the first failing pattern, RET_COMMAND_ERR_NAK means the pattern
+// storage of the MMM8x8 is exhausted.
+int8_t mmm8x8::storeSequence_P(const uint8_t *frames, const uint8_t *delays, uint16_t n)
+{
+  int8_t rc = RET_COMMAND_PARAMETER;
+  uint8_t delay;
+  uint8_t cmd;
+
+  if (frames == NULL || n == 0)
+  {
+    return rc;
+  }
+
+  cmd = CMD_STORE_PATTERN0;
+  for (uint16_t i = 0; i < n; i++)
+  {
+    delay = (delays != NULL) ? pgm_read_byte(delays + i) : 1;
+    rc = cmd_store_pattern_P(frames + i * COLUMNS, delay, cmd);
+    if (rc != RET_COMMAND_OK)
+    {
+      break;
+    }
+    cmd = CMD_STORE_PATTERNx;
+  }
+  return rc;
+}
+
 // Resets to factory settings
 int8_t mmm8x8::factoryReset(void)
 {
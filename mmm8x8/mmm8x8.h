@@ -27,6 +27,7 @@
 
 #include <Arduino.h>
 #include <SoftwareSerial.h>
+#include "mmm8x8frame.h"
 
 class mmm8x8
 {
@@ -60,6 +61,14 @@ class mmm8x8
   // saves a pattern, one byte per line, delay is in steps of 100ms
   int8_t storeFirstPattern(const uint8_t pattern[8], uint8_t delay);
   int8_t storeNextPattern(const uint8_t pattern[8], uint8_t delay);
+  // the same for a frame, see mmm8x8frame.h
+  int8_t displayPattern(const mmm8x8frame &frame);
+  int8_t storeFirstPattern(const mmm8x8frame &frame, uint8_t delay);
+  int8_t storeNextPattern(const mmm8x8frame &frame, uint8_t delay);
+  // saves n patterns read directly from flash (PROGMEM), 8 bytes per pattern,
+  // delays holds one byte per pattern (NULL for 100ms each),
+  // stops at the first error, e.g. when the pattern storage is exhausted
+  int8_t storeSequence_P(const uint8_t *frames, const uint8_t *delays, uint16_t n);
 
  private:
   int8_t _pin_rx;
@@ -71,6 +80,8 @@ class mmm8x8
   int8_t send_byte (uint8_t data, uint16_t *crc);
   int8_t send_byte_escaped (uint8_t data, uint16_t *crc);
   int8_t send_command (char command, uint8_t nparam, const uint8_t *params);
+  int8_t send_command_start (char command, uint8_t nparam, uint16_t *crc);
+  int8_t send_command_end (uint16_t crc);
   int8_t cmd_get_firmwareversion (uint8_t *buffer, uint8_t maxLen);
   int8_t cmd_display_text (const char *text);
   int8_t cmd_store_text (const char *text);
@@ -79,6 +90,8 @@ class mmm8x8
   int8_t cmd_factoryreset (void);
   int8_t cmd_display_pattern(const uint8_t pattern[8]);
   int8_t cmd_store_pattern(const uint8_t pattern[8], uint8_t delay, uint8_t cmd);
+  int8_t cmd_store_pattern_P(const uint8_t *pattern, uint8_t delay, uint8_t cmd);
+  int8_t store_pattern_from(const uint8_t *pattern, bool progmem, uint8_t delay, uint8_t cmd);
 
 };
 
@@ -0,0 +1,215 @@
+/*
+ * Arduino library for ELV MMM8x8
+ * based on https://github.com/oism/mmm8x8
+ *
+ * download at https://github.com/dr-boehmerie/mmm8x8
+ *
+ * A pattern as one 64 bit word, the same layout as frame64.h of the
+ * host tool: byte x of the pattern is column x from the left, bit y of
+ * it is line y from the top, so pixel (x, y) is bit 8 * x + y.
+ * All transforms are constexpr and branch-free, n is 0 to 7.
+ *
+ */
+
+#ifndef MMM8X8FRAME_H
+#define MMM8X8FRAME_H
+
+#include <stdint.h>
+
+class mmm8x8frame
+{
+ public:
+  constexpr mmm8x8frame() : bits(0) {}
+  constexpr explicit mmm8x8frame(uint64_t b) : bits(b) {}
+
+  // converts from and to the 8 bytes sent to the MMM8x8
+  static mmm8x8frame fromPattern(const uint8_t pattern[8])
+  {
+    uint64_t b = 0;
+
+    for (int8_t i = 7; i >= 0; i--)
+    {
+      b = (b << 8) | pattern[i];
+    }
+    return mmm8x8frame(b);
+  }
+
+  void toPattern(uint8_t pattern[8]) const
+  {
+    uint64_t b = bits;
+
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      pattern[i] = (uint8_t) b;
+      b >>= 8;
+    }
+  }
+
+  constexpr uint64_t raw() const { return bits; }
+
+  constexpr bool get(uint8_t x, uint8_t y) const
+  {
+    return (bits >> (8 * x + y)) & 1;
+  }
+
+  constexpr mmm8x8frame set(uint8_t x, uint8_t y, bool on) const
+  {
+    return mmm8x8frame((bits & ~(1ULL << (8 * x + y))) |
+                       ((uint64_t) on << (8 * x + y)));
+  }
+
+  // the n columns on the left, the n lines at the top, n is 0 to 8
+  static constexpr mmm8x8frame columns(uint8_t n)
+  {
+    return mmm8x8frame((~0ULL >> ((64 - 8 * n) & 63)) & -(uint64_t) (n != 0));
+  }
+
+  static constexpr mmm8x8frame lines(uint8_t n)
+  {
+    return mmm8x8frame(LSB_OF_BYTES * ((1U << n) - 1));
+  }
+
+  // shifts, the pixels that move out are lost
+  constexpr mmm8x8frame shiftLeft(uint8_t n) const
+  {
+    return mmm8x8frame(bits >> (8 * n));
+  }
+
+  constexpr mmm8x8frame shiftRight(uint8_t n) const
+  {
+    return mmm8x8frame(bits << (8 * n));
+  }
+
+  constexpr mmm8x8frame shiftUp(uint8_t n) const
+  {
+    return mmm8x8frame((bits >> n) & lines(8 - n).bits);
+  }
+
+  constexpr mmm8x8frame shiftDown(uint8_t n) const
+  {
+    return mmm8x8frame((bits << n) & ~lines(n).bits);
+  }
+
+  // rotations, the pixels that move out come in on the other side
+  constexpr mmm8x8frame rotateLeft(uint8_t n) const
+  {
+    return mmm8x8frame((bits >> (8 * n)) | (bits << ((64 - 8 * n) & 63)));
+  }
+
+  constexpr mmm8x8frame rotateRight(uint8_t n) const
+  {
+    return mmm8x8frame((bits << (8 * n)) | (bits >> ((64 - 8 * n) & 63)));
+  }
+
+  constexpr mmm8x8frame rotateUp(uint8_t n) const
+  {
+    return mmm8x8frame(((bits >> n) & lines(8 - n).bits) |
+                       ((bits << ((8 - n) & 7)) & ~lines(8 - n).bits));
+  }
+
+  constexpr mmm8x8frame rotateDown(uint8_t n) const
+  {
+    return rotateUp((8 - n) & 7);
+  }
+
+  // left and right swapped, top and bottom swapped
+  constexpr mmm8x8frame mirror() const
+  {
+    return mmm8x8frame(swap(swap(swap(bits, 8, 0x00ff00ff00ff00ffULL),
+                                 16, 0x0000ffff0000ffffULL),
+                            32, 0x00000000ffffffffULL));
+  }
+
+  constexpr mmm8x8frame flip() const
+  {
+    return mmm8x8frame(swap(swap(swap(bits, 1, 0x5555555555555555ULL),
+                                 2, 0x3333333333333333ULL),
+                            4, 0x0f0f0f0f0f0f0f0fULL));
+  }
+
+  constexpr mmm8x8frame invert() const
+  {
+    return mmm8x8frame(~bits);
+  }
+
+  // pixel (x, y) to (y, x)
+  constexpr mmm8x8frame transpose() const
+  {
+    return mmm8x8frame(delta(delta(delta(bits, 0x0f0f0f0f00000000ULL, 28),
+                                   0x3333000033330000ULL, 14),
+                             0x5500550055005500ULL, 7));
+  }
+
+  constexpr mmm8x8frame rotateCW() const
+  {
+    return transpose().mirror();
+  }
+
+  constexpr mmm8x8frame rotateCCW() const
+  {
+    return transpose().flip();
+  }
+
+  // compositing
+  constexpr mmm8x8frame operator|(mmm8x8frame other) const
+  {
+    return mmm8x8frame(bits | other.bits);
+  }
+
+  constexpr mmm8x8frame operator^(mmm8x8frame other) const
+  {
+    return mmm8x8frame(bits ^ other.bits);
+  }
+
+  constexpr mmm8x8frame operator&(mmm8x8frame other) const
+  {
+    return mmm8x8frame(bits & other.bits);
+  }
+
+  // this frame where mask is off, other where it is on
+  constexpr mmm8x8frame select(mmm8x8frame other, mmm8x8frame mask) const
+  {
+    return mmm8x8frame(bits ^ ((bits ^ other.bits) & mask.bits));
+  }
+
+  constexpr bool operator==(mmm8x8frame other) const
+  {
+    return bits == other.bits;
+  }
+
+  // the number of pixels that are on
+  constexpr uint8_t popcount() const
+  {
+    return count(bits - ((bits >> 1) & 0x5555555555555555ULL));
+  }
+
+ private:
+  static constexpr uint64_t LSB_OF_BYTES = 0x0101010101010101ULL;
+
+  uint64_t bits;
+
+  // exchanges the bit groups selected by mask with the ones s bits above
+  static constexpr uint64_t swap(uint64_t b, uint8_t s, uint64_t mask)
+  {
+    return ((b >> s) & mask) | ((b & mask) << s);
+  }
+
+  static constexpr uint64_t delta(uint64_t b, uint64_t mask, uint8_t s)
+  {
+    return b ^ (mask & (b ^ (b << s))) ^ ((mask & (b ^ (b << s))) >> s);
+  }
+
+  // the rest of the SWAR popcount, b holds the counts of bit pairs
+  static constexpr uint8_t count(uint64_t b)
+  {
+    return count4(((b & 0x3333333333333333ULL) +
+                   ((b >> 2) & 0x3333333333333333ULL)));
+  }
+
+  static constexpr uint8_t count4(uint64_t b)
+  {
+    return (((b + (b >> 4)) & 0x0f0f0f0f0f0f0f0fULL) * LSB_OF_BYTES) >> 56;
+  }
+};
+
+#endif
@@ -0,0 +1,445 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <state.h>
+#include <clock.h>
+
+#define PACK_SRC 1
+#include <pack.h>
+#undef PACK_SRC
+
+/* "mmm8x8 pack <directory> <packfile>" reads the .mmm files of directory
+   with --jobs threads and writes them to one pack, each animation named
+   after its file without .mmm. A lookup reads the header, the buckets it
+   probes, their names and the frames of the animation it has found, it
+   does not depend on the number of animations in the pack. */
+
+#define PACK_SUFFIX  ".mmm"
+#define MAX_ANIMS    (65536)
+#define DEFAULT_JOBS (8)
+#define MAX_JOBS     (64)
+
+typedef struct {
+  char     *path;
+  char     *name;
+  SEQUENCE  seq;
+  int       rc;
+} PACKED;
+
+typedef struct {
+  PACKED *anims;
+  int     nanims;
+  int     next;             /* next animation to read, taken atomically */
+} PACKER;
+
+static int list_animations(char *dir, PACKER *packer);
+static void *reader_thread(void *arg);
+static int write_pack(char *path, PACKER *packer);
+static int compare_names(const void *a, const void *b);
+
+
+/* pack <directory> <packfile> */
+int build_pack(int myargc, char **myargv)
+{
+  int rc;
+  PACKER packer;
+  pthread_t threads[MAX_JOBS];
+  long long start;
+  long long us;
+  long nframes;
+  int jobs;
+  int i;
+
+  start = get_time_us();
+
+  if ((rc = list_animations(myargv[0], &packer)) != RET_PACK_OK)
+  {
+    fprintf(stderr, "read of directory %s has failed\n", myargv[0]);
+    goto EXIT;
+  }
+
+  jobs = (cmd_options.jobs > 0) ? cmd_options.jobs : DEFAULT_JOBS;
+  if (jobs > MAX_JOBS)
+  {
+    jobs = MAX_JOBS;
+  }
+  if (jobs > packer.nanims)
+  {
+    jobs = packer.nanims;
+  }
+  for (i = 0; i < jobs; i++)
+  {
+    if (pthread_create(&threads[i], NULL, reader_thread, &packer) != 0)
+    {
+      fprintf(stderr, "starting reader thread %d has failed.\n", i + 1);
+      break;
+    }
+  }
+  if (i < jobs)
+  {
+    /* this thread reads what the missing ones would have read */
+    jobs = i;
+    reader_thread(&packer);
+  }
+  for (i = 0; i < jobs; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  rc = RET_PACK_OK;
+  nframes = 0;
+  for (i = 0; i < packer.nanims; i++)
+  {
+    if (packer.anims[i].rc != RET_SEQUENCE_OK)
+    {
+      fprintf(stderr, "read of patternfile %s has failed\n",
+              packer.anims[i].path);
+      rc = RET_PACK_ERR_READ;
+    }
+    nframes += packer.anims[i].seq.nframes;
+  }
+  if (rc != RET_PACK_OK)
+  {
+    goto FREE_EXIT;
+  }
+
+  if ((rc = write_pack(myargv[1], &packer)) != RET_PACK_OK)
+  {
+    fprintf(stderr, "write of pack %s has failed\n", myargv[1]);
+    goto FREE_EXIT;
+  }
+
+  us = get_time_us() - start;
+  printf("%d animations, %ld patterns packed by %d threads, "
+         "%lld.%03lld s\n", packer.nanims, nframes, (jobs > 0) ? jobs : 1,
+         us / 1000000, us / 1000 % 1000);
+
+FREE_EXIT:
+  for (i = 0; i < packer.nanims; i++)
+  {
+    free(packer.anims[i].path);
+    free(packer.anims[i].name);
+    free_sequence(&packer.anims[i].seq);
+  }
+  free(packer.anims);
+
+EXIT:
+  return rc;
+}
+
+
+/* looks name up in the pack at path and appends its frames to seq */
+int read_pack(char *path, char *name, SEQUENCE *seq)
+{
+  int rc;
+  FILE *file;
+  PACK_HEADER header;
+  PACK_ENTRY entry;
+  char found[MAX_STATE_LINE];
+  FRAME *frames;
+  unsigned long long hash;
+  long size;
+  int namelen;
+  int bucket;
+  int probes;
+  int i;
+
+  if ((file = fopen(path, "rb")) == NULL)
+  {
+    rc = RET_PACK_ERR_OPEN;
+    goto EXIT;
+  }
+
+  /* the offsets must stay inside the file and in the order write_pack
+     puts them, the frames must end with the file */
+  if ((fseek(file, 0, SEEK_END) != 0) || ((size = ftell(file)) == -1) ||
+      (fseek(file, 0, SEEK_SET) != 0) ||
+      (fread(&header, sizeof(header), 1, file) != 1) ||
+      (memcmp(header.magic, PACK_MAGIC, PACK_MAGIC_LEN) != 0) ||
+      (header.nbuckets <= 0) ||
+      ((header.nbuckets & (header.nbuckets - 1)) != 0) ||
+      (header.nbuckets > (size - (long) sizeof(header)) /
+                         (long) sizeof(entry)) ||
+      (header.names != sizeof(header) + header.nbuckets * sizeof(entry)) ||
+      (header.frames < header.names) || (header.frames > size) ||
+      ((size - header.frames) % sizeof(FRAME) != 0))
+  {
+    rc = RET_PACK_ERR_FORMAT;
+    goto CLOSE_EXIT;
+  }
+
+  namelen = strlen(name);
+  hash = hash_bytes(HASH_INIT, (unsigned char *) name, namelen);
+  bucket = hash & (header.nbuckets - 1);
+
+  /* the table is at most half full, an empty bucket ends the search */
+  for (probes = 0; probes < header.nbuckets; probes++)
+  {
+    if ((fseek(file, sizeof(header) + (long) bucket * sizeof(entry),
+               SEEK_SET) != 0) ||
+        (fread(&entry, sizeof(entry), 1, file) != 1))
+    {
+      rc = RET_PACK_ERR_FORMAT;
+      goto CLOSE_EXIT;
+    }
+    if (entry.name == -1)
+    {
+      break;
+    }
+    if ((entry.hash == hash) && (entry.namelen == namelen) &&
+        (namelen < sizeof(found)) &&
+        (fseek(file, header.names + entry.name, SEEK_SET) == 0) &&
+        (fread(found, namelen, 1, file) == 1) &&
+        (memcmp(found, name, namelen) == 0))
+    {
+      break;
+    }
+    bucket = (bucket + 1) & (header.nbuckets - 1);
+  }
+  if ((probes == header.nbuckets) || (entry.name == -1))
+  {
+    rc = RET_PACK_ERR_NOTFOUND;
+    goto CLOSE_EXIT;
+  }
+  if ((entry.name < 0) ||
+      ((long) entry.name + namelen > header.frames - header.names) ||
+      (entry.first < 0) || (entry.nframes < 0) ||
+      ((long long) entry.first + entry.nframes >
+       (size - header.frames) / (long) sizeof(FRAME)))
+  {
+    rc = RET_PACK_ERR_FORMAT;
+    goto CLOSE_EXIT;
+  }
+
+  if ((frames = malloc(entry.nframes * sizeof(FRAME) + 1)) == NULL)
+  {
+    rc = RET_PACK_ERR_MEMORY;
+    goto CLOSE_EXIT;
+  }
+  if ((fseek(file, header.frames + (long) entry.first * sizeof(FRAME),
+             SEEK_SET) != 0) ||
+      (fread(frames, sizeof(FRAME), entry.nframes, file) != entry.nframes))
+  {
+    rc = RET_PACK_ERR_FORMAT;
+    goto FREE_EXIT;
+  }
+
+  for (i = 0; i < entry.nframes; i++)
+  {
+    if (add_frame(seq, frames[i].pattern, frames[i].duration) !=
+        RET_SEQUENCE_OK)
+    {
+      rc = RET_PACK_ERR_MEMORY;
+      goto FREE_EXIT;
+    }
+  }
+
+  rc = RET_PACK_OK;
+
+FREE_EXIT:
+  free(frames);
+
+CLOSE_EXIT:
+  fclose(file);
+
+EXIT:
+  return rc;
+}
+
+
+/* the .mmm files of dir, sorted by name so a pack does not depend on the
+   order of the directory */
+static int list_animations(char *dir, PACKER *packer)
+{
+  int rc;
+  DIR *handle;
+  struct dirent *ent;
+  PACKED *anim;
+  int len;
+
+  memset(packer, 0, sizeof(*packer));
+
+  if ((handle = opendir(dir)) == NULL)
+  {
+    rc = RET_PACK_ERR_OPEN;
+    goto EXIT;
+  }
+  if ((packer->anims = calloc(MAX_ANIMS, sizeof(PACKED))) == NULL)
+  {
+    rc = RET_PACK_ERR_MEMORY;
+    goto CLOSE_EXIT;
+  }
+
+  while ((ent = readdir(handle)) != NULL)
+  {
+    len = strlen(ent->d_name);
+    if ((len <= strlen(PACK_SUFFIX)) ||
+        (strcmp(ent->d_name + len - strlen(PACK_SUFFIX), PACK_SUFFIX) != 0))
+    {
+      continue;
+    }
+    if (packer->nanims == MAX_ANIMS)
+    {
+      fprintf(stderr, "%s has more than %d pattern files, a pack holds "
+                      "at most %d.\n", dir, MAX_ANIMS, MAX_ANIMS);
+      rc = RET_PACK_ERR_READ;
+      goto FREE_EXIT;
+    }
+
+    anim = &packer->anims[packer->nanims++];
+    anim->name = strdup(ent->d_name);
+    anim->name[len - strlen(PACK_SUFFIX)] = '\0';
+    anim->path = malloc(strlen(dir) + 1 + len + 1);
+    sprintf(anim->path, "%s/%s", dir, ent->d_name);
+    init_sequence(&anim->seq);
+  }
+
+  qsort(packer->anims, packer->nanims, sizeof(PACKED), compare_names);
+  rc = RET_PACK_OK;
+  goto CLOSE_EXIT;
+
+FREE_EXIT:
+  while (packer->nanims > 0)
+  {
+    anim = &packer->anims[--packer->nanims];
+    free(anim->name);
+    free(anim->path);
+  }
+  free(packer->anims);
+  packer->anims = NULL;
+
+CLOSE_EXIT:
+  closedir(handle);
+
+EXIT:
+  return rc;
+}
+
+
+static void *reader_thread(void *arg)
+{
+  PACKER *packer = arg;
+  PACKED *anim;
+  int i;
+
+  while ((i = __atomic_fetch_add(&packer->next, 1, __ATOMIC_RELAXED)) <
+         packer->nanims)
+  {
+    anim = &packer->anims[i];
+    anim->rc = read_sequence(anim->path, &anim->seq);
+  }
+
+  return NULL;
+}
+
+
+static int write_pack(char *path, PACKER *packer)
+{
+  int rc;
+  FILE *file;
+  PACK_HEADER header;
+  PACK_ENTRY *buckets;
+  PACKED *anim;
+  unsigned long long hash;
+  int namepos;
+  int first;
+  int bucket;
+  int i;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PACK_MAGIC, PACK_MAGIC_LEN);
+  header.nanims = packer->nanims;
+  for (header.nbuckets = 1; header.nbuckets < 2 * packer->nanims;
+       header.nbuckets *= 2)
+    ;
+
+  if ((buckets = malloc(header.nbuckets * sizeof(PACK_ENTRY))) == NULL)
+  {
+    rc = RET_PACK_ERR_MEMORY;
+    goto EXIT;
+  }
+  for (i = 0; i < header.nbuckets; i++)
+  {
+    buckets[i].hash = 0;
+    buckets[i].name = -1;
+    buckets[i].namelen = 0;
+    buckets[i].first = 0;
+    buckets[i].nframes = 0;
+  }
+
+  namepos = 0;
+  first = 0;
+  for (i = 0; i < packer->nanims; i++)
+  {
+    anim = &packer->anims[i];
+    hash = hash_bytes(HASH_INIT, (unsigned char *) anim->name,
+                      strlen(anim->name));
+    for (bucket = hash & (header.nbuckets - 1); buckets[bucket].name != -1;
+         bucket = (bucket + 1) & (header.nbuckets - 1))
+      ;
+    buckets[bucket].hash = hash;
+    buckets[bucket].name = namepos;
+    buckets[bucket].namelen = strlen(anim->name);
+    buckets[bucket].first = first;
+    buckets[bucket].nframes = anim->seq.nframes;
+    namepos += strlen(anim->name) + 1;
+    first += anim->seq.nframes;
+  }
+
+  header.names = sizeof(header) + header.nbuckets * sizeof(PACK_ENTRY);
+  header.frames = header.names + namepos;
+
+  if ((file = fopen(path, "wb")) == NULL)
+  {
+    rc = RET_PACK_ERR_WRITE;
+    goto FREE_EXIT;
+  }
+
+  rc = RET_PACK_OK;
+  if ((fwrite(&header, sizeof(header), 1, file) != 1) ||
+      (fwrite(buckets, sizeof(PACK_ENTRY), header.nbuckets, file) !=
+       header.nbuckets))
+  {
+    rc = RET_PACK_ERR_WRITE;
+  }
+  for (i = 0; (rc == RET_PACK_OK) && (i < packer->nanims); i++)
+  {
+    if (fwrite(packer->anims[i].name, strlen(packer->anims[i].name) + 1, 1,
+               file) != 1)
+    {
+      rc = RET_PACK_ERR_WRITE;
+    }
+  }
+  for (i = 0; (rc == RET_PACK_OK) && (i < packer->nanims); i++)
+  {
+    anim = &packer->anims[i];
+    if (fwrite(anim->seq.frames, sizeof(FRAME), anim->seq.nframes, file) !=
+        anim->seq.nframes)
+    {
+      rc = RET_PACK_ERR_WRITE;
+    }
+  }
+  if ((fclose(file) != 0) && (rc == RET_PACK_OK))
+  {
+    rc = RET_PACK_ERR_WRITE;
+  }
+
+FREE_EXIT:
+  free(buckets);
+
+EXIT:
+  return rc;
+}
+
+
+static int compare_names(const void *a, const void *b)
+{
+  return strcmp(((PACKED *) a)->name, ((PACKED *) b)->name);
+}
@@ -0,0 +1,49 @@
+#ifndef PACK_H
+#define PACK_H
+
+#define RET_PACK_OK           (0)
+#define RET_PACK_ERR_OPEN     (1)
+#define RET_PACK_ERR_READ     (2)
+#define RET_PACK_ERR_WRITE    (3)
+#define RET_PACK_ERR_FORMAT   (4)
+#define RET_PACK_ERR_NOTFOUND (5)
+#define RET_PACK_ERR_MEMORY   (6)
+
+/* Pack of named animations, written by "mmm8x8 pack". The file is a
+   PACK_HEADER, nbuckets PACK_ENTRY, the names each ending with '\0' and,
+   from offset frames on, the FRAMEs of all animations one after the
+   other. An animation is found in the bucket hash_bytes(name) modulo
+   nbuckets or in one of the buckets following it. The numbers are in the
+   byte order of the host that wrote it. */
+
+#define PACK_MAGIC     "MMM8PAK1"
+#define PACK_MAGIC_LEN (8)
+
+typedef struct {
+  char magic[PACK_MAGIC_LEN];
+  int  nanims;
+  int  nbuckets;            /* a power of 2, at least twice nanims */
+  int  names;               /* offset of the names */
+  int  frames;              /* offset of the frames */
+} PACK_HEADER;
+
+typedef struct {
+  unsigned long long hash;  /* hash_bytes of the name */
+  int                name;  /* offset from names on, -1: empty bucket */
+  int                namelen;
+  int                first; /* index of the first frame */
+  int                nframes;
+} PACK_ENTRY;
+
+#if PACK_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int build_pack(int myargc, char **myargv);
+EXTERN int read_pack(char *path, char *name, SEQUENCE *seq);
+
+#undef EXTERN
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 
 #define PATTERN_SRC 1
 #include <pattern.h>
@@ -55,6 +56,110 @@ EXIT:
 }
 
 
+/* reads one line of any width into one byte per pixel, 1 is on,
+   pixels missing at the end of the line are off */
+int read_patternline(FILE *handle, unsigned char *pixels, int width)
+{
+  int rc;
+  int i;
+  char buf[MAX_LINE];
+  int end;
+
+  if (fgets(buf, MAX_LINE, handle) == NULL)
+  {
+    rc = RET_PATTERN_ERR_READ;
+    goto EXIT;
+  }
+
+  end = 0;
+  for (i = 0; i < width; i++)
+  {
+    if ((i >= MAX_LINE) || (buf[i] == '\0') || (buf[i] == '\n'))
+    {
+      end = 1;
+    }
+    pixels[i] = (!end && (buf[i] == BIT_SET_CHAR)) ? 1 : 0;
+  }
+
+  rc = RET_PATTERN_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* reads 8 lines and turns them into one byte per column, bit 0 is the top line */
+int read_pattern(FILE *handle, unsigned char *pattern)
+{
+  int rc;
+  int lines;
+  int columns;
+  unsigned char linepattern;
+
+  for (lines = 0; lines  < LINES_PER_PATTERN; lines++)
+  {
+    pattern[lines] = 0;
+  }
+
+  for (lines = 0; lines < LINES_PER_PATTERN; lines++)
+  {
+    if ((rc = read_patternfile(handle, &linepattern)) != RET_PATTERN_OK)
+    {
+      goto EXIT;
+    }
+
+    for (columns = 0; columns < COLUMNS_PER_PATTERN; columns++)
+    {
+      if (linepattern & (1 << (COLUMNS_PER_PATTERN - columns - 1))) 
+      {
+        pattern[columns] = pattern[columns] | (1 << lines);
+      }
+    }
+  }
+  
+  rc = RET_PATTERN_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* reads the line following a pattern, it may hold the display duration of
+   that pattern in multiples of 100 ms, *duration is 0 if the line is empty */
+int read_patternduration(FILE *handle, unsigned char *duration)
+{
+  int rc;
+  char buf[MAX_LINE];
+  char *pos;
+  long value;
+
+  if (fgets(buf, MAX_LINE, handle) == NULL)
+  {
+    rc = RET_PATTERN_ERR_READ;
+    goto EXIT;
+  }
+
+  for (pos = buf; isspace((unsigned char) *pos); pos++)
+    ;
+
+  value = 0;
+  if (isdigit((unsigned char) *pos))
+  {
+    value = strtol(pos, NULL, 10);
+    if (value > 255)
+    {
+      value = 255;
+    }
+  }
+  *duration = value;
+
+  rc = RET_PATTERN_OK;
+
+EXIT:
+  return rc;
+}
+
+
 int close_patternfile(FILE *handle)
 {
   int rc;
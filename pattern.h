@@ -6,6 +6,9 @@
 #define RET_PATTERN_ERR_CLOSE   (2)
 #define RET_PATTERN_ERR_READ    (3)
 
+#define LINES_PER_PATTERN (8)
+#define COLUMNS_PER_PATTERN (8)
+
 #if PATTERN_SRC
 # define EXTERN 
 #else
@@ -14,6 +17,9 @@
 
 EXTERN int open_patternfile(char *path, FILE **handle);
 EXTERN int read_patternfile(FILE *handle, unsigned char *linevalue);
+EXTERN int read_patternline(FILE *handle, unsigned char *pixels, int width);
+EXTERN int read_pattern(FILE *handle, unsigned char *pattern);
+EXTERN int read_patternduration(FILE *handle, unsigned char *duration);
 EXTERN int close_patternfile(FILE *handle);
 
 #undef EXTERN
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <wire.h>
+#include <crc16.h>
+#include <clock.h>
+
+#define PIPELINE_SRC 1
+#include <pipeline.h>
+#undef PIPELINE_SRC
+
+/* Waiting for the 6 byte acknowledge of each 14 byte display frame leaves
+   the link idle for a third of the time. With --pipeline the frames are
+   written as long as fewer than window of them are unanswered, the reader
+   thread drains the acknowledges, checks their checksum and counts NAKs
+   and acknowledges that have not come within ACK_TIMEOUT_US, as long as
+   receive_response waits for one.
+
+   The answers are counted in blocks of ERROR_BLOCK. As soon as more than
+   MAX_ERROR_PERCENT of a block are errors, the window is halved, down to
+   1, which is stop-and-wait again. After a block without error it grows
+   by one. Store commands never come here, they are always acknowledged
+   one by one.
+
+   The acknowledges carry no sequence number. A frame given up on after an
+   answer has been heard that could have been its own has lost its answer.
+   One given up on without an answer since may still get it, an answer
+   that comes while such frames are late is taken as the answer of the
+   oldest of them and dropped, so the frames after it are not credited
+   with it. If a frame
+   then goes without an answer before all frames sent have been answered,
+   the answers have been taken one frame too late, the frame given up on
+   was lost and this frame gets the dropped answer. */
+
+#define ACK_LEN           (6)
+#define ACK               (0x06)
+#define ACK_TIMEOUT_US    (100000)
+#define MAX_ERROR_PERCENT (10)
+#define ERROR_BLOCK       (128)
+#define MAX_SILENCE_US    (1000000) /* no answer at all: the port has failed */
+
+static void *read_acks(void *arg);
+static void credit(PIPELINE *pl, int rc);
+static void answer(PIPELINE *pl, int error);
+static int check_ack(unsigned char *rsp);
+
+
+int open_pipeline(SERHDL hdl, PIPELINE *pl)
+{
+  memset(pl, 0, sizeof(*pl));
+  pl->hdl = hdl;
+  pl->window = MAX_WINDOW;
+
+  /* a dry run has no acknowledges, Windows does not read and write a
+     port from two threads at once */
+#if LINUX
+  pl->async = cmd_options.pipeline && !cmd_options.dryrun;
+#endif
+  if (!pl->async)
+  {
+    return RET_COMMAND_OK;
+  }
+
+  pthread_mutex_init(&pl->lock, NULL);
+  pthread_cond_init(&pl->changed, NULL);
+  if (pthread_create(&pl->reader, NULL, read_acks, pl) != 0)
+  {
+    pthread_cond_destroy(&pl->changed);
+    pthread_mutex_destroy(&pl->lock);
+    fprintf(stderr, "starting the acknowledge reader has failed.\n");
+    return RET_COMMAND_ERR_READ;
+  }
+
+  return RET_COMMAND_OK;
+}
+
+
+int send_display(PIPELINE *pl, unsigned char *pattern)
+{
+  unsigned char frame[MAX_FRAME_LEN];
+  int len;
+
+  len = encode_command('D', LINES_PER_PATTERN, pattern, frame);
+  return send_display_frame(pl, frame, len);
+}
+
+
+/* an encoded display frame, with --pipeline only waits for a free slot of
+   the window, an error is returned only when the port has failed */
+int send_display_frame(PIPELINE *pl, unsigned char *frame, int len)
+{
+  int rc;
+  unsigned char response[ACK_LEN];
+  int slot;
+
+  if (!pl->async)
+  {
+    if ((rc = send_frame(pl->hdl, frame, len)) == RET_COMMAND_OK)
+    {
+      rc = receive_response(pl->hdl, response, ACK_LEN);
+    }
+    return rc;
+  }
+
+  pthread_mutex_lock(&pl->lock);
+  while ((pl->outstanding >= pl->window) && !pl->failed)
+  {
+    pthread_cond_wait(&pl->changed, &pl->lock);
+  }
+  if (pl->failed)
+  {
+    pthread_mutex_unlock(&pl->lock);
+    return RET_COMMAND_ERR_READ;
+  }
+  slot = (pl->oldest + pl->outstanding) % MAX_WINDOW;
+  pl->sent_us[slot] = get_time_us();
+  pl->due_us[slot] = pl->sent_us[slot] + wire_time_us(len + ACK_LEN);
+  /* after acknowledges missing the silence goes on */
+  if ((pl->outstanding == 0) && (pl->lost == 0))
+  {
+    pl->heard_us = pl->sent_us[pl->oldest];
+  }
+  pl->outstanding++;
+  pl->sent++;
+  pthread_mutex_unlock(&pl->lock);
+
+  return send_frame(pl->hdl, frame, len);
+}
+
+
+/* waits for the acknowledges still outstanding and prints the counts */
+void close_pipeline(PIPELINE *pl)
+{
+  if (!pl->async)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&pl->lock);
+  while (pl->outstanding > 0)
+  {
+    pthread_cond_wait(&pl->changed, &pl->lock);
+  }
+  pl->stop = 1;
+  pthread_mutex_unlock(&pl->lock);
+  pthread_join(pl->reader, NULL);
+
+  printf("%ld frames without waiting: %ld acknowledged, %ld NAKs, %ld "
+         "missing, %ld late, %ld bad bytes, window %d after %ld "
+         "throttles\n", pl->sent, pl->acked, pl->naks, pl->missing,
+         pl->dropped, pl->bad, pl->window, pl->throttles);
+
+  pthread_cond_destroy(&pl->changed);
+  pthread_mutex_destroy(&pl->lock);
+}
+
+
+static void *read_acks(void *arg)
+{
+  PIPELINE *pl = arg;
+  unsigned char rsp[ACK_LEN];
+  long long now;
+  int n;
+  int rc;
+  int error;
+
+  n = 0;
+  for (;;)
+  {
+    /* read_serial gives up after 100 ms, errno tells a failed port from
+       that */
+    errno = 0;
+    rc = read_serial(pl->hdl, rsp + n, 1);
+    error = (rc == -1) && (errno != 0) && (errno != EINTR);
+
+    pthread_mutex_lock(&pl->lock);
+    now = get_time_us();
+    if (error && !pl->failed)
+    {
+      fprintf(stderr, "reading the acknowledges has failed: %s\n",
+              strerror(errno));
+      pl->failed = 1;
+      pthread_cond_broadcast(&pl->changed);
+    }
+    if (rc == 1)
+    {
+      /* resynchronize on the next STX */
+      if ((n == 0) && (rsp[0] != STX))
+      {
+        pl->bad++;
+      }
+      else if (++n == ACK_LEN)
+      {
+        rc = check_ack(rsp);
+        if (rc < 0)
+        {
+          pl->bad += ACK_LEN;
+        }
+        else if (pl->late > 0)
+        {
+          /* kept in case a frame goes without an answer */
+          pl->late--;
+          pl->late_rc = rc;
+          pl->dropped++;
+        }
+        else if (pl->outstanding > 0)
+        {
+          credit(pl, rc);
+        }
+        if (rc >= 0)
+        {
+          pl->heard_us = now;
+          pl->lost = 0;
+        }
+        n = 0;
+      }
+    }
+
+    /* the oldest frames that are too long without an answer */
+    if ((pl->outstanding > 0) && (now - pl->heard_us > MAX_SILENCE_US))
+    {
+      pl->failed = 1;
+      pthread_cond_broadcast(&pl->changed);
+    }
+    if ((pl->late > 0) && (now > pl->late_until_us))
+    {
+      pl->late = 0;
+    }
+    while ((pl->outstanding > 0) &&
+           (now - pl->sent_us[pl->oldest] > ACK_TIMEOUT_US))
+    {
+      if (pl->late_rc != 0)
+      {
+        pl->dropped--;
+        credit(pl, pl->late_rc);
+        pl->late_rc = 0;
+        continue;
+      }
+      if ((pl->heard_us < pl->due_us[pl->oldest]) && (pl->late < MAX_WINDOW))
+      {
+        pl->late++;
+        pl->late_until_us = now + ACK_TIMEOUT_US;
+      }
+      pl->missing++;
+      pl->lost++;
+      pl->oldest = (pl->oldest + 1) % MAX_WINDOW;
+      pl->outstanding--;
+      answer(pl, 1);
+    }
+
+    if (pl->stop)
+    {
+      pthread_mutex_unlock(&pl->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pl->lock);
+
+    /* a port that cannot be read fails at once, the frames still
+       outstanding are given up on at the pace of the timeouts */
+    if (error)
+    {
+      sleep_us(ACK_TIMEOUT_US);
+    }
+  }
+
+  return NULL;
+}
+
+
+/* called with the lock held, the oldest outstanding frame is answered */
+static void credit(PIPELINE *pl, int rc)
+{
+  if (rc == ACK)
+  {
+    pl->acked++;
+  }
+  else
+  {
+    pl->naks++;
+  }
+  pl->oldest = (pl->oldest + 1) % MAX_WINDOW;
+  pl->outstanding--;
+  /* every frame sent has its answer, the dropped one was a late one */
+  if ((pl->outstanding == 0) && (pl->late == 0))
+  {
+    pl->late_rc = 0;
+  }
+  answer(pl, rc != ACK);
+}
+
+
+/* called with the lock held for every acknowledge, NAK or missing one */
+static void answer(PIPELINE *pl, int error)
+{
+  pl->answers++;
+  pl->errors += (error != 0);
+
+  if (pl->errors * 100 > MAX_ERROR_PERCENT * ERROR_BLOCK)
+  {
+    if (pl->window > 1)
+    {
+      pl->window /= 2;
+      pl->throttles++;
+      if (pl->window == 1)
+      {
+        fprintf(stderr, "too many display frames are not acknowledged, "
+                        "waiting for each one.\n");
+      }
+    }
+    pl->answers = 0;
+    pl->errors = 0;
+  }
+  else if (pl->answers == ERROR_BLOCK)
+  {
+    if ((pl->errors == 0) && (pl->window < MAX_WINDOW))
+    {
+      pl->window++;
+    }
+    pl->answers = 0;
+    pl->errors = 0;
+  }
+
+  pthread_cond_broadcast(&pl->changed);
+}
+
+
+/* ACK or NAK of a well-formed acknowledge, -1 for anything else */
+static int check_ack(unsigned char *rsp)
+{
+  unsigned short crc16;
+  int i;
+
+  crc16 = INITIAL_VALUE;
+  for (i = 0; i < ACK_LEN - 2; i++)
+  {
+    crc16 = calc_crc16(crc16, rsp[i]);
+  }
+  if ((rsp[1] != 0) || (rsp[2] != 1) ||
+      (rsp[ACK_LEN - 2] != (crc16 >> 8)) ||
+      (rsp[ACK_LEN - 1] != (crc16 & 0xff)) ||
+      ((rsp[3] != ACK) && (rsp[3] != NAK)))
+  {
+    return -1;
+  }
+
+  return rsp[3];
+}
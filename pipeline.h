@@ -0,0 +1,56 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+
+/* Display frames written back to back with --pipeline: up to window frames
+   are on their way before the first acknowledge is read. The acknowledges
+   are read and checked by a thread of their own. */
+
+#define MAX_WINDOW (8)
+
+typedef struct {
+  SERHDL          hdl;
+  int             async;        /* acknowledges are read by the reader */
+  pthread_t       reader;
+  pthread_mutex_t lock;
+  pthread_cond_t  changed;      /* an acknowledge has come or is missing */
+  long long       sent_us[MAX_WINDOW];  /* of the frames not answered */
+  long long       due_us[MAX_WINDOW];   /* their answers, at the earliest */
+  int             oldest;
+  int             outstanding;
+  int             window;       /* 1: stop-and-wait */
+  int             answers;      /* of the current block of answers */
+  int             errors;       /* NAKs and missing ones among them */
+  long long       heard_us;     /* last answer, or first frame after idle */
+  int             lost;         /* missing acknowledges since the last one */
+  int             late;         /* frames given up on, answer may still come */
+  long long       late_until_us;
+  int             late_rc;      /* the answer last taken as a late one,
+                                   0: none or all frames answered since */
+  int             failed;       /* nothing heard for MAX_SILENCE_US, or the
+                                   port cannot be read */
+  int             stop;
+  long            sent;
+  long            acked;
+  long            naks;
+  long            missing;
+  long            dropped;      /* answers of frames given up on */
+  long            bad;          /* bytes that are not an acknowledge */
+  long            throttles;
+} PIPELINE;
+
+#if PIPELINE_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int open_pipeline(SERHDL hdl, PIPELINE *pl);
+EXTERN int send_display(PIPELINE *pl, unsigned char *pattern);
+EXTERN int send_display_frame(PIPELINE *pl, unsigned char *frame, int len);
+EXTERN void close_pipeline(PIPELINE *pl);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <pattern.h>
+
+#define PNM_SRC 1
+#include <pnm.h>
+#undef PNM_SRC
+
+/* Netpbm images: bitmaps P1 (plain) and P4 (raw), greyscale P2 and P5
+   with a maxval of up to 65535, of any size, one after the other in the
+   same file. A set bit of a bitmap and a grey of maxval are fully on.
+
+   An image is read pixel by pixel into the 64 cells of the pattern, so
+   neither the size of an image nor the number of images takes memory. */
+
+#define MAX_MAXVAL (65535)
+#define MAX_SIZE   (1 << 20)
+
+typedef struct {
+  int bitmap;
+  int plain;
+  int width;
+  int height;
+  int maxval;
+  int bits;             /* the current byte of a raw bitmap line */
+} PNM_IMAGE;
+
+static int read_header(FILE *handle, PNM_IMAGE *image);
+static int read_number(FILE *handle, int max, int *value);
+static int read_sample(FILE *handle, PNM_IMAGE *image, int x, int *value);
+static void get_cells(int x, int size, int fit, int *first, int *end);
+
+
+/* a file that starts like a Netpbm image of the kinds read here */
+int is_pnm(char *path)
+{
+  FILE *handle;
+  unsigned char magic[2];
+  int rc;
+
+  if ((handle = fopen(path, "rb")) == NULL)
+  {
+    return 0;
+  }
+  rc = (fread(magic, sizeof(magic), 1, handle) == 1) &&
+       (magic[0] == 'P') && (magic[1] != '\0') &&
+       (strchr("1245", magic[1]) != NULL);
+  fclose(handle);
+
+  return rc;
+}
+
+
+int open_pnm(char *path, FILE **handle)
+{
+  int rc;
+
+  if ((*handle = fopen(path, "rb")) == NULL)
+  {
+    rc = RET_PNM_ERR_OPEN;
+    goto EXIT;
+  }
+
+  rc = RET_PNM_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* the next image of the file brought to 8x8 as fit says, RET_PNM_END if
+   there is none */
+int read_pnm(FILE *handle, int fit, unsigned char *grey)
+{
+  int rc;
+  PNM_IMAGE image;
+  long long sum[PIXELS_PER_PATTERN];
+  long long count[PIXELS_PER_PATTERN];
+  int value;
+  int firstx;
+  int endx;
+  int firsty;
+  int endy;
+  int x;
+  int y;
+  int i;
+  int j;
+
+  if ((rc = read_header(handle, &image)) != RET_PNM_OK)
+  {
+    goto EXIT;
+  }
+
+  memset(sum, 0, sizeof(sum));
+  memset(count, 0, sizeof(count));
+
+  /* the raster goes line by line from the top */
+  for (y = 0; y < image.height; y++)
+  {
+    get_cells(y, image.height, fit, &firsty, &endy);
+    for (x = 0; x < image.width; x++)
+    {
+      if ((rc = read_sample(handle, &image, x, &value)) != RET_PNM_OK)
+      {
+        goto EXIT;
+      }
+      get_cells(x, image.width, fit, &firstx, &endx);
+      for (i = firstx; i < endx; i++)
+      {
+        for (j = firsty; j < endy; j++)
+        {
+          sum[LINES_PER_PATTERN * i + j] += value;
+          count[LINES_PER_PATTERN * i + j]++;
+        }
+      }
+    }
+  }
+
+  /* a cell no pixel falls into when cropping is off */
+  for (i = 0; i < PIXELS_PER_PATTERN; i++)
+  {
+    count[i] *= image.maxval;
+    grey[i] = (count[i] > 0) ? (sum[i] * 255 + count[i] / 2) / count[i] : 0;
+  }
+
+  rc = RET_PNM_OK;
+
+EXIT:
+  return rc;
+}
+
+
+void threshold_pnm(unsigned char *grey, int cutoff, unsigned char *pattern)
+{
+  int i;
+
+  memset(pattern, 0, LINES_PER_PATTERN);
+  for (i = 0; i < PIXELS_PER_PATTERN; i++)
+  {
+    if (grey[i] >= cutoff)
+    {
+      pattern[i / LINES_PER_PATTERN] |= 1 << (i % LINES_PER_PATTERN);
+    }
+  }
+}
+
+
+int close_pnm(FILE *handle)
+{
+  return (fclose(handle) == 0) ? RET_PNM_OK : RET_PNM_ERR_OPEN;
+}
+
+
+static int read_header(FILE *handle, PNM_IMAGE *image)
+{
+  int c;
+
+  /* whitespace between two images is allowed */
+  while (((c = getc(handle)) != EOF) && isspace(c))
+    ;
+  if (c == EOF)
+  {
+    return RET_PNM_END;
+  }
+  if ((c != 'P') || ((c = getc(handle)) == EOF) || (c == '\0') ||
+      (strchr("1245", c) == NULL))
+  {
+    return RET_PNM_ERR_FORMAT;
+  }
+  image->bitmap = (c == '1') || (c == '4');
+  image->plain = (c == '1') || (c == '2');
+
+  image->maxval = 1;
+  if ((read_number(handle, MAX_SIZE, &image->width) != RET_PNM_OK) ||
+      (read_number(handle, MAX_SIZE, &image->height) != RET_PNM_OK) ||
+      (!image->bitmap &&
+       (read_number(handle, MAX_MAXVAL, &image->maxval) != RET_PNM_OK)) ||
+      (image->width == 0) || (image->height == 0) || (image->maxval == 0))
+  {
+    return RET_PNM_ERR_FORMAT;
+  }
+
+  /* one whitespace character ends the header of a raw image */
+  if (!image->plain && !isspace(getc(handle)))
+  {
+    return RET_PNM_ERR_FORMAT;
+  }
+
+  return RET_PNM_OK;
+}
+
+
+/* a decimal number of the header, after whitespace and comments */
+static int read_number(FILE *handle, int max, int *value)
+{
+  int c;
+
+  while (((c = getc(handle)) != EOF) && (isspace(c) || (c == '#')))
+  {
+    if (c == '#')
+    {
+      while (((c = getc(handle)) != EOF) && (c != '\n'))
+        ;
+    }
+  }
+  if ((c == EOF) || !isdigit(c))
+  {
+    return RET_PNM_ERR_FORMAT;
+  }
+
+  *value = 0;
+  while ((c != EOF) && isdigit(c))
+  {
+    *value = *value * 10 + (c - '0');
+    if (*value > max)
+    {
+      return RET_PNM_ERR_FORMAT;
+    }
+    c = getc(handle);
+  }
+  ungetc(c, handle);
+
+  return RET_PNM_OK;
+}
+
+
+/* pixel x of the current line */
+static int read_sample(FILE *handle, PNM_IMAGE *image, int x, int *value)
+{
+  int hi;
+  int lo;
+  int c;
+
+  if (image->bitmap && image->plain)
+  {
+    while (((c = getc(handle)) != EOF) && isspace(c))
+      ;
+    if ((c != '0') && (c != '1'))
+    {
+      return RET_PNM_ERR_FORMAT;
+    }
+    *value = c - '0';
+  }
+  else if (image->bitmap)
+  {
+    /* 8 pixels per byte from the high bit, each line starts a byte */
+    if ((x % 8 == 0) && ((image->bits = getc(handle)) == EOF))
+    {
+      return RET_PNM_ERR_FORMAT;
+    }
+    *value = (image->bits >> (7 - x % 8)) & 1;
+  }
+  else if (image->plain)
+  {
+    if (read_number(handle, image->maxval, value) != RET_PNM_OK)
+    {
+      return RET_PNM_ERR_FORMAT;
+    }
+  }
+  else if (image->maxval > 255)
+  {
+    if (((hi = getc(handle)) == EOF) || ((lo = getc(handle)) == EOF))
+    {
+      return RET_PNM_ERR_FORMAT;
+    }
+    *value = (hi << 8) | lo;
+  }
+  else
+  {
+    if ((*value = getc(handle)) == EOF)
+    {
+      return RET_PNM_ERR_FORMAT;
+    }
+  }
+
+  return (*value <= image->maxval) ? RET_PNM_OK : RET_PNM_ERR_FORMAT;
+}
+
+
+/* the cells first to end - 1 of the pattern that pixel x of an image of
+   size pixels falls into, along one axis */
+static void get_cells(int x, int size, int fit, int *first, int *end)
+{
+  int cell;
+
+  if (fit == PNM_CROP)
+  {
+    cell = x - (size - COLUMNS_PER_PATTERN) / 2;
+    *first = cell;
+    *end = cell + 1;
+    if ((cell < 0) || (cell >= COLUMNS_PER_PATTERN))
+    {
+      *end = *first;
+    }
+  }
+  else if (size >= COLUMNS_PER_PATTERN)
+  {
+    /* shrinking: each pixel is part of the average of one cell */
+    *first = x * COLUMNS_PER_PATTERN / size;
+    *end = *first + 1;
+  }
+  else
+  {
+    /* growing: each cell takes the pixel its left edge is in */
+    *first = (x * COLUMNS_PER_PATTERN + size - 1) / size;
+    *end = ((x + 1) * COLUMNS_PER_PATTERN + size - 1) / size;
+  }
+}
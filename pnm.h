@@ -0,0 +1,36 @@
+#ifndef PNM_H
+#define PNM_H
+
+#define RET_PNM_OK         (0)
+#define RET_PNM_ERR_OPEN   (1)
+#define RET_PNM_ERR_FORMAT (2)
+#define RET_PNM_END        (3)
+
+/* A greyscale image of one pattern: grey[8 * x + y] is pixel (x, y),
+   column x from the left, line y from the top, as the bits of a pattern.
+   0 is off, 255 fully on. */
+#define PIXELS_PER_PATTERN (64)
+
+/* how an image of another size is brought to 8x8 */
+#define PNM_SCALE (0)     /* averaged over the pixels of each cell */
+#define PNM_CROP  (1)     /* the 8x8 pixels in the middle */
+
+/* the grey level from which a pixel is on */
+#define DEFAULT_CUTOFF (128)
+
+#if PNM_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int is_pnm(char *path);
+EXTERN int open_pnm(char *path, FILE **handle);
+EXTERN int read_pnm(FILE *handle, int fit, unsigned char *grey);
+EXTERN void threshold_pnm(unsigned char *grey, int cutoff,
+                          unsigned char *pattern);
+EXTERN int close_pnm(FILE *handle);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if LINUX
+#  include <fcntl.h>
+#  include <errno.h>
+#  include <signal.h>
+#  include <unistd.h>
+#  include <sys/file.h>
+#  include <sys/stat.h>
+#endif
+
+#include <clock.h>
+#include <probes.h>
+
+#define PORTLOCK_SRC 1
+#include <portlock.h>
+#undef PORTLOCK_SRC
+
+/* Invocations that use the same device queue in a lock file per device,
+   $MMM8X8_LOCK/mmm8x8_<device path>.lock, the path of the device resolved
+   so that links to it share the queue. Without $MMM8X8_LOCK the files are
+   in /tmp/mmm8x8-<uid>, a directory only the user may enter; users that
+   share devices set $MMM8X8_LOCK to a directory of their group:
+     acquired <n> waited <n> wait_us <n> max_wait_us <n> max_depth <n>
+       timeouts <n>                                  (one line)
+     <pid> <seq>                                     (one per invocation)
+   An invocation appends itself and owns the device while it is the first
+   entry, so the device goes to the invocations in the order they came.
+   The file is only changed under flock, entries of processes that are
+   gone are dropped by whoever reads the queue next.
+
+   On Windows a COM port can only be opened once anyway, the lock does
+   nothing there. */
+
+#define LOCK_POLL_US (10000)
+#define MAX_QUEUE    (64)
+#define MAX_LOCKFILE (256 + MAX_QUEUE * 32)
+
+#define QUEUE_ENTER   (0)
+#define QUEUE_POLL    (1)
+#define QUEUE_LEAVE   (2)
+#define QUEUE_TIMEOUT (3)
+
+typedef struct {
+  long long acquired;     /* locks taken */
+  long long waited;       /* of those, locks that had to queue */
+  long long wait_us;      /* total time waited */
+  long long max_wait_us;
+  int       max_depth;    /* most invocations ahead of one */
+  long long timeouts;     /* invocations that gave up */
+  int       nentries;
+  int       pid[MAX_QUEUE];
+  unsigned  seq[MAX_QUEUE];
+} LOCKQUEUE;
+
+PROBE_SEMAPHORE(lock_wait);
+
+#if LINUX
+
+static unsigned lock_seq;
+
+static int get_lockdir(char *dir, int len);
+static int update_queue(PORTLOCK *lock, int op, int *position);
+static void read_queue(int fd, LOCKQUEUE *queue);
+static int write_queue(int fd, LOCKQUEUE *queue);
+
+
+/* waits until device is ours, at most wait_s seconds (0: the default,
+   < 0: not at all) */
+int lock_port(char *device, int wait_s, PORTLOCK *lock)
+{
+  int rc;
+  char path[PATH_MAX];
+  long long start;
+  long long deadline;
+  int position;
+
+  start = get_time_us();
+  if (wait_s == 0)
+  {
+    wait_s = DEFAULT_LOCK_WAIT_S;
+  }
+  deadline = start + ((wait_s > 0) ? wait_s : 0) * 1000000LL;
+
+  lock->pid = getpid();
+  lock->seq = __sync_fetch_and_add(&lock_seq, 1);
+  lock->wait_us = 0;
+
+  if ((get_lockfile(device, path, sizeof(path)) != RET_PORTLOCK_OK) ||
+      ((lock->fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+                        0660)) == -1))
+  {
+    lock->fd = -1;
+    rc = RET_PORTLOCK_ERR_OPEN;
+    goto EXIT;
+  }
+  /* the group of the lock directory must be able to queue in it too,
+     whatever our umask is */
+  fchmod(lock->fd, 0660);
+
+  if ((rc = update_queue(lock, QUEUE_ENTER, &position)) != RET_PORTLOCK_OK)
+  {
+    goto CLOSE_EXIT;
+  }
+  lock->depth = position;
+
+  while (position > 0)
+  {
+    if (get_time_us() >= deadline)
+    {
+      update_queue(lock, QUEUE_TIMEOUT, &position);
+      rc = RET_PORTLOCK_BUSY;
+      goto CLOSE_EXIT;
+    }
+    sleep_us(LOCK_POLL_US);
+    lock->wait_us = get_time_us() - start;
+    if ((rc = update_queue(lock, QUEUE_POLL, &position)) != RET_PORTLOCK_OK)
+    {
+      goto CLOSE_EXIT;
+    }
+  }
+
+  PROBE3(lock_wait, device, lock->wait_us, lock->depth);
+  rc = RET_PORTLOCK_OK;
+  goto EXIT;
+
+CLOSE_EXIT:
+  close(lock->fd);
+  lock->fd = -1;
+
+EXIT:
+  return rc;
+}
+
+
+void unlock_port(PORTLOCK *lock)
+{
+  int position;
+
+  if (lock->fd == -1)
+  {
+    return;
+  }
+
+  update_queue(lock, QUEUE_LEAVE, &position);
+  close(lock->fd);
+  lock->fd = -1;
+}
+
+
+/* lockstat <device>: what the queue of device has seen so far */
+int print_lockstat(int myargc, char **myargv)
+{
+  int rc;
+  char path[PATH_MAX];
+  LOCKQUEUE queue;
+  int fd;
+  int i;
+
+  if ((get_lockfile(myargv[0], path, sizeof(path)) != RET_PORTLOCK_OK) ||
+      ((fd = open(path, O_RDWR | O_NOFOLLOW)) == -1))
+  {
+    fprintf(stderr, "%s has never been locked.\n", myargv[0]);
+    rc = RET_PORTLOCK_ERR_OPEN;
+    goto EXIT;
+  }
+
+  flock(fd, LOCK_EX);
+  read_queue(fd, &queue);
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  printf("%s: %lld locks, %lld had to wait, %lld timeouts\n", myargv[0],
+         queue.acquired, queue.waited, queue.timeouts);
+  if (queue.waited > 0)
+  {
+    printf("wait: avg %lld ms, max %lld ms, at most %d ahead\n",
+           queue.wait_us / queue.waited / 1000, queue.max_wait_us / 1000,
+           queue.max_depth);
+  }
+  for (i = 0; i < queue.nentries; i++)
+  {
+    printf("%s pid %d\n", (i == 0) ? "owner  " : "waiting", queue.pid[i]);
+  }
+
+  rc = RET_PORTLOCK_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* the lock file of device, links to a device share the lock file */
+int get_lockfile(char *device, char *path, int len)
+{
+  char resolved[PATH_MAX];
+  char dir[PATH_MAX];
+  char *name;
+  char *pos;
+
+  if (realpath(device, resolved) != NULL)
+  {
+    name = resolved;
+  }
+  else
+  {
+    name = device;
+  }
+  if (name[0] == '/')
+  {
+    name++;
+  }
+
+  if (get_lockdir(dir, sizeof(dir)) != RET_PORTLOCK_OK)
+  {
+    return RET_PORTLOCK_ERR_OPEN;
+  }
+
+  if (snprintf(path, len, "%s/mmm8x8_%s.lock", dir, name) >= len)
+  {
+    return RET_PORTLOCK_ERR_OPEN;
+  }
+
+  for (pos = path + strlen(dir) + 1; *pos != '\0'; pos++)
+  {
+    if (*pos == '/')
+    {
+      *pos = '_';
+    }
+  }
+
+  return RET_PORTLOCK_OK;
+}
+
+
+/* $MMM8X8_LOCK, or a directory of the user's own in /tmp, which must not
+   be one that somebody else has put there */
+static int get_lockdir(char *dir, int len)
+{
+  struct stat st;
+  char *env;
+
+  if ((env = getenv("MMM8X8_LOCK")) != NULL)
+  {
+    if (snprintf(dir, len, "%s", env) >= len)
+    {
+      return RET_PORTLOCK_ERR_OPEN;
+    }
+    return RET_PORTLOCK_OK;
+  }
+
+  if ((snprintf(dir, len, "/tmp/mmm8x8-%d", (int) getuid()) >= len) ||
+      ((mkdir(dir, 0700) == -1) && (errno != EEXIST)))
+  {
+    return RET_PORTLOCK_ERR_OPEN;
+  }
+  if ((lstat(dir, &st) == -1) || !S_ISDIR(st.st_mode) ||
+      (st.st_uid != getuid()) || ((st.st_mode & 077) != 0))
+  {
+    fprintf(stderr, "%s is not a directory of our own.\n", dir);
+    return RET_PORTLOCK_ERR_OPEN;
+  }
+
+  return RET_PORTLOCK_OK;
+}
+
+
+/* one change of the queue under flock, position is the number of
+   entries ahead of lock afterwards */
+static int update_queue(PORTLOCK *lock, int op, int *position)
+{
+  int rc;
+  LOCKQUEUE queue;
+  int i;
+
+  if (flock(lock->fd, LOCK_EX) == -1)
+  {
+    rc = RET_PORTLOCK_ERR_OPEN;
+    goto EXIT;
+  }
+
+  read_queue(lock->fd, &queue);
+
+  for (i = 0; i < queue.nentries; i++)
+  {
+    if ((queue.pid[i] == lock->pid) && (queue.seq[i] == lock->seq))
+    {
+      break;
+    }
+  }
+  *position = i;
+
+  switch (op)
+  {
+    case QUEUE_ENTER:
+      if (queue.nentries == MAX_QUEUE)
+      {
+        rc = RET_PORTLOCK_BUSY;
+        goto UNLOCK_EXIT;
+      }
+      queue.pid[queue.nentries] = lock->pid;
+      queue.seq[queue.nentries] = lock->seq;
+      queue.nentries++;
+      break;
+
+    case QUEUE_TIMEOUT:
+      queue.timeouts++;
+      /* fall through */
+    case QUEUE_LEAVE:
+      if (i < queue.nentries)
+      {
+        memmove(&queue.pid[i], &queue.pid[i + 1],
+                (queue.nentries - i - 1) * sizeof(queue.pid[0]));
+        memmove(&queue.seq[i], &queue.seq[i + 1],
+                (queue.nentries - i - 1) * sizeof(queue.seq[0]));
+        queue.nentries--;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  /* the device has just become ours, after a wait if it is a poll */
+  if (((op == QUEUE_ENTER) || (op == QUEUE_POLL)) && (*position == 0))
+  {
+    queue.acquired++;
+    if (op == QUEUE_POLL)
+    {
+      queue.waited++;
+      queue.wait_us += lock->wait_us;
+      if (lock->wait_us > queue.max_wait_us)
+      {
+        queue.max_wait_us = lock->wait_us;
+      }
+    }
+  }
+  if ((op == QUEUE_ENTER) && (*position > queue.max_depth))
+  {
+    queue.max_depth = *position;
+  }
+
+  if (write_queue(lock->fd, &queue) != RET_PORTLOCK_OK)
+  {
+    rc = RET_PORTLOCK_ERR_OPEN;
+    goto UNLOCK_EXIT;
+  }
+
+  rc = RET_PORTLOCK_OK;
+
+UNLOCK_EXIT:
+  flock(lock->fd, LOCK_UN);
+
+EXIT:
+  return rc;
+}
+
+
+/* the queue without the entries of processes that have ended */
+static void read_queue(int fd, LOCKQUEUE *queue)
+{
+  char buf[MAX_LOCKFILE + 1];
+  char *line;
+  char *save;
+  int len;
+  int pid;
+  unsigned seq;
+
+  memset(queue, 0, sizeof(*queue));
+
+  if ((len = pread(fd, buf, MAX_LOCKFILE, 0)) <= 0)
+  {
+    return;
+  }
+  buf[len] = '\0';
+
+  if ((line = strtok_r(buf, "\n", &save)) == NULL)
+  {
+    return;
+  }
+  sscanf(line, "acquired %lld waited %lld wait_us %lld max_wait_us %lld "
+               "max_depth %d timeouts %lld", &queue->acquired,
+         &queue->waited, &queue->wait_us, &queue->max_wait_us,
+         &queue->max_depth, &queue->timeouts);
+
+  while (((line = strtok_r(NULL, "\n", &save)) != NULL) &&
+         (queue->nentries < MAX_QUEUE))
+  {
+    if ((sscanf(line, "%d %u", &pid, &seq) != 2) ||
+        ((kill(pid, 0) == -1) && (errno == ESRCH)))
+    {
+      continue;
+    }
+    queue->pid[queue->nentries] = pid;
+    queue->seq[queue->nentries] = seq;
+    queue->nentries++;
+  }
+}
+
+
+static int write_queue(int fd, LOCKQUEUE *queue)
+{
+  char buf[MAX_LOCKFILE];
+  int len;
+  int i;
+
+  len = snprintf(buf, sizeof(buf), "acquired %lld waited %lld wait_us %lld "
+                 "max_wait_us %lld max_depth %d timeouts %lld\n",
+                 queue->acquired, queue->waited, queue->wait_us,
+                 queue->max_wait_us, queue->max_depth, queue->timeouts);
+  for (i = 0; i < queue->nentries; i++)
+  {
+    len += snprintf(buf + len, sizeof(buf) - len, "%d %u\n", queue->pid[i],
+                    queue->seq[i]);
+  }
+
+  if ((pwrite(fd, buf, len, 0) != len) || (ftruncate(fd, len) == -1))
+  {
+    return RET_PORTLOCK_ERR_OPEN;
+  }
+
+  return RET_PORTLOCK_OK;
+}
+
+#endif
+
+#if WIN
+
+int lock_port(char *device, int wait_s, PORTLOCK *lock)
+{
+  lock->fd = -1;
+  lock->depth = 0;
+  lock->wait_us = 0;
+
+  return RET_PORTLOCK_OK;
+}
+
+
+void unlock_port(PORTLOCK *lock)
+{
+}
+
+
+int print_lockstat(int myargc, char **myargv)
+{
+  fprintf(stderr, "COM ports are not queued for on Windows.\n");
+
+  return RET_PORTLOCK_ERR_OPEN;
+}
+
+
+/* there are no lock files, the name of a COM port is all there is */
+int get_lockfile(char *device, char *path, int len)
+{
+  if (snprintf(path, len, "%s", device) >= len)
+  {
+    return RET_PORTLOCK_ERR_OPEN;
+  }
+
+  return RET_PORTLOCK_OK;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef PORTLOCK_H
+#define PORTLOCK_H
+
+#define RET_PORTLOCK_OK       (0)
+#define RET_PORTLOCK_ERR_OPEN (1)
+#define RET_PORTLOCK_BUSY     (2)   /* the wait deadline has passed */
+
+#define DEFAULT_LOCK_WAIT_S (60)
+
+/* the place of one invocation in the queue of a device */
+typedef struct {
+  int      fd;          /* the lock file, -1 if not locked */
+  int      pid;
+  unsigned seq;         /* tells the locks of one process apart */
+  int      depth;       /* invocations ahead when it has queued */
+  long long wait_us;    /* time until the device was ours */
+} PORTLOCK;
+
+#if PORTLOCK_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int lock_port(char *device, int wait_s, PORTLOCK *lock);
+EXTERN void unlock_port(PORTLOCK *lock);
+EXTERN int print_lockstat(int myargc, char **myargv);
+EXTERN int get_lockfile(char *device, char *path, int len);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/* USDT probes of the provider mmm8x8 for perf, bpftrace and SystemTap.
+
+   Built with SDT=SDT=1 in the Makefile (needs <sys/sdt.h>, e.g. from
+   systemtap-sdt-dev) a probe is a single nop in the code and a note in
+   the ELF file that names it and its arguments. A tracer attached to a
+   probe increments its semaphore, arguments that cost something to
+   compute are only computed while PROBE_ENABLED(name). Without SDT the
+   probes are left out completely.
+
+   Every probe needs PROBE_SEMAPHORE(name); at file scope of the source
+   that fires it. The probes are listed in the README. */
+
+#if SDT && LINUX
+
+#  define _SDT_HAS_SEMAPHORES 1
+#  include <sys/sdt.h>
+
+#  define PROBE_SEMAPHORE(name) \
+     unsigned short mmm8x8_##name##_semaphore \
+       __attribute__((section(".probes"), used))
+#  define PROBE_ENABLED(name) \
+     __builtin_expect(mmm8x8_##name##_semaphore != 0, 0)
+
+#  define PROBE1(name, a1) \
+     DTRACE_PROBE1(mmm8x8, name, a1)
+#  define PROBE2(name, a1, a2) \
+     DTRACE_PROBE2(mmm8x8, name, a1, a2)
+#  define PROBE3(name, a1, a2, a3) \
+     DTRACE_PROBE3(mmm8x8, name, a1, a2, a3)
+
+#else
+
+#  define PROBE_SEMAPHORE(name) \
+     extern unsigned short mmm8x8_##name##_semaphore
+#  define PROBE_ENABLED(name) (0)
+
+/* the arguments are not evaluated, only kept from being unused */
+#  define PROBE1(name, a1) \
+     do { (void) sizeof(a1); } while (0)
+#  define PROBE2(name, a1, a2) \
+     do { (void) sizeof(a1); (void) sizeof(a2); } while (0)
+#  define PROBE3(name, a1, a2, a3) \
+     do { (void) sizeof(a1); (void) sizeof(a2); (void) sizeof(a3); } while (0)
+
+#endif
+
+#endif
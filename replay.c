@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <wire.h>
+#include <clock.h>
+#include <tracedec.h>
+#include <emulator.h>
+
+#define REPLAY_SRC 1
+#include <replay.h>
+#undef REPLAY_SRC
+
+/* Replay sends the commands of a trace again, every device of the trace
+   gets an emulated module of its own and a thread that sends its commands
+   in their order. By default a command is sent at the time it was sent in
+   the trace, with --fast as soon as the response to the one before is in.
+   A command is waited for the response the module gives to it, also if
+   the trace has none, so the next response is not taken for its own.
+
+   The average latency of every command and the throughput of all
+   commands are compared with the trace. A latency longer by more than
+   --threshold percent (default 20) and REPLAY_SLACK_US, or a throughput
+   lower by more than --threshold percent, is a regression. The emulated
+   modules answer after the time the command and the answer take on the
+   wire at 38400 baud, so the latencies can be compared with a trace of
+   real modules. Their processing time is not emulated. */
+
+#define RET_REPLAY_OK         (0)
+#define RET_REPLAY_ERR_READ   (1)
+#define RET_REPLAY_ERR_OPEN   (2)
+#define RET_REPLAY_REGRESSION (3)
+
+#define DEFAULT_THRESHOLD (20)
+#define REPLAY_SLACK_US   (1000)
+
+#define CMD_DISPLAY_RSP_LEN (6)
+#define CMD_VERSION_RSP_LEN (12)
+
+typedef struct {
+  int            port;
+  long long      offset_us;     /* sent, from the first command of the trace */
+  unsigned char  command;
+  unsigned char *params;
+  int            nparam;
+  int            rsplen;        /* of the response in the trace, 0: none */
+  int            nak;
+  long long      recorded_us;   /* latency in the trace, -1: no response */
+  long long      sent_us;       /* in the replay */
+  long long      replayed_us;   /* latency in the replay, -1: no response */
+  int            differs;       /* other response than in the trace */
+} REPLAYED;
+
+typedef struct replay REPLAY;
+
+typedef struct {
+  char      *device;            /* in the trace */
+  SERHDL     hdl;
+  int        count;             /* commands of the port */
+  int        failed;            /* commands without the expected response */
+  pthread_t  thread;
+  REPLAY    *replay;
+  int        index;
+} REPLAY_PORT;
+
+struct replay {
+  REPLAYED    *replayed;
+  int          nreplayed;
+  int          size;
+  REPLAY_PORT  ports[MAX_EMULATED_PORTS];
+  int          nports;
+  long long    first_us;
+  long long    start_us;
+  int          error;
+};
+
+/* latencies of one command */
+typedef struct {
+  int       recorded;
+  long long recorded_us;
+  int       replayed;
+  long long replayed_us;
+} LATENCY;
+
+static void add_exchange(EXCHANGE *exchange, void *arg);
+static int run_ports(REPLAY *replay, EMULATOR *emulator);
+static void *replay_port(void *arg);
+static int expected_rsplen(REPLAYED *replayed);
+static int compare_latencies(REPLAY *replay, int threshold);
+static int compare_throughput(REPLAY *replay, int threshold);
+static void free_replay(REPLAY *replay);
+
+
+/* replay <tracefile>: plays the commands of the trace against emulated
+   modules, returns RET_REPLAY_REGRESSION if they have become slower */
+int replay_trace(int myargc, char **myargv)
+{
+  int rc;
+  REPLAY *replay;
+  EMULATOR *emulator;
+  TRACE_TOTALS totals;
+  int threshold;
+  int failed;
+  int differs;
+  int i;
+
+  if ((replay = calloc(1, sizeof(REPLAY))) == NULL)
+  {
+    rc = RET_REPLAY_ERR_READ;
+    goto EXIT;
+  }
+  replay->first_us = -1;
+
+  if ((scan_trace(myargv[0], add_exchange, replay, &totals) !=
+       RET_TRACEDEC_OK) || replay->error)
+  {
+    fprintf(stderr, "read of trace %s has failed.\n", myargv[0]);
+    rc = RET_REPLAY_ERR_READ;
+    goto FREE_EXIT;
+  }
+  if (replay->nreplayed == 0)
+  {
+    fprintf(stderr, "trace %s has no commands.\n", myargv[0]);
+    rc = RET_REPLAY_ERR_READ;
+    goto FREE_EXIT;
+  }
+  for (i = 0; i < replay->nreplayed; i++)
+  {
+    replay->replayed[i].offset_us -= replay->first_us;
+  }
+
+  if (start_emulator(replay->nports, &emulator) != RET_EMULATOR_OK)
+  {
+    fprintf(stderr, "start of %d emulated modules has failed.\n",
+            replay->nports);
+    rc = RET_REPLAY_ERR_OPEN;
+    goto FREE_EXIT;
+  }
+  emulator->wire_time = 1;
+
+  rc = run_ports(replay, emulator);
+  stop_emulator(emulator);
+  if (rc != RET_REPLAY_OK)
+  {
+    goto FREE_EXIT;
+  }
+
+  failed = 0;
+  for (i = 0; i < replay->nports; i++)
+  {
+    failed += replay->ports[i].failed;
+  }
+  differs = 0;
+  for (i = 0; i < replay->nreplayed; i++)
+  {
+    differs += replay->replayed[i].differs;
+  }
+  printf("%d commands to %d devices %s, %d without response, "
+         "%d answered other than in the trace\n", replay->nreplayed,
+         replay->nports, cmd_options.fast ? "as fast as possible" :
+                                            "at their times",
+         failed, differs);
+
+  threshold = (cmd_options.threshold > 0) ? cmd_options.threshold :
+                                            DEFAULT_THRESHOLD;
+  rc = RET_REPLAY_OK;
+  if (compare_latencies(replay, threshold) != RET_REPLAY_OK)
+  {
+    rc = RET_REPLAY_REGRESSION;
+  }
+  if (compare_throughput(replay, threshold) != RET_REPLAY_OK)
+  {
+    rc = RET_REPLAY_REGRESSION;
+  }
+  if (failed > 0)
+  {
+    rc = RET_REPLAY_REGRESSION;
+  }
+
+FREE_EXIT:
+  free_replay(replay);
+
+EXIT:
+  return rc;
+}
+
+
+/* collects the commands of the trace, one port per device */
+static void add_exchange(EXCHANGE *exchange, void *arg)
+{
+  REPLAY *replay;
+  REPLAYED *replayed;
+  int port;
+
+  replay = arg;
+  if (replay->error)
+  {
+    return;
+  }
+  if ((replay->first_us < 0) || (exchange->sent_us < replay->first_us))
+  {
+    replay->first_us = exchange->sent_us;
+  }
+
+  for (port = 0; port < replay->nports; port++)
+  {
+    if (strcmp(replay->ports[port].device, exchange->device) == 0)
+    {
+      break;
+    }
+  }
+  if (port == replay->nports)
+  {
+    if ((port == MAX_EMULATED_PORTS) ||
+        ((replay->ports[port].device = strdup(exchange->device)) == NULL))
+    {
+      replay->error = 1;
+      return;
+    }
+    replay->nports++;
+  }
+
+  if (replay->nreplayed == replay->size)
+  {
+    replay->size = (replay->size == 0) ? 1024 : 2 * replay->size;
+    if ((replayed = realloc(replay->replayed,
+                            replay->size * sizeof(REPLAYED))) == NULL)
+    {
+      replay->error = 1;
+      return;
+    }
+    replay->replayed = replayed;
+  }
+
+  replayed = &replay->replayed[replay->nreplayed];
+  memset(replayed, 0, sizeof(REPLAYED));
+  if ((exchange->nparam > 0) &&
+      ((replayed->params = malloc(exchange->nparam)) == NULL))
+  {
+    replay->error = 1;
+    return;
+  }
+  replay->nreplayed++;
+
+  replayed->port = port;
+  replayed->offset_us = exchange->sent_us;
+  replayed->command = exchange->command;
+  memcpy(replayed->params, exchange->params, exchange->nparam);
+  replayed->nparam = exchange->nparam;
+  replayed->rsplen = (exchange->latency_us >= 0) ? exchange->rsplen : 0;
+  replayed->nak = (replayed->rsplen >= 4) && (exchange->response[3] == NAK);
+  replayed->recorded_us = exchange->latency_us;
+  replayed->replayed_us = -1;
+  replay->ports[port].count++;
+}
+
+
+/* one thread per port, all start at the same time */
+static int run_ports(REPLAY *replay, EMULATOR *emulator)
+{
+  int rc;
+  REPLAY_PORT *port;
+  int i;
+
+  for (i = 0; i < replay->nports; i++)
+  {
+    port = &replay->ports[i];
+    if (open_serial(emulator->ports[i].path, &port->hdl) != RET_SERIAL_OK)
+    {
+      fprintf(stderr, "open of device %s has failed.\n",
+              emulator->ports[i].path);
+      rc = RET_REPLAY_ERR_OPEN;
+      goto CLOSE_EXIT;
+    }
+  }
+
+  replay->start_us = get_time_us();
+  for (i = 0; i < replay->nports; i++)
+  {
+    port = &replay->ports[i];
+    port->replay = replay;
+    port->index = i;
+    pthread_create(&port->thread, NULL, replay_port, port);
+  }
+  for (i = 0; i < replay->nports; i++)
+  {
+    pthread_join(replay->ports[i].thread, NULL);
+  }
+
+  rc = RET_REPLAY_OK;
+
+CLOSE_EXIT:
+  while (--i >= 0)
+  {
+    close_serial(replay->ports[i].hdl);
+  }
+
+  return rc;
+}
+
+
+static void *replay_port(void *arg)
+{
+  REPLAY_PORT *port;
+  REPLAY *replay;
+  REPLAYED *replayed;
+  unsigned char response[CMD_VERSION_RSP_LEN];
+  int rsplen;
+  int i;
+
+  port = arg;
+  replay = port->replay;
+
+  for (i = 0; i < replay->nreplayed; i++)
+  {
+    replayed = &replay->replayed[i];
+    if (replayed->port != port->index)
+    {
+      continue;
+    }
+
+    if (!cmd_options.fast)
+    {
+      sleep_us(replay->start_us + replayed->offset_us - get_time_us());
+    }
+
+    if (send_command(port->hdl, replayed->command, replayed->nparam,
+                     replayed->params) != RET_COMMAND_OK)
+    {
+      port->failed++;
+      continue;
+    }
+    replayed->sent_us = get_time_us();
+
+    if ((rsplen = expected_rsplen(replayed)) == 0)
+    {
+      continue;
+    }
+    if (read_serial(port->hdl, response, rsplen) != rsplen)
+    {
+      port->failed++;
+      continue;
+    }
+    replayed->replayed_us = get_time_us() - replayed->sent_us;
+    replayed->differs = (replayed->rsplen > 0) &&
+                        (replayed->nak != (response[3] == NAK));
+  }
+
+  return NULL;
+}
+
+
+/* the response the module gives, the one of the trace if there is one */
+static int expected_rsplen(REPLAYED *replayed)
+{
+  if ((replayed->rsplen == CMD_DISPLAY_RSP_LEN) ||
+      (replayed->rsplen == CMD_VERSION_RSP_LEN))
+  {
+    return replayed->rsplen;
+  }
+
+  switch (replayed->command)
+  {
+  case 'X':
+    return 0;
+
+  case 'v':
+    return CMD_VERSION_RSP_LEN;
+
+  default:
+    return CMD_DISPLAY_RSP_LEN;
+  }
+}
+
+
+/* average latency per command, of the commands answered in both */
+static int compare_latencies(REPLAY *replay, int threshold)
+{
+  int rc;
+  LATENCY latencies[256];
+  LATENCY *latency;
+  REPLAYED *replayed;
+  long long recorded;
+  long long replayed_us;
+  int i;
+
+  memset(latencies, 0, sizeof(latencies));
+  for (i = 0; i < replay->nreplayed; i++)
+  {
+    replayed = &replay->replayed[i];
+    if ((replayed->recorded_us < 0) || (replayed->replayed_us < 0))
+    {
+      continue;
+    }
+    latency = &latencies[replayed->command];
+    latency->recorded++;
+    latency->recorded_us += replayed->recorded_us;
+    latency->replayed++;
+    latency->replayed_us += replayed->replayed_us;
+  }
+
+  rc = RET_REPLAY_OK;
+  printf("cmd  count  recorded ms  replayed ms   change\n");
+  for (i = 0; i < 256; i++)
+  {
+    latency = &latencies[i];
+    if (latency->recorded == 0)
+    {
+      continue;
+    }
+    recorded = latency->recorded_us / latency->recorded;
+    replayed_us = latency->replayed_us / latency->replayed;
+    printf(" %c  %6d  %11.3f  %11.3f  %+6.1f%%", isprint(i) ? i : '?',
+           latency->recorded, recorded / 1e3, replayed_us / 1e3,
+           (recorded > 0) ? 100.0 * (replayed_us - recorded) / recorded : 0.0);
+    if ((replayed_us - recorded > REPLAY_SLACK_US) &&
+        (100 * (replayed_us - recorded) > threshold * recorded))
+    {
+      printf("  regression");
+      rc = RET_REPLAY_REGRESSION;
+    }
+    printf("\n");
+  }
+
+  return rc;
+}
+
+
+/* commands per second from the first sent to the last done */
+static int compare_throughput(REPLAY *replay, int threshold)
+{
+  int rc;
+  REPLAYED *replayed;
+  long long recorded_end;
+  long long replayed_end;
+  double recorded;
+  double replayed_rate;
+  int i;
+
+  recorded_end = 0;
+  replayed_end = 0;
+  for (i = 0; i < replay->nreplayed; i++)
+  {
+    replayed = &replay->replayed[i];
+    if (replayed->offset_us + replayed->recorded_us > recorded_end)
+    {
+      recorded_end = replayed->offset_us + replayed->recorded_us;
+    }
+    if (replayed->sent_us + replayed->replayed_us - replay->start_us >
+        replayed_end)
+    {
+      replayed_end = replayed->sent_us + replayed->replayed_us -
+                     replay->start_us;
+    }
+  }
+  recorded = (recorded_end > 0) ? replay->nreplayed * 1e6 / recorded_end : 0;
+  replayed_rate = (replayed_end > 0) ?
+                  replay->nreplayed * 1e6 / replayed_end : 0;
+
+  printf("throughput: recorded %.1f commands/s, replayed %.1f commands/s, "
+         "%+.1f%%", recorded, replayed_rate,
+         (recorded > 0) ? 100.0 * (replayed_rate - recorded) / recorded : 0.0);
+
+  rc = RET_REPLAY_OK;
+  if (100 * (recorded - replayed_rate) > threshold * recorded)
+  {
+    printf("  regression");
+    rc = RET_REPLAY_REGRESSION;
+  }
+  printf("\n");
+
+  return rc;
+}
+
+
+static void free_replay(REPLAY *replay)
+{
+  int i;
+
+  for (i = 0; i < replay->nreplayed; i++)
+  {
+    free(replay->replayed[i].params);
+  }
+  free(replay->replayed);
+  for (i = 0; i < replay->nports; i++)
+  {
+    free(replay->ports[i].device);
+  }
+  free(replay);
+}
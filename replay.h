@@ -0,0 +1,14 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#if REPLAY_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int replay_trace(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <state.h>
+#include <wire.h>
+#include <pnm.h>
+
+#define SEQUENCE_SRC 1
+#include <sequence.h>
+#undef SEQUENCE_SRC
+#include <pack.h>
+#include <effect.h>
+#include <command.h>
+
+static int read_frames(FRAMESRC *src, SEQUENCE *seq);
+static int read_own_frame(FRAMESRC *src, unsigned char *pattern,
+                          unsigned char *duration);
+
+#define INITIAL_FRAMES (64)
+
+
+void init_sequence(SEQUENCE *seq)
+{
+  seq->frames = NULL;
+  seq->nframes = 0;
+  seq->maxframes = 0;
+}
+
+
+int add_frame(SEQUENCE *seq, unsigned char *pattern, unsigned char duration)
+{
+  int rc;
+  int maxframes;
+  FRAME *frames;
+
+  if (seq->nframes == seq->maxframes)
+  {
+    maxframes = seq->maxframes ? 2 * seq->maxframes : INITIAL_FRAMES;
+    frames = realloc(seq->frames, maxframes * sizeof(FRAME));
+    if (frames == NULL)
+    {
+      rc = RET_SEQUENCE_ERR_MEMORY;
+      goto EXIT;
+    }
+    seq->frames = frames;
+    seq->maxframes = maxframes;
+  }
+
+  memcpy(seq->frames[seq->nframes].pattern, pattern, LINES_PER_PATTERN);
+  seq->frames[seq->nframes].duration = duration;
+  seq->nframes++;
+
+  rc = RET_SEQUENCE_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* reads all patterns of a pattern file or a pack, a pattern without a
+   duration gets DEFAULT_DURATION */
+int read_sequence(char *path, SEQUENCE *seq)
+{
+  int rc;
+  FRAMESRC src;
+
+  if ((rc = open_frames(path, &src)) != RET_SEQUENCE_OK)
+  {
+    goto EXIT;
+  }
+
+  rc = read_frames(&src, seq);
+  close_frames(&src);
+
+EXIT:
+  return rc;
+}
+
+
+/* the patterns of from, steps patterns of the effect and those of to,
+   failed is set to the one of the two files that could not be read */
+int read_transition(char *from, char *to, int effect, int steps,
+                    SEQUENCE *seq, char **failed)
+{
+  int rc;
+  FRAMESRC src;
+
+  *failed = from;
+  if ((rc = open_frames(from, &src)) != RET_SEQUENCE_OK)
+  {
+    goto EXIT;
+  }
+  if ((rc = open_transition(&src, to, effect, steps)) != RET_SEQUENCE_OK)
+  {
+    *failed = to;
+    goto CLOSE_EXIT;
+  }
+
+  /* src leaves its own frames before it reads the first one of to */
+  if (((rc = read_frames(&src, seq)) != RET_SEQUENCE_OK) && (src.step > 0))
+  {
+    *failed = to;
+  }
+
+CLOSE_EXIT:
+  close_frames(&src);
+
+EXIT:
+  return rc;
+}
+
+
+/* a path that is no file is looked up as <packfile>:<name> */
+int open_frames(char *path, FRAMESRC *src)
+{
+  int rc;
+  char *packfile;
+  char *name;
+
+  memset(src, 0, sizeof(*src));
+  init_sequence(&src->seq);
+
+  if (is_pnm(path))
+  {
+    if (open_pnm(path, &src->file) != RET_PNM_OK)
+    {
+      rc = RET_SEQUENCE_ERR_OPEN;
+      goto EXIT;
+    }
+    src->pnm = 1;
+    rc = RET_SEQUENCE_OK;
+    goto EXIT;
+  }
+
+  if (open_patternfile(path, &src->file) == RET_PATTERN_OK)
+  {
+    src->more = 1;
+    rc = RET_SEQUENCE_OK;
+    goto EXIT;
+  }
+  src->file = NULL;
+
+  if ((packfile = strdup(path)) == NULL)
+  {
+    rc = RET_SEQUENCE_ERR_MEMORY;
+    goto EXIT;
+  }
+  if ((name = strrchr(packfile, ':')) == NULL)
+  {
+    rc = RET_SEQUENCE_ERR_OPEN;
+    goto FREE_EXIT;
+  }
+  *name++ = '\0';
+
+  if (read_pack(packfile, name, &src->seq) != RET_PACK_OK)
+  {
+    free_sequence(&src->seq);
+    rc = RET_SEQUENCE_ERR_OPEN;
+    goto FREE_EXIT;
+  }
+
+  rc = RET_SEQUENCE_OK;
+
+FREE_EXIT:
+  free(packfile);
+
+EXIT:
+  return rc;
+}
+
+
+/* after the own frames of src come steps patterns of the effect, each
+   for DEFAULT_DURATION, then the frames of to */
+int open_transition(FRAMESRC *src, char *to, int effect, int steps)
+{
+  int rc;
+
+  if ((src->to = malloc(sizeof(FRAMESRC))) == NULL)
+  {
+    rc = RET_SEQUENCE_ERR_MEMORY;
+    goto EXIT;
+  }
+  if ((rc = open_frames(to, src->to)) != RET_SEQUENCE_OK)
+  {
+    free(src->to);
+    src->to = NULL;
+    goto EXIT;
+  }
+  src->effect = effect;
+  src->steps = steps;
+
+  rc = RET_SEQUENCE_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* the next pattern with its duration, RET_SEQUENCE_END after the last */
+int read_frame(FRAMESRC *src, unsigned char *pattern,
+               unsigned char *duration)
+{
+  int rc;
+
+  if (src->step == 0)
+  {
+    rc = read_own_frame(src, pattern, duration);
+    if (rc == RET_SEQUENCE_OK)
+    {
+      memcpy(src->last, pattern, LINES_PER_PATTERN);
+    }
+    if ((rc != RET_SEQUENCE_END) || (src->to == NULL))
+    {
+      return rc;
+    }
+
+    /* the effect needs the pattern it leads to */
+    src->step = 1;
+    if ((rc = read_frame(src->to, src->first, &src->first_duration)) !=
+        RET_SEQUENCE_OK)
+    {
+      return rc;
+    }
+  }
+
+  if (src->step <= src->steps)
+  {
+    make_effect(src->effect, src->last, src->first, src->step, src->steps,
+                pattern);
+    *duration = DEFAULT_DURATION;
+  }
+  else if (src->step == src->steps + 1)
+  {
+    memcpy(pattern, src->first, LINES_PER_PATTERN);
+    *duration = src->first_duration;
+  }
+  else
+  {
+    return read_frame(src->to, pattern, duration);
+  }
+  src->step++;
+
+  return RET_SEQUENCE_OK;
+}
+
+
+/* the next frame of the pattern file, the images or the pack */
+static int read_own_frame(FRAMESRC *src, unsigned char *pattern,
+                          unsigned char *duration)
+{
+  int c;
+  int rc;
+  unsigned char grey[PIXELS_PER_PATTERN];
+
+  if (src->file == NULL)
+  {
+    if (src->next == src->seq.nframes)
+    {
+      return RET_SEQUENCE_END;
+    }
+    memcpy(pattern, src->seq.frames[src->next].pattern, LINES_PER_PATTERN);
+    *duration = src->seq.frames[src->next].duration;
+    src->next++;
+    return RET_SEQUENCE_OK;
+  }
+
+  /* each image is one pattern, shown for the default duration */
+  if (src->pnm)
+  {
+    rc = read_pnm(src->file, cmd_options.crop ? PNM_CROP : PNM_SCALE, grey);
+    if (rc != RET_PNM_OK)
+    {
+      return (rc == RET_PNM_END) ? RET_SEQUENCE_END : RET_SEQUENCE_ERR_READ;
+    }
+    threshold_pnm(grey, (cmd_options.cutoff > 0) ? cmd_options.cutoff :
+                                                   DEFAULT_CUTOFF, pattern);
+    *duration = DEFAULT_DURATION;
+    return RET_SEQUENCE_OK;
+  }
+
+  if (!src->more)
+  {
+    return RET_SEQUENCE_END;
+  }
+  if (read_pattern(src->file, pattern) != RET_PATTERN_OK)
+  {
+    src->more = 0;
+    return RET_SEQUENCE_ERR_READ;
+  }
+
+  /* the separator line holds the duration, the last one is optional */
+  if (read_patternduration(src->file, duration) != RET_PATTERN_OK)
+  {
+    *duration = 0;
+    src->more = 0;
+  }
+  if (*duration == 0)
+  {
+    *duration = DEFAULT_DURATION;
+  }
+
+  /* a separator line after the last pattern ends the file as well */
+  if (src->more && (c = getc(src->file)) != EOF)
+  {
+    ungetc(c, src->file);
+  }
+  else
+  {
+    src->more = 0;
+  }
+
+  return RET_SEQUENCE_OK;
+}
+
+
+void close_frames(FRAMESRC *src)
+{
+  if (src->file != NULL)
+  {
+    if (src->pnm)
+    {
+      close_pnm(src->file);
+    }
+    else
+    {
+      close_patternfile(src->file);
+    }
+    src->file = NULL;
+  }
+  free_sequence(&src->seq);
+  if (src->to != NULL)
+  {
+    close_frames(src->to);
+    free(src->to);
+    src->to = NULL;
+  }
+}
+
+
+static int read_frames(FRAMESRC *src, SEQUENCE *seq)
+{
+  int rc;
+  unsigned char pattern[LINES_PER_PATTERN];
+  unsigned char duration;
+
+  while ((rc = read_frame(src, pattern, &duration)) == RET_SEQUENCE_OK)
+  {
+    if ((rc = add_frame(seq, pattern, duration)) != RET_SEQUENCE_OK)
+    {
+      return rc;
+    }
+  }
+
+  return (rc == RET_SEQUENCE_END) ? RET_SEQUENCE_OK : rc;
+}
+
+
+/* merges runs of identical frames into one frame showing the summed
+   duration, runs longer than MAX_DURATION are split,
+   returns the number of frames saved */
+int coalesce_sequence(SEQUENCE *seq)
+{
+  int in;
+  int out;
+  int saved;
+  FRAME *last;
+
+  if (seq->nframes == 0)
+  {
+    return 0;
+  }
+
+  out = 0;
+  for (in = 1; in < seq->nframes; in++)
+  {
+    last = &seq->frames[out];
+    if (memcmp(last->pattern, seq->frames[in].pattern,
+               LINES_PER_PATTERN) == 0)
+    {
+      if (last->duration + seq->frames[in].duration <= MAX_DURATION)
+      {
+        last->duration += seq->frames[in].duration;
+        continue;
+      }
+      seq->frames[in].duration -= MAX_DURATION - last->duration;
+      last->duration = MAX_DURATION;
+    }
+    out++;
+    seq->frames[out] = seq->frames[in];
+  }
+
+  saved = seq->nframes - (out + 1);
+  seq->nframes = out + 1;
+  return saved;
+}
+
+
+/* merges groups of consecutive frames until at most maxframes are left,
+   each group shows its first pattern for the summed duration, up to
+   MAX_DURATION, returns the number of frames saved */
+int downsample_sequence(SEQUENCE *seq, int maxframes)
+{
+  int first;
+  int end;
+  int sum;
+  int saved;
+  int i;
+  int j;
+
+  if (seq->nframes <= maxframes)
+  {
+    return 0;
+  }
+
+  /* group j begins at or after frame j, so it is moved down in place */
+  for (j = 0; j < maxframes; j++)
+  {
+    first = (long long) j * seq->nframes / maxframes;
+    end = (long long) (j + 1) * seq->nframes / maxframes;
+    sum = 0;
+    for (i = first; i < end; i++)
+    {
+      sum += seq->frames[i].duration;
+    }
+    seq->frames[j] = seq->frames[first];
+    seq->frames[j].duration = (sum < MAX_DURATION) ? sum : MAX_DURATION;
+  }
+
+  saved = seq->nframes - maxframes;
+  seq->nframes = maxframes;
+  return saved;
+}
+
+
+void free_sequence(SEQUENCE *seq)
+{
+  free(seq->frames);
+  init_sequence(seq);
+}
+
+
+/* encodes the store commands once, so they can be sent to many devices,
+   the first pattern replaces the stored ones, the others are appended */
+int encode_sequence(SEQUENCE *seq, ENCODED *enc)
+{
+  int rc;
+  int i;
+  int len;
+  unsigned char params[LINES_PER_PATTERN + 1];
+#define MAX_STORE_FRAME_LEN (1 + 2 * (2 + 1 + LINES_PER_PATTERN + 1 + 2))
+
+  enc->nframes = seq->nframes;
+  enc->data = malloc(seq->nframes * MAX_STORE_FRAME_LEN + 1);
+  enc->offsets = malloc((seq->nframes + 1) * sizeof(int));
+  if ((enc->data == NULL) || (enc->offsets == NULL))
+  {
+    free_encoded(enc);
+    rc = RET_SEQUENCE_ERR_MEMORY;
+    goto EXIT;
+  }
+
+  len = 0;
+  for (i = 0; i < seq->nframes; i++)
+  {
+    memcpy(params, seq->frames[i].pattern, LINES_PER_PATTERN);
+    params[LINES_PER_PATTERN] = seq->frames[i].duration;
+    enc->offsets[i] = len;
+    len += encode_command((i == 0) ? 'G' : 'I', LINES_PER_PATTERN + 1,
+                          params, enc->data + len);
+  }
+  enc->offsets[i] = len;
+
+  enc->hash = hash_bytes(HASH_INIT, (unsigned char *) seq->frames,
+                         seq->nframes * sizeof(FRAME));
+
+  rc = RET_SEQUENCE_OK;
+
+EXIT:
+  return rc;
+}
+
+
+void free_encoded(ENCODED *enc)
+{
+  free(enc->data);
+  free(enc->offsets);
+  enc->data = NULL;
+  enc->offsets = NULL;
+  enc->nframes = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#define RET_SEQUENCE_OK         (0)
+#define RET_SEQUENCE_ERR_OPEN   (1)
+#define RET_SEQUENCE_ERR_READ   (2)
+#define RET_SEQUENCE_ERR_MEMORY (3)
+#define RET_SEQUENCE_END        (4)   /* read_frame: no more frames */
+
+/* display duration in multiples of 100 ms */
+#define DEFAULT_DURATION (1)
+#define MAX_DURATION     (255)
+
+typedef struct {
+  unsigned char pattern[LINES_PER_PATTERN]; /* one byte per column */
+  unsigned char duration;                   /* multiples of 100 ms */
+} FRAME;
+
+typedef struct {
+  FRAME *frames;
+  int    nframes;
+  int    maxframes;
+} SEQUENCE;
+
+/* the store commands of a sequence as they go over the wire,
+   frame i is data[offsets[i]] up to data[offsets[i + 1]] */
+typedef struct {
+  unsigned char     *data;
+  int               *offsets;
+  int                nframes;
+  unsigned long long hash;        /* of the frames and durations */
+} ENCODED;
+
+/* where the frames of a command come from: a pattern file or a stream
+   of PBM/PGM images, read pattern by pattern, or an animation in a pack,
+   given as <packfile>:<name>, optionally followed by a transition into
+   the frames of another one */
+typedef struct framesrc FRAMESRC;
+
+struct framesrc {
+  FILE          *file;    /* NULL for an animation in a pack */
+  int            more;    /* the pattern file may hold another pattern */
+  int            pnm;     /* file holds PBM/PGM images, not text */
+  SEQUENCE       seq;     /* the frames of the animation in the pack */
+  int            next;
+  FRAMESRC      *to;      /* where the transition leads, NULL: none */
+  int            effect;
+  int            steps;
+  int            step;    /* 0: in the own frames, steps + 2: in to */
+  unsigned char  last[LINES_PER_PATTERN];   /* the own frame shown last */
+  unsigned char  first[LINES_PER_PATTERN];  /* the first one of to */
+  unsigned char  first_duration;
+};
+
+#if SEQUENCE_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN void init_sequence(SEQUENCE *seq);
+EXTERN int add_frame(SEQUENCE *seq, unsigned char *pattern,
+                     unsigned char duration);
+EXTERN int read_sequence(char *path, SEQUENCE *seq);
+EXTERN int read_transition(char *from, char *to, int effect, int steps,
+                           SEQUENCE *seq, char **failed);
+EXTERN int coalesce_sequence(SEQUENCE *seq);
+EXTERN int downsample_sequence(SEQUENCE *seq, int maxframes);
+EXTERN void free_sequence(SEQUENCE *seq);
+EXTERN int encode_sequence(SEQUENCE *seq, ENCODED *enc);
+EXTERN void free_encoded(ENCODED *enc);
+EXTERN int open_frames(char *path, FRAMESRC *src);
+EXTERN int open_transition(FRAMESRC *src, char *to, int effect, int steps);
+EXTERN int read_frame(FRAMESRC *src, unsigned char *pattern,
+                      unsigned char *duration);
+EXTERN void close_frames(FRAMESRC *src);
+
+#undef EXTERN
+
+#endif
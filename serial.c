@@ -7,6 +7,8 @@
 #  include <sys/select.h>
 #  include <errno.h>
 #  include <unistd.h>
+#  include <poll.h>
+#  include <sys/ioctl.h>
 #endif
 
 #if WIN
@@ -18,9 +20,38 @@
 #define SERIAL_SRC 1
 #include <serial.h>
 #undef SERIAL_SRC
+#include <uring.h>
+#include <clock.h>
+#include <trace.h>
+#include <probes.h>
+
+static int serial_backend = SERIAL_BACKEND_AUTO;
+
+PROBE_SEMAPHORE(open_serial);
+PROBE_SEMAPHORE(read_timeout);
+
+
+/* chooses the backend of transfer_serial, io_uring falls back to poll if
+   the kernel does not offer it, returns the backend that is used */
+int select_serial_backend(int backend)
+{
+  if ((backend != SERIAL_BACKEND_POLL) && (init_uring() == RET_URING_OK))
+  {
+    backend = SERIAL_BACKEND_URING;
+  }
+  else
+  {
+    backend = SERIAL_BACKEND_POLL;
+  }
+  __atomic_store_n(&serial_backend, backend, __ATOMIC_RELAXED);
+
+  return backend;
+}
 
 #if LINUX
 
+static int poll_transfer(SERIO *ios, int nios, int timeout_ms);
+
 int open_serial(char *serialport, SERHDL *hdl)
 {
   int rc;
@@ -67,15 +98,22 @@ int open_serial(char *serialport, SERHDL *hdl)
     goto EXIT;
   }
 
+  /* programs that do not queue in lock_port get EBUSY while we have it */
+  ioctl(*hdl, TIOCEXCL);
+
+  trace_open(*hdl, serialport);
   rc = RET_SERIAL_OK;
 
 EXIT:
+  PROBE2(open_serial, serialport, rc);
   return rc;
 }
 
 
 int close_serial(SERHDL hdl)
 {
+  /* a pty keeps the flag as long as its master is open */
+  ioctl(hdl, TIOCNXCL);
   close(hdl);
 
   return RET_SERIAL_OK;
@@ -99,6 +137,7 @@ int read_serial(SERHDL hdl, unsigned char *buf, int count)
   rc = select(hdl + 1, &readfds, NULL, NULL, &timeout);
   if (rc == 0)
   {
+    PROBE2(read_timeout, hdl, count);
     rc = -1;
     goto EXIT;
   }
@@ -115,6 +154,12 @@ int read_serial(SERHDL hdl, unsigned char *buf, int count)
     do
     {
       rc = read(hdl, pos, nread);
+      if (rc == 0)
+      {
+        /* ready but nothing to read, the device is gone */
+        errno = EIO;
+        rc = -1;
+      }
       if (rc != -1) 
       {
         pos = pos + rc;
@@ -124,6 +169,7 @@ int read_serial(SERHDL hdl, unsigned char *buf, int count)
     while ((rc != -1) && (nread > 0));
   }
   while ((rc == -1) && (errno == EAGAIN));
+  trace_bytes(hdl, TRACE_RX, buf, pos - buf);
 
 EXIT:
   return rc;
@@ -133,8 +179,190 @@ EXIT:
 int write_serial(SERHDL hdl, unsigned char *buf, int count)
 {
   int rc;
+  int nwritten;
+  fd_set writefds;
+
+  /* the port is opened with O_NDELAY, so wait until it takes more bytes */
+  nwritten = 0;
+  while (nwritten < count)
+  {
+    rc = write(hdl, buf + nwritten, count - nwritten);
+    if (rc == -1)
+    {
+      if (errno != EAGAIN)
+      {
+        goto EXIT;
+      }
+      FD_ZERO(&writefds);
+      FD_SET(hdl, &writefds);
+      if (select(hdl + 1, NULL, &writefds, NULL, NULL) == -1)
+      {
+        rc = -1;
+        goto EXIT;
+      }
+      continue;
+    }
+    nwritten += rc;
+  }
+
+  trace_bytes(hdl, TRACE_TX, buf, count);
+  rc = count;
+
+EXIT:
+  return rc;
+}
+
+
+/* Writes and reads a batch of exchanges on different ports at the same
+   time, until all are complete or timeout_ms has passed. Returns the
+   number of complete exchanges, the result of each one is in its rc. */
+int transfer_serial(SERIO *ios, int nios, int timeout_ms)
+{
+  int rc;
+  int i;
+  int backend;
+
+  /* threads of deploy may get here at the same time */
+  backend = __atomic_load_n(&serial_backend, __ATOMIC_RELAXED);
+  if (backend == SERIAL_BACKEND_AUTO)
+  {
+    backend = select_serial_backend(SERIAL_BACKEND_AUTO);
+  }
+
+  /* poll takes over only if io_uring has not sent anything, frames that
+     may have gone out are not sent twice */
+  if ((backend != SERIAL_BACKEND_URING) ||
+      (uring_transfer(ios, nios, timeout_ms) == RET_URING_ERR_SETUP))
+  {
+    poll_transfer(ios, nios, timeout_ms);
+  }
+
+  rc = 0;
+  for (i = 0; i < nios; i++)
+  {
+    if (ios[i].rc == ios[i].rxlen)
+    {
+      rc++;
+    }
+  }
+
+  return rc;
+}
+
+
+/* one poll() for all ports per round, then write or read what is ready */
+static int poll_transfer(SERIO *ios, int nios, int timeout_ms)
+{
+  int rc;
+  struct pollfd *fds;
+  int *index;
+  int *done;
+  int nfds;
+  int i;
+  int k;
+  long long deadline;
+  long long left;
+  SERIO *io;
+  unsigned char *pos;
+  int kind;
+
+  fds = calloc(nios, sizeof(struct pollfd));
+  index = calloc(nios, sizeof(int));
+  done = calloc(nios, sizeof(int));
+  if ((fds == NULL) || (index == NULL) || (done == NULL))
+  {
+    rc = -1;
+    goto FREE_EXIT;
+  }
+
+  /* done counts the bytes written, then the bytes read */
+  for (i = 0; i < nios; i++)
+  {
+    ios[i].rc = -1;
+  }
+
+  deadline = get_time_us() + (long long) timeout_ms * 1000;
+  for (;;)
+  {
+    nfds = 0;
+    for (i = 0; i < nios; i++)
+    {
+      io = &ios[i];
+      if (io->rc >= 0 || done[i] < 0)
+      {
+        continue;
+      }
+      if (done[i] == io->txlen + io->rxlen)
+      {
+        io->rc = io->rxlen;
+        continue;
+      }
+      fds[nfds].fd = io->hdl;
+      fds[nfds].events = (done[i] < io->txlen) ? POLLOUT : POLLIN;
+      fds[nfds].revents = 0;
+      index[nfds++] = i;
+    }
+    if (nfds == 0)
+    {
+      break;
+    }
+
+    left = deadline - get_time_us();
+    if (left <= 0)
+    {
+      break;
+    }
+    rc = poll(fds, nfds, (int) ((left + 999) / 1000));
+    if ((rc == -1) && (errno != EINTR))
+    {
+      goto FREE_EXIT;
+    }
+
+    for (k = 0; (rc > 0) && (k < nfds); k++)
+    {
+      if (fds[k].revents == 0)
+      {
+        continue;
+      }
+      i = index[k];
+      io = &ios[i];
+      if (fds[k].revents & POLLOUT)
+      {
+        kind = TRACE_TX;
+        pos = io->tx + done[i];
+        rc = write(io->hdl, pos, io->txlen - done[i]);
+      }
+      else
+      {
+        kind = TRACE_RX;
+        pos = io->rx + done[i] - io->txlen;
+        rc = read(io->hdl, pos, io->txlen + io->rxlen - done[i]);
+      }
+      if (rc > 0)
+      {
+        trace_bytes(io->hdl, kind, pos, rc);
+        done[i] += rc;
+        if (done[i] == io->txlen + io->rxlen)
+        {
+          io->done_us = get_time_us();
+        }
+      }
+      else if ((rc == 0) || (errno != EAGAIN))
+      {
+        /* port failed, no further tries */
+        done[i] = -1;
+      }
+      rc = 1;
+    }
+  }
+
+  rc = 0;
+
+FREE_EXIT:
+  free(done);
+  free(index);
+  free(fds);
 
-  rc = write(hdl, buf, count);
   return rc;
 }
 
@@ -203,12 +431,14 @@ int open_serial(char *serialport, SERHDL *hdl)
     goto FREE_EXIT;
   }
 
+  trace_open(*hdl, serialport);
   rc = RET_SERIAL_OK;
 
 FREE_EXIT:
   free(windows_serialport); 
 
 EXIT:
+  PROBE2(open_serial, serialport, rc);
   return rc;
 }
 
@@ -238,6 +468,11 @@ int read_serial(SERHDL hdl, unsigned char *buf, int count)
     goto EXIT;
   }
   
+  if (nread < count)
+  {
+    PROBE2(read_timeout, hdl, count);
+  }
+  trace_bytes(hdl, TRACE_RX, buf, nread);
   rc = nread;
 
 EXIT:
@@ -263,10 +498,38 @@ int write_serial(SERHDL hdl, unsigned char *buf, int count)
     ntowrite -= nwritten;
   }
   
+  trace_bytes(hdl, TRACE_TX, buf, count);
   rc = count;
 
 EXIT:
   return rc;
 }
 
+
+/* no overlapped I/O here, the exchanges are done one after the other */
+int transfer_serial(SERIO *ios, int nios, int timeout_ms)
+{
+  int rc;
+  int i;
+
+  rc = 0;
+  for (i = 0; i < nios; i++)
+  {
+    ios[i].rc = -1;
+    if (write_serial(ios[i].hdl, ios[i].tx, ios[i].txlen) != ios[i].txlen)
+    {
+      continue;
+    }
+    if ((ios[i].rxlen == 0) ||
+        (read_serial(ios[i].hdl, ios[i].rx, ios[i].rxlen) == ios[i].rxlen))
+    {
+      ios[i].rc = ios[i].rxlen;
+      ios[i].done_us = get_time_us();
+      rc++;
+    }
+  }
+
+  return rc;
+}
+
 #endif /* WIN */
@@ -12,6 +12,22 @@ typedef HANDLE SERHDL;
 #define RET_SERIAL_ERR_OPEN    (1)
 #define RET_SERIAL_ERR_SETATTR (2)
 
+/* backends of transfer_serial */
+#define SERIAL_BACKEND_AUTO  (0)  /* io_uring if available, else poll */
+#define SERIAL_BACKEND_POLL  (1)
+#define SERIAL_BACKEND_URING (2)
+
+/* one exchange of a batch: write txlen bytes, then read rxlen bytes */
+typedef struct {
+  SERHDL         hdl;
+  unsigned char *tx;
+  int            txlen;
+  unsigned char *rx;
+  int            rxlen;
+  int            rc;      /* rxlen when complete, -1 on error or timeout */
+  long long      done_us; /* get_time_us() when it was complete */
+} SERIO;
+
 #if SERIAL_SRC
 # define EXTERN 
 #else
@@ -22,6 +38,8 @@ EXTERN int open_serial(char *serialport, SERHDL *hdl);
 EXTERN int close_serial(SERHDL hdl);
 EXTERN int read_serial(SERHDL hdl, unsigned char *buf, int count);
 EXTERN int write_serial(SERHDL hdl, unsigned char *buf, int count);
+EXTERN int transfer_serial(SERIO *ios, int nios, int timeout_ms);
+EXTERN int select_serial_backend(int backend);
 
 
 #undef EXTERN
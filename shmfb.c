@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#if LINUX
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <errno.h>
+#  include <time.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/futex.h>
+#endif
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <clock.h>
+#include <pipeline.h>
+
+#define SHMFB_SRC 1
+#include <shmfb.h>
+#undef SHMFB_SRC
+
+#define MAX_SHMFB_NAME (256)
+
+#if LINUX
+
+static volatile sig_atomic_t stop;
+
+static void stop_handler(int sig);
+static void get_shmfb_name(char *device, char *name, int len);
+static int map_shmfb(char *device, int flags, SHMFB **fb);
+
+
+/* creates the frame buffer of a device, an existing one is reused */
+int create_shmfb(char *device, SHMFB **fb)
+{
+  int rc;
+
+  if ((rc = map_shmfb(device, O_RDWR | O_CREAT, fb)) != RET_SHMFB_OK)
+  {
+    goto EXIT;
+  }
+
+  if (((*fb)->magic != SHMFB_MAGIC) || ((*fb)->version != SHMFB_VERSION))
+  {
+    memset(*fb, 0, sizeof(SHMFB));
+    (*fb)->version = SHMFB_VERSION;
+    __atomic_store_n(&(*fb)->magic, SHMFB_MAGIC, __ATOMIC_RELEASE);
+  }
+
+EXIT:
+  return rc;
+}
+
+
+/* maps the frame buffer of a device for a producer */
+int attach_shmfb(char *device, SHMFB **fb)
+{
+  int rc;
+
+  if ((rc = map_shmfb(device, O_RDWR, fb)) != RET_SHMFB_OK)
+  {
+    goto EXIT;
+  }
+
+  if ((__atomic_load_n(&(*fb)->magic, __ATOMIC_ACQUIRE) != SHMFB_MAGIC) ||
+      ((*fb)->version != SHMFB_VERSION))
+  {
+    munmap(*fb, sizeof(SHMFB));
+    rc = RET_SHMFB_ERR_MAP;
+    goto EXIT;
+  }
+
+EXIT:
+  return rc;
+}
+
+
+int remove_shmfb(char *device, SHMFB *fb)
+{
+  char name[MAX_SHMFB_NAME];
+
+  munmap(fb, sizeof(SHMFB));
+  get_shmfb_name(device, name, sizeof(name));
+  shm_unlink(name);
+
+  return RET_SHMFB_OK;
+}
+
+
+/* publishes a frame, never blocks, one producer only */
+void write_shmfb(SHMFB *fb, unsigned char *frame)
+{
+  unsigned int generation;
+
+  /* a reader may still copy this half under the generation before the
+     last one, the last one must be visible before the first byte changes */
+  generation = __atomic_load_n(&fb->generation, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(fb->frame[(generation + 1) & 1], frame, LINES_PER_PATTERN);
+
+  /* a store followed by a load, both sequentially consistent as in
+     wait_shmfb, or the consumer may sleep past a new frame */
+  __atomic_store_n(&fb->generation, generation + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&fb->waiting, __ATOMIC_SEQ_CST))
+  {
+    syscall(SYS_futex, &fb->generation, FUTEX_WAKE, 1, NULL, NULL, 0);
+  }
+}
+
+
+/* copies the newest frame, returns its generation */
+unsigned int read_shmfb(SHMFB *fb, unsigned char *frame)
+{
+  unsigned int before;
+  unsigned int after;
+
+  /* the other half of the buffer is written meanwhile, a retry is only
+     needed if the producer has moved on to this half during the copy */
+  do
+  {
+    before = __atomic_load_n(&fb->generation, __ATOMIC_ACQUIRE);
+    memcpy(frame, fb->frame[before & 1], LINES_PER_PATTERN);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&fb->generation, __ATOMIC_RELAXED);
+  }
+  while (after != before);
+
+  return before;
+}
+
+
+/* sleeps until the generation differs from the given one, at most us */
+void wait_shmfb(SHMFB *fb, unsigned int generation, long long us)
+{
+  struct timespec timeout;
+
+  timeout.tv_sec = us / 1000000;
+  timeout.tv_nsec = (us % 1000000) * 1000;
+
+  __atomic_store_n(&fb->waiting, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&fb->generation, __ATOMIC_SEQ_CST) == generation)
+  {
+    syscall(SYS_futex, &fb->generation, FUTEX_WAIT, generation, &timeout,
+            NULL, 0);
+  }
+  __atomic_store_n(&fb->waiting, 0, __ATOMIC_RELEASE);
+}
+
+
+static void get_shmfb_name(char *device, char *name, int len)
+{
+  char *pos;
+
+  snprintf(name, len, "/mmm8x8%s%s", (device[0] == '/') ? "" : "_", device);
+  for (pos = name + 1; *pos != '\0'; pos++)
+  {
+    if (*pos == '/')
+    {
+      *pos = '_';
+    }
+  }
+}
+
+
+static int map_shmfb(char *device, int flags, SHMFB **fb)
+{
+  int rc;
+  int fd;
+  char name[MAX_SHMFB_NAME];
+  void *addr;
+
+  get_shmfb_name(device, name, sizeof(name));
+  /* only the user of the device writes frames to it */
+  if ((fd = shm_open(name, flags, 0600)) == -1)
+  {
+    rc = RET_SHMFB_ERR_OPEN;
+    goto EXIT;
+  }
+
+  if ((flags & O_CREAT) && (ftruncate(fd, sizeof(SHMFB)) == -1))
+  {
+    close(fd);
+    rc = RET_SHMFB_ERR_OPEN;
+    goto EXIT;
+  }
+
+  addr = mmap(NULL, sizeof(SHMFB), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+  {
+    rc = RET_SHMFB_ERR_MAP;
+    goto EXIT;
+  }
+  *fb = addr;
+
+  rc = RET_SHMFB_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* Sends the newest frame of the shared frame buffer whenever the link is
+   free, until interrupted. Generations written while a frame was on the
+   wire are skipped. */
+int serve_framebuffer(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  unsigned char pattern[LINES_PER_PATTERN];
+  SHMFB *fb;
+  PIPELINE pl;
+  unsigned int sent_generation;
+  unsigned int generation;
+  long sent;
+  long skipped;
+  long long start;
+#define IDLE_WAIT_US (100000)
+
+  if (create_shmfb(cmd_options.device, &fb) != RET_SHMFB_OK)
+  {
+    fprintf(stderr, "creating the frame buffer of %s has failed.\n",
+            cmd_options.device);
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
+  }
+  if ((rc = open_pipeline(hdl, &pl)) != RET_COMMAND_OK)
+  {
+    goto REMOVE_EXIT;
+  }
+
+  stop = 0;
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+
+  rc = RET_COMMAND_OK;
+  sent = 0;
+  skipped = 0;
+  start = get_time_us();
+  /* a frame left from an earlier run is shown first */
+  sent_generation = __atomic_load_n(&fb->generation, __ATOMIC_ACQUIRE);
+  if (sent_generation != 0)
+  {
+    sent_generation--;
+  }
+  while (!stop)
+  {
+    generation = read_shmfb(fb, pattern);
+    if (generation == sent_generation)
+    {
+      wait_shmfb(fb, generation, IDLE_WAIT_US);
+      continue;
+    }
+
+    rc = send_display(&pl, pattern);
+    if ((rc != RET_COMMAND_OK) && stop)
+    {
+      /* interrupted while waiting for the response */
+      rc = RET_COMMAND_OK;
+      break;
+    }
+    if (rc != RET_COMMAND_OK) 
+    {
+      fprintf(stderr, "sending command framebuffer has failed.\n");
+      break;
+    }
+
+    skipped += generation - sent_generation - 1;
+    sent_generation = generation;
+    sent++;
+  }
+
+  printf("%ld frames sent, %ld skipped in %lld ms\n", sent, skipped,
+         (get_time_us() - start) / 1000);
+  close_pipeline(&pl);
+
+REMOVE_EXIT:
+  remove_shmfb(cmd_options.device, fb);
+
+EXIT:
+  return rc;
+}
+
+
+static void stop_handler(int sig)
+{
+  stop = 1;
+}
+
+#endif /* LINUX */
+
+#if WIN
+
+int serve_framebuffer(SERHDL hdl, int myargc, char **myargv)
+{
+  fprintf(stderr, "framebuffer is not supported on this platform.\n");
+  return RET_COMMAND_ERR_READ;
+}
+
+#endif /* WIN */
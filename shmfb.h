@@ -0,0 +1,43 @@
+#ifndef SHMFB_H
+#define SHMFB_H
+
+#define RET_SHMFB_OK       (0)
+#define RET_SHMFB_ERR_OPEN (1)
+#define RET_SHMFB_ERR_MAP  (2)
+
+/* Shared memory frame buffer, one per device, named "/mmm8x8" followed by
+   the device path with '/' replaced by '_', e.g. /mmm8x8_dev_ttyUSB0.
+
+   A producer writes the next frame into frame[(generation + 1) & 1] and
+   then increments generation, so frame[generation & 1] is always the
+   newest complete frame. The frame is 8 bytes, one per column, bit 0 is
+   the top line. There must be only one producer per device at a time. */
+
+#define SHMFB_MAGIC   (0x384d4d4d)    /* "MMM8" */
+#define SHMFB_VERSION (1)
+
+typedef struct {
+  unsigned int  magic;
+  unsigned int  version;
+  unsigned int  generation;     /* frames written so far */
+  unsigned int  waiting;        /* the consumer sleeps on generation */
+  unsigned char frame[2][8];
+} SHMFB;
+
+#if SHMFB_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int create_shmfb(char *device, SHMFB **fb);
+EXTERN int attach_shmfb(char *device, SHMFB **fb);
+EXTERN int remove_shmfb(char *device, SHMFB *fb);
+EXTERN void write_shmfb(SHMFB *fb, unsigned char *frame);
+EXTERN unsigned int read_shmfb(SHMFB *fb, unsigned char *frame);
+EXTERN void wait_shmfb(SHMFB *fb, unsigned int generation, long long us);
+EXTERN int serve_framebuffer(SERHDL hdl, int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if LINUX
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/file.h>
+#endif
+
+#if WIN
+#  include <process.h>
+#  define getpid _getpid
+#endif
+
+#define STATE_SRC 1
+#include <state.h>
+#undef STATE_SRC
+
+/* State files are kept in $MMM8X8_STATE, $HOME or %USERPROFILE% as
+   .mmm8x8_<name>, one "key<TAB>value" record per line. */
+
+static int get_statefile(char *name, char *path, int len);
+static int rewrite_state(char *name, char *key, char *value);
+
+/* deploy stores from several threads, they share the temporary file;
+   invocations on other devices rewrite the same files at the same time,
+   they are kept apart by a flock on .mmm8x8_<name>.lock */
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+int read_state(char *name, char *key, char *value, int len)
+{
+  int rc;
+  char path[MAX_STATE_LINE];
+  char line[MAX_STATE_LINE];
+  FILE *file;
+  char *tab;
+  int keylen;
+
+  if ((rc = get_statefile(name, path, sizeof(path))) != RET_STATE_OK)
+  {
+    goto EXIT;
+  }
+
+  if ((file = fopen(path, "r")) == NULL)
+  {
+    rc = RET_STATE_ERR_NOTFOUND;
+    goto EXIT;
+  }
+
+  rc = RET_STATE_ERR_NOTFOUND;
+  keylen = strlen(key);
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    tab = strchr(line, '\t');
+    if ((tab == NULL) || (tab - line != keylen) ||
+        (strncmp(line, key, keylen) != 0))
+    {
+      continue;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    strncpy(value, tab + 1, len - 1);
+    value[len - 1] = '\0';
+    rc = RET_STATE_OK;
+    break;
+  }
+
+  fclose(file);
+
+EXIT:
+  return rc;
+}
+
+
+/* replaces the record for key, value NULL removes it */
+int write_state(char *name, char *key, char *value)
+{
+  int rc;
+#if LINUX
+  char path[MAX_STATE_LINE + 8];
+  int fd;
+#endif
+
+  pthread_mutex_lock(&state_lock);
+#if LINUX
+  if ((rc = get_statefile(name, path, MAX_STATE_LINE)) != RET_STATE_OK)
+  {
+    goto UNLOCK_EXIT;
+  }
+  strcat(path, ".lock");
+  if ((fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)) ==
+      -1)
+  {
+    rc = RET_STATE_ERR_WRITE;
+    goto UNLOCK_EXIT;
+  }
+  if (flock(fd, LOCK_EX) == -1)
+  {
+    close(fd);
+    rc = RET_STATE_ERR_WRITE;
+    goto UNLOCK_EXIT;
+  }
+#endif
+
+  rc = rewrite_state(name, key, value);
+
+#if LINUX
+  /* closing the file releases the flock */
+  close(fd);
+
+UNLOCK_EXIT:
+#endif
+  pthread_mutex_unlock(&state_lock);
+
+  return rc;
+}
+
+
+/* the file is rewritten into a temporary file and renamed */
+static int rewrite_state(char *name, char *key, char *value)
+{
+  int rc;
+  char path[MAX_STATE_LINE];
+  char tmppath[MAX_STATE_LINE + 16];
+  char line[MAX_STATE_LINE];
+  FILE *file;
+  FILE *newfile;
+  char *tab;
+  int keylen;
+
+  if ((rc = get_statefile(name, path, sizeof(path))) != RET_STATE_OK)
+  {
+    goto EXIT;
+  }
+
+  snprintf(tmppath, sizeof(tmppath), "%s.%d", path, (int) getpid());
+  if ((newfile = fopen(tmppath, "w")) == NULL)
+  {
+    rc = RET_STATE_ERR_WRITE;
+    goto EXIT;
+  }
+
+  /* copy all other records */
+  keylen = strlen(key);
+  if ((file = fopen(path, "r")) != NULL)
+  {
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+      tab = strchr(line, '\t');
+      if ((tab != NULL) && (tab - line == keylen) &&
+          (strncmp(line, key, keylen) == 0))
+      {
+        continue;
+      }
+      fputs(line, newfile);
+    }
+    fclose(file);
+  }
+
+  if (value != NULL)
+  {
+    fprintf(newfile, "%s\t%s\n", key, value);
+  }
+
+  if (fclose(newfile) != 0)
+  {
+    remove(tmppath);
+    rc = RET_STATE_ERR_WRITE;
+    goto EXIT;
+  }
+
+#if WIN
+  /* rename does not replace existing files on windows */
+  remove(path);
+#endif
+  if (rename(tmppath, path) != 0)
+  {
+    remove(tmppath);
+    rc = RET_STATE_ERR_WRITE;
+    goto EXIT;
+  }
+
+  rc = RET_STATE_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* 64 bit FNV-1a, start with HASH_INIT */
+unsigned long long hash_bytes(unsigned long long hash,
+                              unsigned char *buf, int len)
+{
+#define HASH_PRIME (0x100000001b3ULL)
+  int i;
+
+  for (i = 0; i < len; i++)
+  {
+    hash = (hash ^ buf[i]) * HASH_PRIME;
+  }
+
+  return hash;
+}
+
+
+static int get_statefile(char *name, char *path, int len)
+{
+  int rc;
+  char *dir;
+
+  if ((dir = getenv("MMM8X8_STATE")) == NULL)
+  {
+#if WIN
+    dir = getenv("USERPROFILE");
+#else
+    dir = getenv("HOME");
+#endif
+  }
+  if (dir == NULL)
+  {
+    rc = RET_STATE_ERR_OPEN;
+    goto EXIT;
+  }
+
+  if (snprintf(path, len, "%s/.mmm8x8_%s", dir, name) >= len)
+  {
+    rc = RET_STATE_ERR_OPEN;
+    goto EXIT;
+  }
+
+  rc = RET_STATE_OK;
+
+EXIT:
+  return rc;
+}
@@ -0,0 +1,26 @@
+#ifndef STATE_H
+#define STATE_H
+
+#define RET_STATE_OK          (0)
+#define RET_STATE_ERR_OPEN    (1)
+#define RET_STATE_ERR_NOTFOUND (2)
+#define RET_STATE_ERR_WRITE   (3)
+
+#define MAX_STATE_LINE (1024)
+
+#define HASH_INIT (0xcbf29ce484222325ULL)
+
+#if STATE_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int read_state(char *name, char *key, char *value, int len);
+EXTERN int write_state(char *name, char *key, char *value);
+EXTERN unsigned long long hash_bytes(unsigned long long hash,
+                                     unsigned char *buf, int len);
+
+#undef EXTERN
+
+#endif
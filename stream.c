@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if WIN
+#  include <io.h>
+#  include <fcntl.h>
+#endif
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <wire.h>
+#include <clock.h>
+#include <pnm.h>
+#include <pipeline.h>
+
+#define STREAM_SRC 1
+#include <stream.h>
+#undef STREAM_SRC
+
+/* Frames are read from stdin by a thread of their own into a single slot.
+   A frame that has not been sent when the next one arrives is replaced,
+   so a fast producer never builds up latency on the slow link.
+   The slot is freed by the last of its two users: a failed link returns
+   while the reader may still be blocked on stdin. */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t  ready;
+  unsigned char   pattern[LINES_PER_PATTERN];
+  int             full;         /* slot holds a frame not sent yet */
+  int             eof;          /* no more frames will come */
+  int             text;         /* .mmm text instead of raw columns */
+  int             pnm;          /* PBM/PGM images instead of raw columns */
+  int             users;        /* the sender and the reader */
+  long            received;
+  long            coalesced;
+} SLOT;
+
+static void *read_frames(void *arg);
+static void put_slot(SLOT *slot, unsigned char *pattern);
+static void release_slot(SLOT *slot);
+
+
+int stream_patterns(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+#define CMD_STREAM_RSP_LEN (6)
+  unsigned char pattern[LINES_PER_PATTERN];
+  unsigned char frame[MAX_FRAME_LEN];
+  SLOT *slot;
+  pthread_t reader;
+  PIPELINE pl;
+  long sent;
+  long long period;
+  long long next;
+  long long start;
+  int fps;
+
+  if ((slot = calloc(1, sizeof(SLOT))) == NULL)
+  {
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
+  }
+  if (strcmp(myargv[0], "text") == 0)
+  {
+    slot->text = 1;
+  }
+  else if (strcmp(myargv[0], "pnm") == 0)
+  {
+    slot->pnm = 1;
+  }
+  else if (strcmp(myargv[0], "raw") != 0)
+  {
+    fprintf(stderr, "stream format must be raw, text or pnm.\n");
+    rc = RET_COMMAND_ERR_READ;
+    goto FREE_EXIT;
+  }
+
+#if WIN
+  _setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+  if ((rc = open_pipeline(hdl, &pl)) != RET_COMMAND_OK)
+  {
+    goto FREE_EXIT;
+  }
+
+  /* with --fps the frames are sent no faster than that, the others are
+     coalesced, a rate above what the link sustains is reduced; pipelined
+     acknowledges come back while the next frame is sent */
+  period = 0;
+  if (cmd_options.fps > 0)
+  {
+    memset(pattern, 0, sizeof(pattern));
+    fps = admit_frame_rate(cmd_options.fps,
+                           encode_command('D', LINES_PER_PATTERN, pattern,
+                                          frame),
+                           pl.async ? 0 : CMD_STREAM_RSP_LEN);
+    period = 1000000 / fps;
+  }
+
+  pthread_mutex_init(&slot->lock, NULL);
+  pthread_cond_init(&slot->ready, NULL);
+  slot->users = 2;
+  if (pthread_create(&reader, NULL, read_frames, slot) != 0)
+  {
+    fprintf(stderr, "starting the stream reader has failed.\n");
+    close_pipeline(&pl);
+    slot->users = 1;
+    release_slot(slot);
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
+  }
+
+  rc = RET_COMMAND_OK;
+  sent = 0;
+  start = get_time_us();
+  next = start;
+  for (;;)
+  {
+    sleep_us(next - get_time_us());
+
+    /* take the newest frame */
+    pthread_mutex_lock(&slot->lock);
+    while (!slot->full && !slot->eof)
+    {
+      pthread_cond_wait(&slot->ready, &slot->lock);
+    }
+    if (!slot->full)
+    {
+      pthread_mutex_unlock(&slot->lock);
+      break;
+    }
+    memcpy(pattern, slot->pattern, LINES_PER_PATTERN);
+    slot->full = 0;
+    pthread_mutex_unlock(&slot->lock);
+
+    next = get_time_us() + period;
+    rc = send_display(&pl, pattern);
+    if (rc != RET_COMMAND_OK) 
+    {
+      fprintf(stderr, "sending command stream has failed.\n");
+      break;
+    }
+    sent++;
+  }
+  close_pipeline(&pl);
+
+  /* the reader ends with stdin, a failed link does not wait for that */
+  if (rc == RET_COMMAND_OK)
+  {
+    pthread_join(reader, NULL);
+  }
+  else
+  {
+    pthread_detach(reader);
+  }
+
+  pthread_mutex_lock(&slot->lock);
+  printf("%ld frames received, %ld sent, %ld coalesced in %lld ms\n",
+         slot->received, sent, slot->coalesced,
+         (get_time_us() - start) / 1000);
+  pthread_mutex_unlock(&slot->lock);
+  release_slot(slot);
+  goto EXIT;
+
+FREE_EXIT:
+  free(slot);
+
+EXIT:
+  return rc;
+}
+
+
+static void *read_frames(void *arg)
+{
+  SLOT *slot;
+  unsigned char pattern[LINES_PER_PATTERN];
+  unsigned char duration;
+  unsigned char grey[PIXELS_PER_PATTERN];
+
+  slot = arg;
+  for (;;)
+  {
+    if (slot->pnm)
+    {
+      if (read_pnm(stdin, cmd_options.crop ? PNM_CROP : PNM_SCALE, grey) !=
+          RET_PNM_OK)
+      {
+        break;
+      }
+      threshold_pnm(grey, (cmd_options.cutoff > 0) ? cmd_options.cutoff :
+                                                     DEFAULT_CUTOFF, pattern);
+      put_slot(slot, pattern);
+    }
+    else if (slot->text)
+    {
+      /* 8 lines, the separator line only follows once the next frame
+         is written, so it is read after the frame is passed on */
+      if (read_pattern(stdin, pattern) != RET_PATTERN_OK)
+      {
+        break;
+      }
+      put_slot(slot, pattern);
+      if (read_patternduration(stdin, &duration) != RET_PATTERN_OK)
+      {
+        break;
+      }
+    }
+    else
+    {
+      if (fread(pattern, 1, LINES_PER_PATTERN, stdin) != LINES_PER_PATTERN)
+      {
+        break;
+      }
+      put_slot(slot, pattern);
+    }
+  }
+
+  pthread_mutex_lock(&slot->lock);
+  slot->eof = 1;
+  pthread_cond_signal(&slot->ready);
+  pthread_mutex_unlock(&slot->lock);
+  release_slot(slot);
+
+  return NULL;
+}
+
+
+static void put_slot(SLOT *slot, unsigned char *pattern)
+{
+  pthread_mutex_lock(&slot->lock);
+  if (slot->full)
+  {
+    slot->coalesced++;
+  }
+  memcpy(slot->pattern, pattern, LINES_PER_PATTERN);
+  slot->full = 1;
+  slot->received++;
+  pthread_cond_signal(&slot->ready);
+  pthread_mutex_unlock(&slot->lock);
+}
+
+
+static void release_slot(SLOT *slot)
+{
+  int users;
+
+  pthread_mutex_lock(&slot->lock);
+  users = --slot->users;
+  pthread_mutex_unlock(&slot->lock);
+
+  if (users == 0)
+  {
+    pthread_cond_destroy(&slot->ready);
+    pthread_mutex_destroy(&slot->lock);
+    free(slot);
+  }
+}
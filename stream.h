@@ -0,0 +1,14 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#if STREAM_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int stream_patterns(SERHDL hdl, int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
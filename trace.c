@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <serial.h>
+#include <clock.h>
+
+#define TRACE_SRC 1
+#include <trace.h>
+#undef TRACE_SRC
+
+/* The ports write their records into a ring in memory and go on, a thread
+   writes the ring to the file every TRACE_FLUSH_US. A writer reserves its
+   space by moving head with a compare and swap, copies the record and
+   publishes it by setting its size last. The thread takes the records in
+   the order of their space up to the first one not yet published and
+   zeroes what it took. If the ring is full the record is dropped and
+   counted, a port never waits for the file. */
+
+#define TRACE_RING_SIZE  (1 << 20)
+#define TRACE_RING_MASK  (TRACE_RING_SIZE - 1)
+#define TRACE_FLUSH_US   (10000)
+
+typedef struct {
+  unsigned char     *ring;
+  unsigned long long head;      /* next free byte, ever increasing */
+  unsigned long long tail;      /* next byte to write to the file */
+  unsigned long long lost;      /* records dropped */
+  unsigned long long reported;  /* of them in TRACE_LOST records */
+  int                stop;
+  FILE              *file;
+  int                errors;    /* failed writes to the file */
+  pthread_t          thread;
+} TRACE;
+
+static TRACE trace;
+static int tracing;
+
+static void put_record(int kind, int device, void *payload, int length);
+static void copy_in(unsigned long long pos, void *src, int len);
+static void copy_out(unsigned long long pos, void *dest, int len);
+static void *flush_trace(void *arg);
+static int flush_ring(unsigned char *buf);
+static void write_record(TRACE_RECORD *rec, void *payload);
+
+
+/* opens the trace file and starts the thread writing it */
+int start_trace(char *path)
+{
+  int rc;
+
+  if ((trace.ring = calloc(TRACE_RING_SIZE, 1)) == NULL)
+  {
+    rc = RET_TRACE_ERR_OPEN;
+    goto EXIT;
+  }
+  if ((trace.file = fopen(path, "wb")) == NULL)
+  {
+    rc = RET_TRACE_ERR_OPEN;
+    goto FREE_EXIT;
+  }
+  if (fwrite(TRACE_MAGIC, TRACE_MAGIC_LEN, 1, trace.file) != 1)
+  {
+    rc = RET_TRACE_ERR_WRITE;
+    goto CLOSE_EXIT;
+  }
+
+  trace.head = 0;
+  trace.tail = 0;
+  trace.lost = 0;
+  trace.reported = 0;
+  trace.stop = 0;
+  trace.errors = 0;
+  if (pthread_create(&trace.thread, NULL, flush_trace, NULL) != 0)
+  {
+    rc = RET_TRACE_ERR_OPEN;
+    goto CLOSE_EXIT;
+  }
+
+  __atomic_store_n(&tracing, 1, __ATOMIC_RELEASE);
+  rc = RET_TRACE_OK;
+  goto EXIT;
+
+CLOSE_EXIT:
+  fclose(trace.file);
+
+FREE_EXIT:
+  free(trace.ring);
+
+EXIT:
+  return rc;
+}
+
+
+/* writes the rest of the ring and closes the file, no port may be in
+   use by another thread any more */
+int stop_trace(void)
+{
+  int rc;
+
+  if (!__atomic_load_n(&tracing, __ATOMIC_ACQUIRE))
+  {
+    return RET_TRACE_OK;
+  }
+  __atomic_store_n(&tracing, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&trace.stop, 1, __ATOMIC_RELEASE);
+  pthread_join(trace.thread, NULL);
+
+  if (fclose(trace.file) != 0)
+  {
+    trace.errors++;
+  }
+  free(trace.ring);
+
+  if (trace.lost > 0)
+  {
+    fprintf(stderr, "trace: %llu records dropped, the ring was full.\n",
+            trace.lost);
+  }
+  rc = (trace.errors == 0) ? RET_TRACE_OK : RET_TRACE_ERR_WRITE;
+
+  return rc;
+}
+
+
+void trace_open(SERHDL hdl, char *path)
+{
+  if (__atomic_load_n(&tracing, __ATOMIC_ACQUIRE))
+  {
+    put_record(TRACE_OPEN, (int) (intptr_t) hdl, path, strlen(path));
+  }
+}
+
+
+void trace_bytes(SERHDL hdl, int kind, unsigned char *buf, int count)
+{
+  int len;
+
+  if (!__atomic_load_n(&tracing, __ATOMIC_ACQUIRE))
+  {
+    return;
+  }
+
+  while (count > 0)
+  {
+    len = (count > TRACE_MAX_PAYLOAD) ? TRACE_MAX_PAYLOAD : count;
+    put_record(kind, (int) (intptr_t) hdl, buf, len);
+    buf += len;
+    count -= len;
+  }
+}
+
+
+/* opens a trace file for read_trace */
+int open_trace(char *path, FILE **file)
+{
+  int rc;
+  char magic[TRACE_MAGIC_LEN];
+
+  if ((*file = fopen(path, "rb")) == NULL)
+  {
+    rc = RET_TRACE_ERR_OPEN;
+    goto EXIT;
+  }
+  if ((fread(magic, TRACE_MAGIC_LEN, 1, *file) != 1) ||
+      (memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0))
+  {
+    fclose(*file);
+    rc = RET_TRACE_ERR_FORMAT;
+    goto EXIT;
+  }
+
+  rc = RET_TRACE_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* reads the next record, payload must hold TRACE_MAX_PAYLOAD bytes */
+int read_trace(FILE *file, TRACE_RECORD *rec, unsigned char *payload)
+{
+  unsigned char padding[8];
+  int npad;
+
+  if (fread(rec, sizeof(TRACE_RECORD), 1, file) != 1)
+  {
+    return feof(file) ? RET_TRACE_END : RET_TRACE_ERR_FORMAT;
+  }
+
+  npad = (int) rec->size - (int) sizeof(TRACE_RECORD) - rec->length;
+  if ((rec->length > TRACE_MAX_PAYLOAD) || (npad < 0) || (npad >= 8) ||
+      (fread(payload, 1, rec->length, file) != rec->length) ||
+      (fread(padding, 1, npad, file) != npad))
+  {
+    return RET_TRACE_ERR_FORMAT;
+  }
+
+  return RET_TRACE_OK;
+}
+
+
+static void put_record(int kind, int device, void *payload, int length)
+{
+  TRACE_RECORD rec;
+  unsigned long long head;
+  unsigned int size;
+
+  size = (sizeof(TRACE_RECORD) + length + 7) & ~7;
+  rec.size = 0;
+  rec.length = length;
+  rec.kind = kind;
+  rec.reserved = 0;
+  rec.device = device;
+  rec.reserved2 = 0;
+  rec.time_us = get_time_us();
+
+  head = __atomic_load_n(&trace.head, __ATOMIC_RELAXED);
+  do
+  {
+    if (head + size - __atomic_load_n(&trace.tail, __ATOMIC_ACQUIRE) >
+        TRACE_RING_SIZE)
+    {
+      __atomic_add_fetch(&trace.lost, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+  while (!__atomic_compare_exchange_n(&trace.head, &head, head + size, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  /* size is the first word of the record, it never wraps */
+  copy_in(head + sizeof(rec.size), (unsigned char *) &rec + sizeof(rec.size),
+          sizeof(rec) - sizeof(rec.size));
+  copy_in(head + sizeof(rec), payload, length);
+  __atomic_store_n((unsigned int *) (trace.ring + (head & TRACE_RING_MASK)),
+                   size, __ATOMIC_RELEASE);
+}
+
+
+static void copy_in(unsigned long long pos, void *src, int len)
+{
+  int offset;
+  int first;
+
+  offset = pos & TRACE_RING_MASK;
+  first = (len < TRACE_RING_SIZE - offset) ? len : TRACE_RING_SIZE - offset;
+  memcpy(trace.ring + offset, src, first);
+  memcpy(trace.ring, (unsigned char *) src + first, len - first);
+}
+
+
+/* copies the bytes out of the ring and zeroes them for the next round */
+static void copy_out(unsigned long long pos, void *dest, int len)
+{
+  int offset;
+  int first;
+
+  offset = pos & TRACE_RING_MASK;
+  first = (len < TRACE_RING_SIZE - offset) ? len : TRACE_RING_SIZE - offset;
+  memcpy(dest, trace.ring + offset, first);
+  memcpy((unsigned char *) dest + first, trace.ring, len - first);
+  memset(trace.ring + offset, 0, first);
+  memset(trace.ring, 0, len - first);
+}
+
+
+static void *flush_trace(void *arg)
+{
+  unsigned char *buf;
+  int stop;
+
+  if ((buf = malloc(sizeof(TRACE_RECORD) + TRACE_MAX_PAYLOAD + 8)) == NULL)
+  {
+    trace.errors++;
+    return NULL;
+  }
+
+  do
+  {
+    /* what was published before the stop is written in this round */
+    stop = __atomic_load_n(&trace.stop, __ATOMIC_ACQUIRE);
+    if (flush_ring(buf) > 0)
+    {
+      if (fflush(trace.file) != 0)
+      {
+        trace.errors++;
+      }
+    }
+    if (!stop)
+    {
+      sleep_us(TRACE_FLUSH_US);
+    }
+  }
+  while (!stop);
+
+  free(buf);
+
+  return NULL;
+}
+
+
+/* writes the published records to the file, returns their number */
+static int flush_ring(unsigned char *buf)
+{
+  TRACE_RECORD lost;
+  unsigned long long count;
+  unsigned long long tail;
+  unsigned int size;
+  int n;
+
+  n = 0;
+  tail = trace.tail;
+  while ((size = __atomic_load_n((unsigned int *)
+                                 (trace.ring + (tail & TRACE_RING_MASK)),
+                                 __ATOMIC_ACQUIRE)) != 0)
+  {
+    copy_out(tail, buf, size);
+    ((TRACE_RECORD *) buf)->size = size;
+    write_record((TRACE_RECORD *) buf, buf + sizeof(TRACE_RECORD));
+    tail += size;
+    __atomic_store_n(&trace.tail, tail, __ATOMIC_RELEASE);
+    n++;
+  }
+
+  count = __atomic_load_n(&trace.lost, __ATOMIC_RELAXED);
+  if (count != trace.reported)
+  {
+    memset(&lost, 0, sizeof(lost));
+    lost.size = sizeof(lost) + sizeof(count);
+    lost.length = sizeof(count);
+    lost.kind = TRACE_LOST;
+    lost.time_us = get_time_us();
+    count -= trace.reported;
+    write_record(&lost, &count);
+    trace.reported += count;
+    n++;
+  }
+
+  return n;
+}
+
+
+static void write_record(TRACE_RECORD *rec, void *payload)
+{
+  static unsigned char padding[8];
+
+  if ((fwrite(rec, sizeof(TRACE_RECORD), 1, trace.file) != 1) ||
+      (fwrite(payload, 1, rec->length, trace.file) != rec->length) ||
+      (fwrite(padding, 1, rec->size - sizeof(TRACE_RECORD) - rec->length,
+              trace.file) != rec->size - sizeof(TRACE_RECORD) - rec->length))
+  {
+    trace.errors++;
+  }
+}
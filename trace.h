@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#define RET_TRACE_OK         (0)
+#define RET_TRACE_ERR_OPEN   (1)
+#define RET_TRACE_ERR_WRITE  (2)
+#define RET_TRACE_ERR_FORMAT (3)
+#define RET_TRACE_END        (4)
+
+/* Binary trace of the bytes written to and read from the serial ports.
+   The file starts with TRACE_MAGIC, then follow the records, each one a
+   TRACE_RECORD and length bytes of payload, padded to a multiple of 8
+   bytes. The numbers are in the byte order of the host that wrote it.
+
+   TRACE_OPEN  a port was opened, the payload is its path, device is the
+               handle the port has until the next TRACE_OPEN with it
+   TRACE_TX    bytes written to the port, time is after the write
+   TRACE_RX    bytes read from the port, time is after the read
+   TRACE_LOST  the ring was full, the payload is the number of records
+               dropped since the last TRACE_LOST (unsigned long long) */
+
+#define TRACE_MAGIC        "MMM8TRC1"
+#define TRACE_MAGIC_LEN    (8)
+
+#define TRACE_OPEN         (1)
+#define TRACE_TX           (2)
+#define TRACE_RX           (3)
+#define TRACE_LOST         (4)
+
+#define TRACE_MAX_PAYLOAD  (4096)
+
+typedef struct {
+  unsigned int   size;        /* record with payload and padding */
+  unsigned short length;      /* payload bytes */
+  unsigned char  kind;
+  unsigned char  reserved;
+  int            device;
+  int            reserved2;
+  long long      time_us;     /* get_time_us() */
+} TRACE_RECORD;
+
+#if TRACE_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int start_trace(char *path);
+EXTERN int stop_trace(void);
+EXTERN void trace_open(SERHDL hdl, char *path);
+EXTERN void trace_bytes(SERHDL hdl, int kind, unsigned char *buf, int count);
+EXTERN int open_trace(char *path, FILE **file);
+EXTERN int read_trace(FILE *file, TRACE_RECORD *rec, unsigned char *payload);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,519 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <wire.h>
+#include <crc16.h>
+#include <trace.h>
+
+#define TRACEDEC_SRC 1
+#include <tracedec.h>
+#undef TRACEDEC_SRC
+
+/* Decoding of a trace written with --trace. The bytes written to a port
+   are unescaped into frames like the module does, the bytes read are cut
+   into responses by their length. A response belongs to the last command
+   sent to the port, a command that is followed by the next one or by the
+   end of the trace had no response. The latency of a command is the time
+   from its last byte handed to the port to the last byte of its response,
+   so it includes the time on the wire. */
+
+#define MAX_STATS (1024)
+
+typedef struct {
+  int           device;       /* handle of the port in the trace */
+  char          path[TRACE_MAX_PAYLOAD + 1];
+  WIRE_DECODER  tx;
+  unsigned char rx[MAX_RESPONSE_LEN];
+  int           nrx;
+  int           rxlen;        /* 0 until the length has been received */
+  EXCHANGE      exchange;
+  int           waiting;      /* exchange is sent, its response not yet in */
+} PORT;
+
+typedef struct {
+  PORT         **ports;
+  int            nports;
+  EXCHANGE_FCT   fct;
+  void          *arg;
+  TRACE_TOTALS  *totals;
+} SCAN;
+
+/* statistics of decode_trace per device and command */
+typedef struct {
+  char          *device;
+  unsigned char  command;
+  int            count;
+  int            naks;
+  int            unanswered;
+  int            bad_frames;
+  int            bad_responses;
+  long long      min_us;
+  long long      max_us;
+  long long      sum_us;
+  int            answered;
+} STAT;
+
+typedef struct {
+  STAT      stats[MAX_STATS];
+  int       nstats;
+  long long first_us;
+} DECODE;
+
+static PORT *find_port(SCAN *scan, int device);
+static PORT *add_port(SCAN *scan, int device, unsigned char *path, int len);
+static void sent_byte(SCAN *scan, PORT *port, unsigned char byte,
+                      long long time_us);
+static void received_byte(SCAN *scan, PORT *port, unsigned char byte,
+                          long long time_us);
+static void finish_exchange(SCAN *scan, PORT *port, long long time_us);
+static void print_exchange(EXCHANGE *exchange, void *arg);
+static STAT *find_stat(DECODE *decode, EXCHANGE *exchange);
+static void print_stats(DECODE *decode, TRACE_TOTALS *totals);
+static char *describe_response(EXCHANGE *exchange, char *text);
+
+
+/* reads the trace and calls fct for every command in it once its response
+   is in, the commands of a port in the order they were sent */
+int scan_trace(char *path, EXCHANGE_FCT fct, void *arg, TRACE_TOTALS *totals)
+{
+  int rc;
+  FILE *file;
+  TRACE_RECORD rec;
+  unsigned char *payload;
+  unsigned long long lost;
+  SCAN scan;
+  PORT *port;
+  int i;
+
+  memset(totals, 0, sizeof(TRACE_TOTALS));
+  memset(&scan, 0, sizeof(scan));
+  scan.fct = fct;
+  scan.arg = arg;
+  scan.totals = totals;
+
+  if ((payload = malloc(TRACE_MAX_PAYLOAD)) == NULL)
+  {
+    rc = RET_TRACEDEC_ERR_MEMORY;
+    goto EXIT;
+  }
+  if (open_trace(path, &file) != RET_TRACE_OK)
+  {
+    rc = RET_TRACEDEC_ERR_OPEN;
+    goto FREE_EXIT;
+  }
+
+  while ((rc = read_trace(file, &rec, payload)) == RET_TRACE_OK)
+  {
+    if (totals->records++ == 0)
+    {
+      totals->first_us = rec.time_us;
+    }
+    if (rec.time_us > totals->last_us)
+    {
+      totals->last_us = rec.time_us;
+    }
+
+    switch (rec.kind)
+    {
+    case TRACE_OPEN:
+      if ((port = find_port(&scan, rec.device)) != NULL)
+      {
+        finish_exchange(&scan, port, -1);
+        port->device = -1;
+      }
+      if (add_port(&scan, rec.device, payload, rec.length) == NULL)
+      {
+        rc = RET_TRACE_ERR_FORMAT;
+        goto CLOSE_EXIT;
+      }
+      break;
+
+    case TRACE_TX:
+    case TRACE_RX:
+      if ((port = find_port(&scan, rec.device)) == NULL)
+      {
+        /* opened before the trace was started */
+        if ((port = add_port(&scan, rec.device, (unsigned char *) "?", 1))
+            == NULL)
+        {
+          rc = RET_TRACE_ERR_FORMAT;
+          goto CLOSE_EXIT;
+        }
+      }
+      for (i = 0; i < rec.length; i++)
+      {
+        if (rec.kind == TRACE_TX)
+        {
+          sent_byte(&scan, port, payload[i], rec.time_us);
+        }
+        else
+        {
+          received_byte(&scan, port, payload[i], rec.time_us);
+        }
+      }
+      break;
+
+    case TRACE_LOST:
+      if (rec.length == sizeof(lost))
+      {
+        memcpy(&lost, payload, sizeof(lost));
+        totals->lost += lost;
+      }
+      break;
+    }
+  }
+
+  for (i = 0; i < scan.nports; i++)
+  {
+    finish_exchange(&scan, scan.ports[i], -1);
+  }
+
+CLOSE_EXIT:
+  rc = (rc == RET_TRACE_END) ? RET_TRACEDEC_OK : RET_TRACEDEC_ERR_FORMAT;
+  fclose(file);
+  for (i = 0; i < scan.nports; i++)
+  {
+    free(scan.ports[i]);
+  }
+  free(scan.ports);
+
+FREE_EXIT:
+  free(payload);
+
+EXIT:
+  return rc;
+}
+
+
+/* decode-trace <tracefile>: prints every command with its response and
+   latency, then the latencies per device and command */
+int decode_trace(int myargc, char **myargv)
+{
+  int rc;
+  DECODE *decode;
+  TRACE_TOTALS totals;
+
+  if ((decode = calloc(1, sizeof(DECODE))) == NULL)
+  {
+    rc = RET_TRACEDEC_ERR_MEMORY;
+    goto EXIT;
+  }
+  decode->first_us = -1;
+
+  rc = scan_trace(myargv[0], print_exchange, decode, &totals);
+  if (rc == RET_TRACEDEC_ERR_OPEN)
+  {
+    fprintf(stderr, "read of trace %s has failed.\n", myargv[0]);
+    goto FREE_EXIT;
+  }
+  if (rc == RET_TRACEDEC_ERR_FORMAT)
+  {
+    fprintf(stderr, "trace %s is damaged, the rest of it is skipped.\n",
+            myargv[0]);
+  }
+
+  print_stats(decode, &totals);
+
+FREE_EXIT:
+  free(decode);
+
+EXIT:
+  return rc;
+}
+
+
+/* the latest port opened with the handle */
+static PORT *find_port(SCAN *scan, int device)
+{
+  int i;
+
+  for (i = scan->nports - 1; i >= 0; i--)
+  {
+    if (scan->ports[i]->device == device)
+    {
+      return scan->ports[i];
+    }
+  }
+
+  return NULL;
+}
+
+
+static PORT *add_port(SCAN *scan, int device, unsigned char *path, int len)
+{
+  PORT **ports;
+  PORT *port;
+
+  if ((port = calloc(1, sizeof(PORT))) == NULL)
+  {
+    return NULL;
+  }
+  if ((ports = realloc(scan->ports, (scan->nports + 1) * sizeof(PORT *)))
+      == NULL)
+  {
+    free(port);
+    return NULL;
+  }
+  scan->ports = ports;
+  scan->ports[scan->nports++] = port;
+
+  port->device = device;
+  memcpy(port->path, path, len);
+  port->path[len] = '\0';
+  port->exchange.device = port->path;
+
+  return port;
+}
+
+
+static void sent_byte(SCAN *scan, PORT *port, unsigned char byte,
+                      long long time_us)
+{
+  int rc;
+  EXCHANGE *exchange;
+
+  if ((rc = decode_byte(&port->tx, byte)) == WIRE_PENDING)
+  {
+    return;
+  }
+
+  /* the previous command had no response */
+  finish_exchange(scan, port, -1);
+
+  exchange = &port->exchange;
+  exchange->sent_us = time_us;
+  exchange->command = port->tx.raw[2];
+  exchange->nparam = (port->tx.raw[0] << 8) + port->tx.raw[1] - 1;
+  memcpy(exchange->params, port->tx.raw + 3, exchange->nparam);
+  exchange->frame_ok = (rc == WIRE_FRAME);
+  exchange->rsplen = 0;
+  exchange->response_ok = 0;
+  port->waiting = 1;
+}
+
+
+/* responses are not escaped: STX, length high and low, payload, crc */
+static void received_byte(SCAN *scan, PORT *port, unsigned char byte,
+                          long long time_us)
+{
+  unsigned short crc16;
+  EXCHANGE *exchange;
+  int i;
+
+  if ((port->nrx == 0) && (byte != STX))
+  {
+    scan->totals->stray++;
+    return;
+  }
+
+  port->rx[port->nrx++] = byte;
+  if (port->nrx == 3)
+  {
+    port->rxlen = 3 + (port->rx[1] << 8) + port->rx[2] + 2;
+    if (port->rxlen > MAX_RESPONSE_LEN)
+    {
+      scan->totals->stray += port->nrx;
+      port->nrx = 0;
+      return;
+    }
+  }
+  if ((port->nrx < 3) || (port->nrx < port->rxlen))
+  {
+    return;
+  }
+
+  if (!port->waiting)
+  {
+    scan->totals->stray += port->nrx;
+    port->nrx = 0;
+    return;
+  }
+
+  crc16 = INITIAL_VALUE;
+  for (i = 0; i < port->rxlen - 2; i++)
+  {
+    crc16 = calc_crc16(crc16, port->rx[i]);
+  }
+
+  exchange = &port->exchange;
+  memcpy(exchange->response, port->rx, port->rxlen);
+  exchange->rsplen = port->rxlen;
+  exchange->response_ok = (port->rx[port->rxlen - 2] == (crc16 >> 8)) &&
+                          (port->rx[port->rxlen - 1] == (crc16 & 0xff));
+  port->nrx = 0;
+
+  finish_exchange(scan, port, time_us);
+}
+
+
+/* hands the exchange of the port over, time_us -1: without response */
+static void finish_exchange(SCAN *scan, PORT *port, long long time_us)
+{
+  if (!port->waiting)
+  {
+    return;
+  }
+  port->waiting = 0;
+
+  port->exchange.latency_us = (time_us >= 0) ?
+                              time_us - port->exchange.sent_us : -1;
+  scan->fct(&port->exchange, scan->arg);
+}
+
+
+static void print_exchange(EXCHANGE *exchange, void *arg)
+{
+  DECODE *decode;
+  STAT *stat;
+  char text[32];
+
+  decode = arg;
+  if (decode->first_us < 0)
+  {
+    decode->first_us = exchange->sent_us;
+  }
+
+  if (!cmd_options.quiet)
+  {
+    printf("%11.6f %-16s %c %3d%s  %-12s",
+           (exchange->sent_us - decode->first_us) / 1e6, exchange->device,
+           isprint(exchange->command) ? exchange->command : '?',
+           exchange->nparam, exchange->frame_ok ? "" : " bad crc",
+           describe_response(exchange, text));
+    if (exchange->latency_us >= 0)
+    {
+      printf(" %8.3f ms", exchange->latency_us / 1e3);
+    }
+    printf("\n");
+  }
+
+  if ((stat = find_stat(decode, exchange)) == NULL)
+  {
+    return;
+  }
+  stat->count++;
+  if (!exchange->frame_ok)
+  {
+    stat->bad_frames++;
+  }
+  if (exchange->latency_us < 0)
+  {
+    stat->unanswered++;
+    return;
+  }
+  if (!exchange->response_ok)
+  {
+    stat->bad_responses++;
+  }
+  if ((exchange->rsplen >= 6) && (exchange->response[3] == NAK))
+  {
+    stat->naks++;
+  }
+  if ((stat->answered == 0) || (exchange->latency_us < stat->min_us))
+  {
+    stat->min_us = exchange->latency_us;
+  }
+  if (exchange->latency_us > stat->max_us)
+  {
+    stat->max_us = exchange->latency_us;
+  }
+  stat->sum_us += exchange->latency_us;
+  stat->answered++;
+}
+
+
+static STAT *find_stat(DECODE *decode, EXCHANGE *exchange)
+{
+  STAT *stat;
+  int i;
+
+  for (i = 0; i < decode->nstats; i++)
+  {
+    stat = &decode->stats[i];
+    if ((stat->command == exchange->command) &&
+        (strcmp(stat->device, exchange->device) == 0))
+    {
+      return stat;
+    }
+  }
+  if ((decode->nstats == MAX_STATS) ||
+      ((decode->stats[i].device = strdup(exchange->device)) == NULL))
+  {
+    return NULL;
+  }
+  decode->stats[i].command = exchange->command;
+  decode->nstats++;
+
+  return &decode->stats[i];
+}
+
+
+static void print_stats(DECODE *decode, TRACE_TOTALS *totals)
+{
+  STAT *stat;
+  long long us;
+  int i;
+
+  us = totals->last_us - totals->first_us;
+  printf("%llu records, %lld.%03lld s, %llu dropped, %llu stray bytes\n",
+         totals->records, us / 1000000, us / 1000 % 1000, totals->lost,
+         totals->stray);
+  if (decode->nstats == 0)
+  {
+    return;
+  }
+
+  printf("%-16s cmd  count   nak  none  bad crc   min ms   avg ms   max ms\n",
+         "device");
+  for (i = 0; i < decode->nstats; i++)
+  {
+    stat = &decode->stats[i];
+    printf("%-16s  %c  %6d %5d %5d  %7d", stat->device,
+           isprint(stat->command) ? stat->command : '?', stat->count,
+           stat->naks, stat->unanswered,
+           stat->bad_frames + stat->bad_responses);
+    if (stat->answered > 0)
+    {
+      printf(" %8.3f %8.3f %8.3f", stat->min_us / 1e3,
+             (double) stat->sum_us / stat->answered / 1e3, stat->max_us / 1e3);
+    }
+    printf("\n");
+    free(stat->device);
+  }
+}
+
+
+static char *describe_response(EXCHANGE *exchange, char *text)
+{
+  if (exchange->latency_us < 0)
+  {
+    strcpy(text, "none");
+  }
+  else if ((exchange->rsplen == 12) && (exchange->response[3] != NAK))
+  {
+    sprintf(text, "v%d.%d.%d",
+            exchange->response[4] * 256 + exchange->response[5],
+            exchange->response[6] * 256 + exchange->response[7],
+            exchange->response[8] * 256 + exchange->response[9]);
+  }
+  else if ((exchange->rsplen >= 6) && (exchange->response[3] == NAK))
+  {
+    strcpy(text, "NAK");
+  }
+  else
+  {
+    strcpy(text, "ACK");
+  }
+  if ((exchange->latency_us >= 0) && !exchange->response_ok)
+  {
+    strcat(text, " bad crc");
+  }
+
+  return text;
+}
@@ -0,0 +1,49 @@
+#ifndef TRACEDEC_H
+#define TRACEDEC_H
+
+#define RET_TRACEDEC_OK         (0)
+#define RET_TRACEDEC_ERR_OPEN   (1)
+#define RET_TRACEDEC_ERR_FORMAT (2)
+#define RET_TRACEDEC_ERR_MEMORY (3)
+
+/* longest response: STX, two byte length, payload, crc */
+#define MAX_RESPONSE_LEN (3 + 255 + 2)
+
+/* a command of a trace and the response to it */
+typedef struct {
+  char          *device;      /* path of the port */
+  long long      sent_us;     /* time the last byte of the frame was written */
+  long long      latency_us;  /* until the last byte of the response, -1: none */
+  unsigned char  command;
+  unsigned char  params[MAX_PARAMS];
+  int            nparam;
+  int            frame_ok;    /* checksum of the command */
+  unsigned char  response[MAX_RESPONSE_LEN];   /* as received */
+  int            rsplen;
+  int            response_ok; /* checksum of the response */
+} EXCHANGE;
+
+/* totals of a trace */
+typedef struct {
+  unsigned long long records;
+  unsigned long long lost;    /* records dropped while tracing */
+  unsigned long long stray;   /* bytes received outside of a response */
+  long long          first_us;
+  long long          last_us;
+} TRACE_TOTALS;
+
+typedef void (*EXCHANGE_FCT)(EXCHANGE *exchange, void *arg);
+
+#if TRACEDEC_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int scan_trace(char *path, EXCHANGE_FCT fct, void *arg,
+                      TRACE_TOTALS *totals);
+EXTERN int decode_trace(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,588 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if LINUX && URING
+#  include <errno.h>
+#  include <poll.h>
+#  include <pthread.h>
+#  include <time.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+#endif
+
+#include <serial.h>
+#include <clock.h>
+#include <trace.h>
+
+#define URING_SRC 1
+#include <uring.h>
+#undef URING_SRC
+
+#if LINUX && URING
+
+/* The batch of transfer_serial goes through one io_uring. For each device
+   a linked chain of
+     WRITE -> POLL_ADD(POLLIN) -> READ
+   is queued, all chains are submitted and all their completions are
+   waited for with a single io_uring_enter. The poll is needed as the ports
+   are opened non-blocking, a READ on its own would just complete with
+   -EAGAIN. A WRITE that fails with -EAGAIN is retried behind a
+   POLL_ADD(POLLOUT). A short WRITE or READ ends its chain, once all parts
+   of a chain have completed the rest is queued again. When the timeout
+   expires the outstanding requests are cancelled. When io_uring_enter
+   fails they are cancelled as well and their exchanges fail, a frame that
+   may already be on the wire is never sent again.
+
+   Every thread has a ring of its own, as the deploy workers exchange
+   frames at the same time. It is closed when the thread ends.
+
+   liburing is not needed, the three system calls and the ring layout are
+   used directly as described in io_uring(7). */
+
+#define URING_ENTRIES  (1024)
+#define MAX_URING_IOS  (URING_ENTRIES / 4)
+#define MAX_URING_ERRORS (3)
+
+/* user_data is the batch, the index of the exchange and the step of its
+   chain, completions left over from an earlier batch are ignored */
+#define USER_DATA(i, step) \
+  (((__u64) batch_tag << 32) | ((i) << STEP_BITS) | (step))
+#define STEP_POLLOUT   (0)
+#define STEP_WRITE     (1)
+#define STEP_POLLIN    (2)
+#define STEP_READ      (3)
+#define STEP_CANCEL    (7)
+#define STEP_BITS      (3)
+#define STEP_MASK      ((1 << STEP_BITS) - 1)
+
+typedef struct {
+  int                  fd;
+  unsigned char       *ring;
+  size_t               ring_size;
+  size_t               sqes_size;
+  unsigned            *sq_head;
+  unsigned            *sq_tail;
+  unsigned            *sq_mask;
+  unsigned            *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned            *cq_head;
+  unsigned            *cq_tail;
+  unsigned            *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned             queued;    /* sqes not yet submitted */
+} RING;
+
+typedef struct {
+  int written;
+  int read;
+  int outstanding;                /* requests of the chain in flight */
+  int blocked;                    /* the last write found no room */
+  int failed;
+} XFER;
+
+static __thread RING uring;
+static __thread int uring_state;  /* 0: not tried, 1: ready, -1: failed */
+static __thread unsigned batch_tag;
+static pthread_key_t uring_key;   /* closes the ring at the thread's end */
+static pthread_once_t uring_once = PTHREAD_ONCE_INIT;
+
+static void create_uring_key(void);
+static void end_uring(void *arg);
+static void close_uring(void);
+static int transfer_batch(SERIO *ios, XFER *xfers, int nios,
+                          long long deadline);
+static int queue_chain(SERIO *ios, XFER *xfers, int i);
+static void queue_cancel(int i);
+static struct io_uring_sqe *get_sqe(void);
+static int submit_and_wait(int wait, long long deadline);
+static int complete_cqe(SERIO *ios, XFER *xfers, struct io_uring_cqe *cqe);
+
+
+/* sets up the ring once per thread */
+int init_uring(void)
+{
+  int rc;
+  struct io_uring_params params;
+  unsigned char *sq;
+  unsigned char *cq;
+  size_t sqsize;
+  size_t cqsize;
+
+  if (uring_state != 0)
+  {
+    rc = (uring_state > 0) ? RET_URING_OK : RET_URING_ERR_SETUP;
+    goto EXIT;
+  }
+  uring_state = -1;
+
+  memset(&params, 0, sizeof(params));
+  uring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if (uring.fd < 0)
+  {
+    rc = RET_URING_ERR_SETUP;
+    goto EXIT;
+  }
+
+  /* waiting with a timeout needs 5.11, the single mmap 5.4 */
+  if (!(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    close(uring.fd);
+    rc = RET_URING_ERR_SETUP;
+    goto EXIT;
+  }
+
+  sqsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqsize = params.cq_off.cqes +
+           params.cq_entries * sizeof(struct io_uring_cqe);
+  if (cqsize > sqsize)
+  {
+    sqsize = cqsize;
+  }
+  sq = mmap(NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            uring.fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED)
+  {
+    close(uring.fd);
+    rc = RET_URING_ERR_SETUP;
+    goto EXIT;
+  }
+  cq = sq;
+
+  uring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    uring.fd, IORING_OFF_SQES);
+  if (uring.sqes == MAP_FAILED)
+  {
+    munmap(sq, sqsize);
+    close(uring.fd);
+    rc = RET_URING_ERR_SETUP;
+    goto EXIT;
+  }
+
+  uring.ring = sq;
+  uring.ring_size = sqsize;
+  uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  uring.sq_head = (unsigned *) (sq + params.sq_off.head);
+  uring.sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  uring.sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+  uring.sq_array = (unsigned *) (sq + params.sq_off.array);
+  uring.cq_head = (unsigned *) (cq + params.cq_off.head);
+  uring.cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  uring.cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+  uring.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  uring_state = 1;
+  pthread_once(&uring_once, create_uring_key);
+  pthread_setspecific(uring_key, &uring);
+  rc = RET_URING_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static void create_uring_key(void)
+{
+  pthread_key_create(&uring_key, end_uring);
+}
+
+
+static void end_uring(void *arg)
+{
+  if (uring_state > 0)
+  {
+    close_uring();
+  }
+}
+
+
+/* gives up a ring that cannot be used any more, the later batches of the
+   thread go through poll. Unmapping it and closing its fd cancels what is
+   still in flight. */
+static void close_uring(void)
+{
+  munmap(uring.sqes, uring.sqes_size);
+  munmap(uring.ring, uring.ring_size);
+  close(uring.fd);
+  uring_state = -1;
+  pthread_setspecific(uring_key, NULL);
+}
+
+
+/* like transfer_serial, the batch is split if it is larger than the ring,
+   each part gets the whole timeout. RET_URING_ERR_SETUP means nothing has
+   been sent, with RET_URING_ERR_SUBMIT the exchanges that did not complete
+   have failed. */
+int uring_transfer(SERIO *ios, int nios, int timeout_ms)
+{
+  int rc;
+  XFER *xfers;
+  int i;
+  int first;
+  int n;
+
+  if ((rc = init_uring()) != RET_URING_OK)
+  {
+    goto EXIT;
+  }
+
+  if ((xfers = calloc(nios, sizeof(XFER))) == NULL)
+  {
+    rc = RET_URING_ERR_SETUP;
+    goto EXIT;
+  }
+
+  for (i = 0; i < nios; i++)
+  {
+    ios[i].rc = -1;
+  }
+
+  /* a silent device must not use up the time of the later parts */
+  rc = RET_URING_OK;
+  for (first = 0; (first < nios) && (uring_state > 0); first += n)
+  {
+    n = nios - first;
+    if (n > MAX_URING_IOS)
+    {
+      n = MAX_URING_IOS;
+    }
+    if (transfer_batch(ios + first, xfers + first, n,
+                       get_time_us() + (long long) timeout_ms * 1000) !=
+        RET_URING_OK)
+    {
+      rc = RET_URING_ERR_SUBMIT;
+    }
+  }
+  if (first < nios)
+  {
+    rc = RET_URING_ERR_SUBMIT;
+  }
+
+  free(xfers);
+
+EXIT:
+  return rc;
+}
+
+
+static int transfer_batch(SERIO *ios, XFER *xfers, int nios,
+                          long long deadline)
+{
+  int rc;
+  int i;
+  int pending;
+  int cancelled;
+  int errors;
+  unsigned head;
+  unsigned tail;
+
+  batch_tag++;
+
+  /* pending counts the completions still to come */
+  pending = 0;
+  for (i = 0; i < nios; i++)
+  {
+    pending += queue_chain(ios, xfers, i);
+  }
+
+  rc = RET_URING_OK;
+  cancelled = 0;
+  errors = 0;
+  while (pending > 0)
+  {
+    /* after cancelling, wait for the requests to give up their buffers */
+    if (submit_and_wait(cancelled ? 1 : pending,
+                        cancelled ? 0 : deadline) != 0)
+    {
+      /* a failed submit ends the batch like the timeout, the requests in
+         flight still own their buffers and are drained, not sent again.
+         Reaping the completions may make room for the next try. */
+      if (errno != ETIME)
+      {
+        rc = RET_URING_ERR_SUBMIT;
+        if (++errors > MAX_URING_ERRORS)
+        {
+          close_uring();
+          break;
+        }
+      }
+      for (i = 0; !cancelled && (i < nios); i++)
+      {
+        if (xfers[i].outstanding > 0)
+        {
+          queue_cancel(i);
+        }
+      }
+      cancelled = 1;
+    }
+
+    head = *uring.cq_head;
+    tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+      pending -= complete_cqe(ios, xfers, &uring.cqes[head & *uring.cq_mask]);
+      head++;
+    }
+    __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+
+    /* restart the chains that ended short */
+    for (i = 0; !cancelled && (i < nios); i++)
+    {
+      if ((xfers[i].outstanding == 0) && !xfers[i].failed &&
+          (ios[i].rc < 0))
+      {
+        pending += queue_chain(ios, xfers, i);
+      }
+    }
+  }
+
+  /* cancelled requests have released the buffers, errors are per device */
+  return rc;
+}
+
+
+/* queues what is left of exchange i as one linked chain,
+   returns the number of requests */
+static int queue_chain(SERIO *ios, XFER *xfers, int i)
+{
+  struct io_uring_sqe *sqe[4];
+  int n;
+  int k;
+
+  if ((xfers[i].written == ios[i].txlen) && (xfers[i].read == ios[i].rxlen))
+  {
+    ios[i].rc = ios[i].rxlen;
+    ios[i].done_us = get_time_us();
+    return 0;
+  }
+
+  n = 0;
+  if ((xfers[i].written < ios[i].txlen) && xfers[i].blocked)
+  {
+    sqe[n] = get_sqe();
+    sqe[n]->opcode = IORING_OP_POLL_ADD;
+    sqe[n]->fd = ios[i].hdl;
+    sqe[n]->poll32_events = POLLOUT;
+    sqe[n++]->user_data = USER_DATA(i, STEP_POLLOUT);
+  }
+  if (xfers[i].written < ios[i].txlen)
+  {
+    sqe[n] = get_sqe();
+    sqe[n]->opcode = IORING_OP_WRITE;
+    sqe[n]->fd = ios[i].hdl;
+    sqe[n]->off = (__u64) -1;
+    sqe[n]->addr = (unsigned long) (ios[i].tx + xfers[i].written);
+    sqe[n]->len = ios[i].txlen - xfers[i].written;
+    sqe[n++]->user_data = USER_DATA(i, STEP_WRITE);
+  }
+  if (xfers[i].read < ios[i].rxlen)
+  {
+    sqe[n] = get_sqe();
+    sqe[n]->opcode = IORING_OP_POLL_ADD;
+    sqe[n]->fd = ios[i].hdl;
+    sqe[n]->poll32_events = POLLIN;
+    sqe[n++]->user_data = USER_DATA(i, STEP_POLLIN);
+
+    sqe[n] = get_sqe();
+    sqe[n]->opcode = IORING_OP_READ;
+    sqe[n]->fd = ios[i].hdl;
+    sqe[n]->off = (__u64) -1;
+    sqe[n]->addr = (unsigned long) (ios[i].rx + xfers[i].read);
+    sqe[n]->len = ios[i].rxlen - xfers[i].read;
+    sqe[n++]->user_data = USER_DATA(i, STEP_READ);
+  }
+
+  for (k = 0; k < n - 1; k++)
+  {
+    sqe[k]->flags |= IOSQE_IO_LINK;
+  }
+  xfers[i].outstanding = n;
+
+  return n;
+}
+
+
+/* cancelling the running request of a chain fails the rest of it */
+static void queue_cancel(int i)
+{
+  struct io_uring_sqe *sqe;
+  int step;
+
+  for (step = STEP_POLLOUT; step <= STEP_READ; step++)
+  {
+    sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = USER_DATA(i, step);
+    sqe->user_data = USER_DATA(0, STEP_CANCEL);
+  }
+}
+
+
+/* next free sqe, cleared, submits the queued ones if the ring is full */
+static struct io_uring_sqe *get_sqe(void)
+{
+  struct io_uring_sqe *sqe;
+  unsigned tail;
+  unsigned index;
+
+  tail = *uring.sq_tail;
+  if (tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) ==
+      *uring.sq_mask + 1)
+  {
+    submit_and_wait(0, 0);
+    tail = *uring.sq_tail;
+  }
+
+  index = tail & *uring.sq_mask;
+  sqe = &uring.sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  uring.sq_array[index] = index;
+  __atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  uring.queued++;
+
+  return sqe;
+}
+
+
+/* submits the queued sqes, waits for wait completions,
+   until the deadline if it is not 0, returns -1 with errno ETIME
+   when the deadline has passed */
+static int submit_and_wait(int wait, long long deadline)
+{
+  int rc;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  long long left;
+  unsigned flags;
+
+  memset(&arg, 0, sizeof(arg));
+  flags = IORING_ENTER_EXT_ARG;
+  if (wait)
+  {
+    flags |= IORING_ENTER_GETEVENTS;
+    if (deadline != 0)
+    {
+      left = deadline - get_time_us();
+      if (left < 0)
+      {
+        left = 0;
+      }
+      ts.tv_sec = left / 1000000;
+      ts.tv_nsec = (left % 1000000) * 1000;
+      arg.ts = (unsigned long) &ts;
+    }
+  }
+
+  do
+  {
+    rc = syscall(__NR_io_uring_enter, uring.fd, uring.queued, wait, flags,
+                 &arg, sizeof(arg));
+    if (rc >= 0)
+    {
+      uring.queued -= rc;
+    }
+  }
+  while ((rc < 0) && (errno == EINTR));
+
+  /* completions that are already there count, the timeout does not */
+  if ((rc < 0) && (errno == ETIME) &&
+      (*uring.cq_head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE)))
+  {
+    rc = 0;
+  }
+
+  return (rc < 0) ? -1 : 0;
+}
+
+
+/* returns 1 for the completion of a queued request, 0 for a cancel or
+   one of an earlier batch */
+static int complete_cqe(SERIO *ios, XFER *xfers, struct io_uring_cqe *cqe)
+{
+  int i;
+  int step;
+  XFER *xfer;
+
+  step = cqe->user_data & STEP_MASK;
+  if (((cqe->user_data >> 32) != batch_tag) || (step == STEP_CANCEL))
+  {
+    return 0;
+  }
+  i = (cqe->user_data & 0xffffffff) >> STEP_BITS;
+  xfer = &xfers[i];
+  xfer->outstanding--;
+
+  /* the rest of a chain fails with -ECANCELED, it is queued again */
+  if ((step == STEP_WRITE) && (cqe->res == -EAGAIN))
+  {
+    xfer->blocked = 1;
+    return 1;
+  }
+  if ((cqe->res == -ECANCELED) || (cqe->res == -EAGAIN) ||
+      (cqe->res == -EINTR))
+  {
+    return 1;
+  }
+  if ((cqe->res < 0) ||
+      ((step == STEP_READ) && (cqe->res == 0)))
+  {
+    xfer->failed = 1;
+    return 1;
+  }
+
+  switch (step)
+  {
+  case STEP_WRITE:
+    trace_bytes(ios[i].hdl, TRACE_TX, ios[i].tx + xfer->written, cqe->res);
+    xfer->written += cqe->res;
+    xfer->blocked = 0;
+    break;
+
+  case STEP_READ:
+    trace_bytes(ios[i].hdl, TRACE_RX, ios[i].rx + xfer->read, cqe->res);
+    xfer->read += cqe->res;
+    if ((xfer->written == ios[i].txlen) && (xfer->read == ios[i].rxlen))
+    {
+      ios[i].rc = ios[i].rxlen;
+      ios[i].done_us = get_time_us();
+    }
+    break;
+
+  case STEP_POLLIN:
+  case STEP_POLLOUT:
+    if (cqe->res & (POLLERR | POLLHUP | POLLNVAL))
+    {
+      xfer->failed = 1;
+    }
+    break;
+  }
+
+  /* a write only exchange is complete with its last byte */
+  if ((xfer->written == ios[i].txlen) && (ios[i].rxlen == 0))
+  {
+    ios[i].rc = 0;
+    ios[i].done_us = get_time_us();
+  }
+
+  return 1;
+}
+
+#else
+
+int init_uring(void)
+{
+  return RET_URING_ERR_SETUP;
+}
+
+
+int uring_transfer(SERIO *ios, int nios, int timeout_ms)
+{
+  return RET_URING_ERR_SETUP;
+}
+
+#endif /* LINUX && URING */
@@ -0,0 +1,19 @@
+#ifndef URING_H
+#define URING_H
+
+#define RET_URING_OK          (0)
+#define RET_URING_ERR_SETUP   (1)
+#define RET_URING_ERR_SUBMIT  (2)
+
+#if URING_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int init_uring(void);
+EXTERN int uring_transfer(SERIO *ios, int nios, int timeout_ms);
+
+#undef EXTERN
+
+#endif
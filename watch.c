@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#if LINUX
+#  include <unistd.h>
+#  include <errno.h>
+#  include <poll.h>
+#  include <dirent.h>
+#  include <libgen.h>
+#  include <sys/stat.h>
+#  include <sys/inotify.h>
+#endif
+
+#include <serial.h>
+#include <pattern.h>
+#include <sequence.h>
+#include <command.h>
+#include <clock.h>
+#include <capacity.h>
+
+#define WATCH_SRC 1
+#include <watch.h>
+#undef WATCH_SRC
+
+#if LINUX
+
+/* "mmm8x8 <device> watch <file|directory>" stores the patterns of a file,
+   or of all pattern files and images of a directory one after the other
+   in the order of their names, and again whenever one of them changes,
+   until interrupted. The port stays open and locked meanwhile.
+
+   The directory is watched with inotify, so a file an editor replaces by
+   renaming is seen as well. Events are collected until none has come for
+   DEBOUNCE_MS, then only the files named by them are read again. The
+   patterns are stored only if they differ from the ones stored last. */
+
+#define DEBOUNCE_MS  (250)
+#define MAX_WATCHED  (1024)
+
+static const char *suffixes[] = { ".mmm", ".pbm", ".pgm", ".pnm" };
+
+typedef struct {
+  char     *name;
+  SEQUENCE  seq;
+  int       changed;      /* named by an event since it was read */
+  int       rc;
+} WATCHED;
+
+typedef struct {
+  char     *dir;
+  char     *file;         /* the one file watched, NULL: all of dir */
+  WATCHED  *entries;
+  int       nentries;
+  unsigned long long stored;      /* hash of the patterns stored last */
+} WATCH;
+
+static volatile sig_atomic_t stop;
+
+static void stop_handler(int sig);
+static int wait_for_changes(int fd, WATCH *watch);
+static void mark_changed(WATCH *watch, char *name);
+static int read_entries(WATCH *watch);
+static int is_watched(WATCH *watch, char *name);
+static int store_entries(SERHDL hdl, WATCH *watch);
+static void free_entries(WATCHED *entries, int nentries);
+static int compare_entries(const void *a, const void *b);
+
+
+int watch_patterns(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  WATCH watch;
+  struct stat st;
+  char *copy;
+  int fd;
+
+  memset(&watch, 0, sizeof(watch));
+  if (stat(myargv[0], &st) != 0)
+  {
+    fprintf(stderr, "%s does not exist.\n", myargv[0]);
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
+  }
+
+  /* a single file is watched through its directory */
+  copy = strdup(myargv[0]);
+  if (S_ISDIR(st.st_mode))
+  {
+    watch.dir = copy;
+  }
+  else
+  {
+    watch.dir = strdup(dirname(copy));
+    strcpy(copy, myargv[0]);
+    watch.file = strdup(basename(copy));
+    free(copy);
+  }
+
+  if (((fd = inotify_init1(IN_CLOEXEC)) < 0) ||
+      (inotify_add_watch(fd, watch.dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+                         IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF |
+                         IN_MOVE_SELF) < 0))
+  {
+    fprintf(stderr, "watching %s has failed.\n", watch.dir);
+    rc = RET_COMMAND_ERR_READ;
+    goto FREE_EXIT;
+  }
+
+  stop = 0;
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+
+  rc = RET_COMMAND_OK;
+  printf("watching %s, interrupt to end\n", myargv[0]);
+  while (!stop)
+  {
+    /* a file that can not be read may be written in the next moment */
+    if (read_entries(&watch) == RET_COMMAND_OK)
+    {
+      rc = store_entries(hdl, &watch);
+      if ((rc != RET_COMMAND_OK) && (rc != RET_COMMAND_ERR_FULL))
+      {
+        break;
+      }
+    }
+    fflush(stdout);
+
+    if ((rc = wait_for_changes(fd, &watch)) != RET_COMMAND_OK)
+    {
+      break;
+    }
+  }
+  if (stop)
+  {
+    rc = RET_COMMAND_OK;
+  }
+
+  close(fd);
+
+FREE_EXIT:
+  free_entries(watch.entries, watch.nentries);
+  free(watch.dir);
+  free(watch.file);
+
+EXIT:
+  return rc;
+}
+
+
+static void stop_handler(int sig)
+{
+  stop = 1;
+}
+
+
+/* blocks until a watched file has changed and no event has come for
+   DEBOUNCE_MS since */
+static int wait_for_changes(int fd, WATCH *watch)
+{
+  char buf[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *event;
+  struct pollfd pfd;
+  int timeout;
+  int changed;
+  int len;
+  int n;
+  int i;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  timeout = -1;
+  changed = 0;
+  while (!stop)
+  {
+    if ((n = poll(&pfd, 1, timeout)) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return RET_COMMAND_ERR_READ;
+    }
+    if (n == 0)
+    {
+      break;
+    }
+
+    if ((len = read(fd, buf, sizeof(buf))) <= 0)
+    {
+      return RET_COMMAND_ERR_READ;
+    }
+    for (i = 0; i < len; i += sizeof(struct inotify_event) + event->len)
+    {
+      event = (struct inotify_event *) (buf + i);
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+      {
+        fprintf(stderr, "%s has gone.\n", watch->dir);
+        return RET_COMMAND_ERR_READ;
+      }
+      if ((event->len > 0) && is_watched(watch, event->name))
+      {
+        mark_changed(watch, event->name);
+        changed = 1;
+      }
+    }
+
+    /* from the first change on, wait for a pause of the events */
+    if (changed)
+    {
+      timeout = DEBOUNCE_MS;
+    }
+  }
+
+  return RET_COMMAND_OK;
+}
+
+
+static void mark_changed(WATCH *watch, char *name)
+{
+  int i;
+
+  for (i = 0; i < watch->nentries; i++)
+  {
+    if (strcmp(watch->entries[i].name, name) == 0)
+    {
+      watch->entries[i].changed = 1;
+    }
+  }
+}
+
+
+/* lists the files that are watched now, those read before and not
+   changed since keep their patterns, the others are read */
+static int read_entries(WATCH *watch)
+{
+  int rc;
+  WATCHED *entries;
+  WATCHED *old;
+  DIR *handle;
+  struct dirent *ent;
+  char *path;
+  int nentries;
+  int i;
+
+  if ((entries = calloc(MAX_WATCHED, sizeof(WATCHED))) == NULL)
+  {
+    return RET_COMMAND_ERR_READ;
+  }
+  nentries = 0;
+  if ((handle = opendir(watch->dir)) != NULL)
+  {
+    while (((ent = readdir(handle)) != NULL) && (nentries < MAX_WATCHED))
+    {
+      if (is_watched(watch, ent->d_name))
+      {
+        entries[nentries].name = strdup(ent->d_name);
+        init_sequence(&entries[nentries].seq);
+        nentries++;
+      }
+    }
+    closedir(handle);
+  }
+  qsort(entries, nentries, sizeof(WATCHED), compare_entries);
+
+  rc = RET_COMMAND_OK;
+  for (i = 0; i < nentries; i++)
+  {
+    old = bsearch(&entries[i], watch->entries, watch->nentries,
+                  sizeof(WATCHED), compare_entries);
+    if ((old != NULL) && !old->changed && (old->rc == RET_SEQUENCE_OK))
+    {
+      entries[i].seq = old->seq;
+      init_sequence(&old->seq);
+      continue;
+    }
+
+    path = malloc(strlen(watch->dir) + 1 + strlen(entries[i].name) + 1);
+    sprintf(path, "%s/%s", watch->dir, entries[i].name);
+    entries[i].rc = read_sequence(path, &entries[i].seq);
+    if (entries[i].rc != RET_SEQUENCE_OK)
+    {
+      fprintf(stderr, "read of patternfile %s has failed, waiting for the "
+                      "next change\n", path);
+      rc = RET_COMMAND_ERR_READ;
+    }
+    else
+    {
+      printf("%s: %d patterns read\n", path, entries[i].seq.nframes);
+    }
+    free(path);
+  }
+
+  free_entries(watch->entries, watch->nentries);
+  watch->entries = entries;
+  watch->nentries = nentries;
+
+  if (nentries == 0)
+  {
+    fprintf(stderr, "no patterns in %s, waiting for the next change\n",
+            watch->dir);
+    rc = RET_COMMAND_ERR_READ;
+  }
+
+  return rc;
+}
+
+
+/* the file given, or a pattern file or image of the directory */
+static int is_watched(WATCH *watch, char *name)
+{
+  int len;
+  int i;
+
+  if (watch->file != NULL)
+  {
+    return (strcmp(name, watch->file) == 0);
+  }
+
+  len = strlen(name);
+  for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+  {
+    if ((len > strlen(suffixes[i])) &&
+        (strcmp(name + len - strlen(suffixes[i]), suffixes[i]) == 0))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/* the patterns of all files one after the other, stored if they differ
+   from the ones stored last */
+static int store_entries(SERHDL hdl, WATCH *watch)
+{
+  int rc;
+  SEQUENCE seq;
+  ENCODED enc;
+  FRAME *frame;
+  long long start;
+  int unchanged;
+  int i;
+  int j;
+
+  init_sequence(&seq);
+  rc = RET_COMMAND_OK;
+  for (i = 0; i < watch->nentries; i++)
+  {
+    for (j = 0; j < watch->entries[i].seq.nframes; j++)
+    {
+      frame = &watch->entries[i].seq.frames[j];
+      if (add_frame(&seq, frame->pattern, frame->duration) !=
+          RET_SEQUENCE_OK)
+      {
+        rc = RET_COMMAND_ERR_READ;
+        goto FREE_EXIT;
+      }
+    }
+  }
+  coalesce_sequence(&seq);
+  if ((rc = fit_sequence(hdl, cmd_options.device, &seq)) != RET_COMMAND_OK)
+  {
+    goto FREE_EXIT;
+  }
+
+  if (encode_sequence(&seq, &enc) != RET_SEQUENCE_OK)
+  {
+    rc = RET_COMMAND_ERR_READ;
+    goto FREE_EXIT;
+  }
+
+  if (enc.hash == watch->stored)
+  {
+    printf("patterns are unchanged, nothing to do.\n");
+  }
+  else
+  {
+    start = get_time_us();
+    rc = store_encoded(hdl, cmd_options.device, &enc, &unchanged);
+    if (rc == RET_COMMAND_OK)
+    {
+      watch->stored = enc.hash;
+      if (unchanged)
+      {
+        printf("patterns are already stored, nothing to do.\n");
+      }
+      else
+      {
+        printf("%d patterns stored in %lld ms\n", seq.nframes,
+               (get_time_us() - start) / 1000);
+      }
+    }
+  }
+  free_encoded(&enc);
+
+FREE_EXIT:
+  free_sequence(&seq);
+
+  return rc;
+}
+
+
+static void free_entries(WATCHED *entries, int nentries)
+{
+  int i;
+
+  for (i = 0; i < nentries; i++)
+  {
+    free(entries[i].name);
+    free_sequence(&entries[i].seq);
+  }
+  free(entries);
+}
+
+
+static int compare_entries(const void *a, const void *b)
+{
+  return strcmp(((WATCHED *) a)->name, ((WATCHED *) b)->name);
+}
+
+#endif /* LINUX */
+
+#if WIN
+
+int watch_patterns(SERHDL hdl, int myargc, char **myargv)
+{
+  fprintf(stderr, "watch is not supported on this platform.\n");
+  return RET_COMMAND_ERR_READ;
+}
+
+#endif /* WIN */
@@ -0,0 +1,14 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#if WATCH_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int watch_patterns(SERHDL hdl, int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
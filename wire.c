@@ -0,0 +1,174 @@
+#include <stdio.h>
+
+#include <crc16.h>
+
+#define WIRE_SRC 1
+#include <wire.h>
+#undef WIRE_SRC
+
+static void put_with_escape(unsigned char *frame, int *len,
+                            unsigned char byte, unsigned short *crc16);
+static void put_and_crc_byte(unsigned char *frame, int *len,
+                             unsigned char byte, unsigned short *crc16);
+
+
+/* builds the complete frame as it goes over the wire, returns its length,
+   frame must hold MAX_FRAME_LEN bytes */
+int encode_command(char command, int nparam, unsigned char *params,
+                   unsigned char *frame)
+{
+  int len;
+  unsigned short crc16;
+  unsigned short dummy;
+  int i;
+
+  /* set initial value for crc16 computation */
+  crc16 = INITIAL_VALUE;
+  len = 0;
+
+  /* start frame character */
+  put_and_crc_byte(frame, &len, STX, &crc16);
+
+  /* two byte length, command + params */
+  put_with_escape(frame, &len, 0, &crc16);
+  put_with_escape(frame, &len, 1 + nparam, &crc16);
+
+  /* command */
+  put_with_escape(frame, &len, command, &crc16);
+
+  /* params */
+  for (i = 0; i < nparam; i++)
+  {
+    put_with_escape(frame, &len, params[i], &crc16);
+  }
+
+  /* checksum CRC16 */
+  put_with_escape(frame, &len, (crc16 >> 8) & 0xff, &dummy);
+  put_with_escape(frame, &len, crc16 & 0xff, &dummy);
+
+  return len;
+}
+
+
+/* Unescapes the frames of a byte stream the way the module does. The
+   checksum covers the bytes as they were sent, escapes included, from STX
+   up to the last parameter. */
+int decode_byte(WIRE_DECODER *dec, unsigned char byte)
+{
+  int len;
+
+  if (byte == STX)
+  {
+    dec->inframe = 1;
+    dec->nraw = 0;
+    dec->escaped = 0;
+    dec->crc16 = calc_crc16(INITIAL_VALUE, byte);
+    return WIRE_PENDING;
+  }
+  if (!dec->inframe)
+  {
+    return WIRE_PENDING;
+  }
+
+  len = (dec->nraw >= 2) ? (dec->raw[0] << 8) + dec->raw[1] : 0;
+  if ((dec->nraw < 2) || (dec->nraw < 2 + len))
+  {
+    dec->crc16 = calc_crc16(dec->crc16, byte);
+  }
+
+  if (byte == ESC)
+  {
+    dec->escaped = 1;
+    return WIRE_PENDING;
+  }
+  if (dec->escaped)
+  {
+    byte &= ~FLAG;
+    dec->escaped = 0;
+  }
+  dec->raw[dec->nraw++] = byte;
+
+  if (dec->nraw == 2)
+  {
+    len = (dec->raw[0] << 8) + dec->raw[1];
+    if ((len == 0) || (2 + len + 2 > MAX_DECODED_LEN))
+    {
+      dec->inframe = 0;
+    }
+  }
+  else if ((dec->nraw > 2) && (dec->nraw == 2 + len + 2))
+  {
+    dec->inframe = 0;
+    if ((dec->raw[2 + len] == (dec->crc16 >> 8)) &&
+        (dec->raw[2 + len + 1] == (dec->crc16 & 0xff)))
+    {
+      return WIRE_FRAME;
+    }
+    return WIRE_BADCRC;
+  }
+
+  return WIRE_PENDING;
+}
+
+
+/* time the given number of bytes take on the link */
+long wire_time_us(long bytes)
+{
+  return (long) ((long long) bytes * BITS_PER_BYTE * 1000000 / BAUDRATE);
+}
+
+
+/* Frames per second the link sustains if every frame of framelen bytes
+   has to be acknowledged with rsplen bytes before the next one is sent.
+   The processing time of the module is not known and not included. */
+int max_frame_rate(int framelen, int rsplen)
+{
+  return (BAUDRATE / BITS_PER_BYTE) / (framelen + rsplen);
+}
+
+
+/* limits a requested frame rate to what the link sustains */
+int admit_frame_rate(int fps, int framelen, int rsplen)
+{
+  int maxfps;
+
+  maxfps = max_frame_rate(framelen, rsplen);
+  if (fps > maxfps)
+  {
+    fprintf(stderr, "%d frames/s requested, the link sustains at most %d "
+                    "frames/s of %d bytes.\n", fps, maxfps, framelen);
+    fps = maxfps;
+  }
+
+  return fps;
+}
+
+
+static void put_with_escape(unsigned char *frame, int *len,
+                            unsigned char byte, unsigned short *crc16)
+{
+  switch (byte)
+  {
+    case STX:
+      put_and_crc_byte(frame, len, ESC, crc16);
+      put_and_crc_byte(frame, len, STX | FLAG, crc16);
+      break;
+
+    case ESC:
+      put_and_crc_byte(frame, len, ESC, crc16);
+      put_and_crc_byte(frame, len, ESC | FLAG, crc16);
+      break;
+
+    default:
+      put_and_crc_byte(frame, len, byte, crc16);
+      break;
+  }
+}
+
+
+static void put_and_crc_byte(unsigned char *frame, int *len,
+                             unsigned char byte, unsigned short *crc16)
+{
+  frame[(*len)++] = byte;
+  *crc16 = calc_crc16(*crc16, byte);
+}
@@ -0,0 +1,50 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+/* framing of the MMM8x8 protocol */
+#define STX 0x02
+#define ESC 0x10
+#define FLAG 0x80
+#define NAK 0x15
+
+/* longest frame: STX, everything else escaped, at most 255 params */
+#define MAX_PARAMS (255 - 1)
+#define MAX_FRAME_LEN (1 + 2 * (2 + 1 + MAX_PARAMS + 2))
+
+/* a frame as the module sees it, unescaped: length, command, params, crc */
+#define MAX_DECODED_LEN (2 + 1 + MAX_PARAMS + 2)
+
+/* results of decode_byte */
+#define WIRE_PENDING (0)  /* no complete frame yet */
+#define WIRE_FRAME   (1)  /* raw holds a complete frame */
+#define WIRE_BADCRC  (2)  /* raw holds a complete frame, checksum is wrong */
+
+/* state of decode_byte, all zero before the first byte */
+typedef struct {
+  unsigned char  raw[MAX_DECODED_LEN];
+  int            nraw;
+  int            inframe;
+  int            escaped;
+  unsigned short crc16;
+} WIRE_DECODER;
+
+/* the link runs at 38400,8,N,1: start bit, 8 data bits, stop bit */
+#define BAUDRATE      (38400)
+#define BITS_PER_BYTE (10)
+
+#if WIRE_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int encode_command(char command, int nparam, unsigned char *params,
+                          unsigned char *frame);
+EXTERN int decode_byte(WIRE_DECODER *dec, unsigned char byte);
+EXTERN long wire_time_us(long bytes);
+EXTERN int max_frame_rate(int framelen, int rsplen);
+EXTERN int admit_frame_rate(int fps, int framelen, int rsplen);
+
+#undef EXTERN
+
+#endif